@@ -0,0 +1,81 @@
+#include "arena.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+const size_t arena_alignment = 64;
+
+size_t arena_align_up(size_t size) {
+    return (size + arena_alignment - 1) & ~(arena_alignment - 1);
+}
+
+void arena_init(struct Arena* arena, size_t capacity) {
+    arena->capacity = arena_align_up(capacity);
+    arena->base = (char*) aligned_alloc(arena_alignment, arena->capacity);
+    arena->offset = 0;
+    arena->overflow = NULL;
+    arena->overflow_used = 0;
+    arena->peak = 0;
+    arena->allocations = 0;
+    arena->system_allocations = 1;
+}
+
+void* arena_alloc(struct Arena* arena, size_t size) {
+    size = arena_align_up(size);
+    arena->allocations++;
+    if (arena->offset + size <= arena->capacity) {
+        void* ptr = arena->base + arena->offset;
+        arena->offset += size;
+        if (arena->offset + arena->overflow_used > arena->peak) {
+            arena->peak = arena->offset + arena->overflow_used;
+        }
+        return ptr;
+    }
+    // The main block cannot move while this frame's pointers are live, so
+    // spill into a side block and fold it into the main one on reset.
+    size_t header = arena_align_up(sizeof(struct ArenaBlock));
+    struct ArenaBlock* block = (struct ArenaBlock*) aligned_alloc(arena_alignment, header + size);
+    if (!block) {
+        fprintf(stderr, "Arena failed to allocate %zu bytes!\n", size);
+        exit(1);
+    }
+    block->next = arena->overflow;
+    block->size = size;
+    arena->overflow = block;
+    arena->overflow_used += size;
+    arena->system_allocations++;
+    if (arena->offset + arena->overflow_used > arena->peak) {
+        arena->peak = arena->offset + arena->overflow_used;
+    }
+    return (char*) block + header;
+}
+
+void arena_reset(struct Arena* arena) {
+    if (arena->overflow) {
+        while (arena->overflow) {
+            struct ArenaBlock* next = arena->overflow->next;
+            free(arena->overflow);
+            arena->overflow = next;
+        }
+        // Leave headroom so a slowly growing workload does not spill every frame.
+        size_t capacity = arena_align_up(arena->peak + arena->peak/2);
+        free(arena->base);
+        arena->base = (char*) aligned_alloc(arena_alignment, capacity);
+        arena->capacity = capacity;
+        arena->system_allocations++;
+    }
+    arena->offset = 0;
+    arena->overflow_used = 0;
+}
+
+void arena_free(struct Arena* arena) {
+    arena_reset(arena);
+    free(arena->base);
+    arena->base = NULL;
+    arena->capacity = 0;
+}
+
+void arena_print_stats(const struct Arena* arena, const char* name) {
+    printf("%s arena: peak %zu bytes of %zu, %zu allocations, %zu system allocations\n",
+        name, arena->peak, arena->capacity, arena->allocations, arena->system_allocations);
+}
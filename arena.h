@@ -0,0 +1,32 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// Linear (bump) allocator for data that only lives for one simulation step or
+// one rendered frame. arena_reset() releases everything at once; if a frame
+// overflowed the block, the reset grows it to the observed peak so that
+// steady-state frames never touch malloc.
+struct ArenaBlock {
+    struct ArenaBlock* next;
+    size_t size;
+};
+
+struct Arena {
+    char* base;
+    size_t capacity;
+    size_t offset;
+    struct ArenaBlock* overflow;
+    size_t overflow_used;
+    size_t peak;
+    size_t allocations;
+    size_t system_allocations;
+};
+
+void arena_init(struct Arena* arena, size_t capacity);
+void* arena_alloc(struct Arena* arena, size_t size);
+void arena_reset(struct Arena* arena);
+void arena_free(struct Arena* arena);
+void arena_print_stats(const struct Arena* arena, const char* name);
+
+#endif
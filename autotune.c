@@ -0,0 +1,232 @@
+#include "autotune.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "simulation.h"
+
+// Opening angles tried for the tree force modes, from most to least accurate.
+static const float autotune_angles[] = {0.2f, 0.3f, 0.5f, 0.7f, 1.0f};
+static const int num_angles = sizeof(autotune_angles)/sizeof(autotune_angles[0]);
+// Every exact sum costs a pass over all bodies, so the sample shrinks as the
+// count grows, down to this many.
+static const long autotune_sample_pairs = 1 << 24;
+static const int autotune_min_samples = 32;
+// Each trial times steps until this long has passed or it has taken the
+// most steps, after one untimed step that builds what later steps only
+// update. Small systems get enough steps to average out noise; large ones
+// are measured on a single step.
+static const double autotune_trial_time = 0.02;
+static const int autotune_max_trial_steps = 16;
+
+static const char* force_mode_name(int mode) {
+    switch (mode) {
+    case DIRECT_SUM: return "direct sum";
+    case BARNES_HUT: return "barnes-hut";
+    case LINEAR_BVH: return "linear bvh";
+    default: return "?";
+    }
+}
+
+static const char* broad_phase_name(int phase) {
+    switch (phase) {
+    case TREE_OR_ALL_PAIRS: return "tree or all pairs";
+    case SWEEP_AND_PRUNE: return "sweep and prune";
+    case UNIFORM_GRID: return "uniform grid";
+    case VERLET_LIST: return "verlet list";
+    default: return "?";
+    }
+}
+
+int autotune_due(int num_points) {
+    return num_points > 1 && (autotune_count == 0 || num_points <= autotune_count*autotune_drop);
+}
+
+// Seconds per step of the current configuration on a fresh copy of bodies.
+template <int D>
+static double trial_step(const particle<D>* bodies, int num_points, particle<D>* scratch, quadtree<D>* tree) {
+    memcpy(scratch, bodies, sizeof(particle<D>)*num_points);
+    int n = num_points;
+    simulation_reset(num_points);
+    iterate(scratch, &n, tree);
+    double start = wall_time();
+    double elapsed = 0.0;
+    int steps = 0;
+    while (steps < autotune_max_trial_steps && elapsed < autotune_trial_time) {
+        iterate(scratch, &n, tree);
+        steps++;
+        elapsed = wall_time() - start;
+    }
+    elapsed /= steps;
+    simulation_release();
+    return elapsed;
+}
+
+template <int D>
+void autotune_run(const particle<D>* points, int num_points, quadtree<D>* tree) {
+    struct SimulationState live;
+    simulation_save(&live);
+    autotune = 0;
+    printf("autotune: %d bodies at step %ld, field error budget %.1e\n", num_points, step_count, autotune_error_budget);
+
+    // Trials run on a fresh index, which needs ids 0..num_points-1.
+    particle<D>* bodies = (particle<D>*) malloc(sizeof(particle<D>)*num_points);
+    particle<D>* scratch = (particle<D>*) malloc(sizeof(particle<D>)*num_points);
+    for (int i = 0; i < num_points; i++) {
+        bodies[i] = points[i];
+        bodies[i].id = i;
+        bodies[i].lineage = -1;
+    }
+
+    long wanted = autotune_sample_pairs/num_points;
+    int samples = (int) (wanted < autotune_min_samples ? autotune_min_samples : wanted);
+    if (samples > num_points) {
+        samples = num_points;
+    }
+    vec<D>* exact = (vec<D>*) malloc(sizeof(vec<D>)*samples);
+    double start = wall_time();
+    task_for(&task_pool, 0, samples, 1, [&](int begin, int end) {
+        for (int s = begin; s < end; s++) {
+            int i = (int) ((long) s*num_points/samples);
+            vec<D> field = vec_zero<D>();
+            for (int k = 0; k < num_points; k++) {
+                if (k != i && bodies[k].mass >= passive_mass_threshold) {
+                    vec<D> delta = bodies[k].position - bodies[i].position;
+                    float distance_sq = dot(delta, delta);
+                    field += delta * (bodies[k].mass/(distance_sq*sqrtf(distance_sq)));
+                }
+            }
+            exact[s] = field;
+        }
+    });
+    // The samples are a direct force pass over a fraction of the bodies.
+    double direct_estimate = (wall_time() - start)*num_points/samples;
+
+    const int tree_modes[] = {BARNES_HUT, LINEAR_BVH};
+    float tree_angles[2] = {0.0f, 0.0f};
+    struct ParticleIndex index;
+    particle_index_init(&index, num_points);
+    // Test particles feel the field but source none of it, in the exact sums
+    // and the trees alike.
+    quadtree<D> cells;
+    quadtree_init(&cells);
+    cells.min_source_mass = passive_mass_threshold;
+    quadtree_build(&cells, bodies, num_points, &index);
+    lbvh<D> hierarchy;
+    lbvh_init(&hierarchy);
+    hierarchy.min_source_mass = passive_mass_threshold;
+    arena_reset(&step_arena);
+    lbvh_build(&hierarchy, bodies, num_points, &step_arena);
+    for (int m = 0; m < 2; m++) {
+        printf("autotune:   %-12s field error", force_mode_name(tree_modes[m]));
+        for (int a = 0; a < num_angles; a++) {
+            double error = 0.0;
+            int measured = 0;
+            for (int s = 0; s < samples; s++) {
+                int i = (int) ((long) s*num_points/samples);
+                // Bodies sharing a position with another have no finite field.
+                float norm_sq = dot(exact[s], exact[s]);
+                if (!isfinite(norm_sq) || norm_sq == 0.0f) {
+                    continue;
+                }
+                vec<D> field = tree_modes[m] == BARNES_HUT
+                    ? quadtree_field(&cells, bodies, &index, i, autotune_angles[a])
+                    : lbvh_field(&hierarchy, bodies, i, autotune_angles[a]);
+                vec<D> delta = field - exact[s];
+                error += dot(delta, delta)/norm_sq;
+                measured++;
+            }
+            error = measured > 0 ? sqrt(error/measured) : 0.0;
+            printf("  theta %.2f %.1e", autotune_angles[a], error);
+            if (error <= autotune_error_budget) {
+                tree_angles[m] = autotune_angles[a];
+            }
+        }
+        printf("\n");
+    }
+    quadtree_free(&cells);
+    lbvh_free(&hierarchy);
+    particle_index_free(&index);
+    free(exact);
+
+    // The force modes under the live broad phase, then the fastest of them
+    // under every other broad phase.
+    double best_time = INFINITY;
+    int best_mode = DIRECT_SUM;
+    float best_angle = opening_angle;
+    int best_phase = broad_phase;
+    for (int m = 0; m < 2; m++) {
+        if (tree_angles[m] == 0.0f) {
+            printf("autotune:   %-12s no opening angle within budget\n", force_mode_name(tree_modes[m]));
+            continue;
+        }
+        force_mode = tree_modes[m];
+        opening_angle = tree_angles[m];
+        double time = trial_step(bodies, num_points, scratch, tree);
+        printf("autotune:   %-12s theta %.2f  %-17s %10.3f ms/step\n", force_mode_name(force_mode), opening_angle, broad_phase_name(broad_phase), 1000.0*time);
+        if (time < best_time) {
+            best_time = time;
+            best_mode = force_mode;
+            best_angle = opening_angle;
+        }
+    }
+    if (direct_estimate < best_time) {
+        force_mode = DIRECT_SUM;
+        // Without a broad phase, direct summation falls back to the serial
+        // pair loop, which every broad phase beats.
+        if (broad_phase == TREE_OR_ALL_PAIRS) {
+            broad_phase = UNIFORM_GRID;
+        }
+        double time = trial_step(bodies, num_points, scratch, tree);
+        printf("autotune:   %-12s             %-17s %10.3f ms/step\n", force_mode_name(force_mode), broad_phase_name(broad_phase), 1000.0*time);
+        if (time < best_time) {
+            best_time = time;
+            best_mode = DIRECT_SUM;
+            best_angle = live.opening_angle;
+            best_phase = broad_phase;
+        }
+    } else {
+        printf("autotune:   %-12s estimated at %.3f ms/step, not tried\n", force_mode_name(DIRECT_SUM), 1000.0*direct_estimate);
+    }
+    force_mode = best_mode;
+    opening_angle = best_angle;
+    int timed_phase = best_phase;
+    for (int phase = TREE_OR_ALL_PAIRS; phase <= VERLET_LIST; phase++) {
+        if (phase == timed_phase || (force_mode == DIRECT_SUM && phase == TREE_OR_ALL_PAIRS)) {
+            continue;
+        }
+        broad_phase = phase;
+        double time = trial_step(bodies, num_points, scratch, tree);
+        printf("autotune:   %-12s             %-17s %10.3f ms/step\n", force_mode_name(force_mode), broad_phase_name(broad_phase), 1000.0*time);
+        if (time < best_time) {
+            best_time = time;
+            best_phase = phase;
+        }
+    }
+    free(bodies);
+    free(scratch);
+
+    simulation_load(&live);
+    if (best_mode != force_mode || best_phase != broad_phase) {
+        // What the old configuration kept across steps may go stale while
+        // unused, so it is dropped and rebuilt on demand.
+        quadtree_free(tree);
+        sweep_prune_free(&sweep);
+        verlet_list_free(&neighbor_lists);
+        wh_cached_step = -2;
+        hermite_cached_step = -2;
+    }
+    force_mode = best_mode;
+    opening_angle = best_angle;
+    broad_phase = best_phase;
+    autotune_count = num_points;
+    if (force_mode == DIRECT_SUM) {
+        printf("autotune: -> %s, %s collisions\n", force_mode_name(force_mode), broad_phase_name(broad_phase));
+    } else {
+        printf("autotune: -> %s at theta %.2f, %s collisions\n", force_mode_name(force_mode), opening_angle, broad_phase_name(broad_phase));
+    }
+}
+
+template void autotune_run<dimensions>(const particle<dimensions>* points, int num_points, quadtree<dimensions>* tree);
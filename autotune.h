@@ -0,0 +1,25 @@
+#ifndef AUTOTUNE_H
+#define AUTOTUNE_H
+
+#include "particle.h"
+#include "quadtree.h"
+
+// Runtime choice of how forces and collision candidates are computed. Which
+// is fastest depends on the body count and how the bodies are spread, so
+// rather than guess, the tuner measures on a copy of the live bodies:
+//  - the RMS relative field error of each tree force mode at each of a few
+//    opening angles, against exact sums for a sample of bodies, keeping the
+//    largest angle within autotune_error_budget;
+//  - the time of short trial runs of each force mode that qualified, then of
+//    the winner with each broad phase. Direct summation is only tried when
+//    the exact sums predict it can compete.
+// The winner is applied to the live configuration, and every measurement is
+// logged to stdout. Tuning starts from the step state of a fresh simulation,
+// so the live state is left exactly as it was.
+
+// 1 if a simulation of num_points bodies is due for (re)tuning.
+int autotune_due(int num_points);
+template <int D>
+void autotune_run(const particle<D>* points, int num_points, quadtree<D>* tree);
+
+#endif
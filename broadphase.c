@@ -0,0 +1,346 @@
+#include "broadphase.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Box around a body's straight-line path over the last dt, padded by margin.
+template <int D>
+void swept_box(const particle<D>& p, float dt, float margin, vec<D>* lo, vec<D>* hi) {
+    for (int d = 0; d < D; d++) {
+        float start = p.position[d] - p.velocity[d]*dt;
+        (*lo)[d] = fminf(start, p.position[d]) - p.radius - margin;
+        (*hi)[d] = fmaxf(start, p.position[d]) + p.radius + margin;
+    }
+}
+
+template <int D>
+int boxes_overlap(const vec<D>& lo1, const vec<D>& hi1, const vec<D>& lo2, const vec<D>& hi2) {
+    for (int d = 0; d < D; d++) {
+        if (hi1[d] < lo2[d] || hi2[d] < lo1[d]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+template <int D>
+void sweep_prune_init(sweep_prune<D>* sweep) {
+    sweep->entries = NULL;
+    sweep->count = 0;
+    sweep->capacity = 0;
+    sweep->listed = NULL;
+    sweep->id_capacity = 0;
+    sweep->swaps = 0;
+}
+
+template <int D>
+void sweep_prune_free(sweep_prune<D>* sweep) {
+    free(sweep->entries);
+    free(sweep->listed);
+    sweep_prune_init(sweep);
+}
+
+// Drops absorbed and retired ids, appends new ones, refreshes every box and
+// restores the order on lo.x.
+template <int D>
+void sweep_prune_update(sweep_prune<D>* sweep, const particle<D>* points, int num_points, const struct ParticleIndex* index, float dt) {
+    if (sweep->id_capacity < index->num_ids) {
+        sweep->listed = (char*) realloc(sweep->listed, index->num_ids);
+        memset(sweep->listed + sweep->id_capacity, 0, index->num_ids - sweep->id_capacity);
+        sweep->id_capacity = index->num_ids;
+    }
+    if (sweep->capacity < num_points) {
+        sweep->capacity = num_points > 2*sweep->capacity ? num_points : 2*sweep->capacity;
+        sweep->entries = (sweep_entry<D>*) realloc(sweep->entries, sweep->capacity*sizeof(sweep_entry<D>));
+    }
+
+    int kept = 0;
+    for (int e = 0; e < sweep->count; e++) {
+        uint64_t id = sweep->entries[e].id;
+        int slot = particle_index_slot(index, id);
+        if (slot < 0) {
+            sweep->listed[id] = 0;
+            continue;
+        }
+        sweep_entry<D>& entry = sweep->entries[kept++];
+        entry.id = id;
+        swept_box(points[slot], dt, 0.0f, &entry.lo, &entry.hi);
+    }
+    sweep->count = kept;
+    if (kept < num_points) {
+        for (int i = 0; i < num_points; i++) {
+            uint64_t id = points[i].id;
+            if (!sweep->listed[id]) {
+                sweep->listed[id] = 1;
+                sweep_entry<D>& entry = sweep->entries[sweep->count++];
+                entry.id = id;
+                swept_box(points[i], dt, 0.0f, &entry.lo, &entry.hi);
+            }
+        }
+    }
+
+    long swaps = 0;
+    for (int e = 1; e < sweep->count; e++) {
+        sweep_entry<D> entry = sweep->entries[e];
+        int k = e;
+        while (k > 0 && sweep->entries[k-1].lo[0] > entry.lo[0]) {
+            sweep->entries[k] = sweep->entries[k-1];
+            k--;
+        }
+        sweep->entries[k] = entry;
+        swaps += e - k;
+    }
+    sweep->swaps = swaps;
+}
+
+template <int D>
+int sweep_prune_pairs(const sweep_prune<D>* sweep, uint64_t* pairs, int max_pairs) {
+    int found = 0;
+    for (int e = 0; e < sweep->count; e++) {
+        const sweep_entry<D>& a = sweep->entries[e];
+        for (int k = e + 1; k < sweep->count && sweep->entries[k].lo[0] <= a.hi[0]; k++) {
+            const sweep_entry<D>& b = sweep->entries[k];
+            if (boxes_overlap(a.lo, a.hi, b.lo, b.hi)) {
+                if (found < max_pairs) {
+                    pairs[2*found] = a.id;
+                    pairs[2*found + 1] = b.id;
+                }
+                found++;
+            }
+        }
+    }
+    return found;
+}
+
+template <int D>
+uint32_t cell_hash(const int32_t* cell, uint32_t mask) {
+    const uint32_t primes[3] = {73856093u, 19349663u, 83492791u};
+    uint32_t hash = 0;
+    for (int d = 0; d < D; d++) {
+        hash ^= (uint32_t) cell[d]*primes[d];
+    }
+    return hash & mask;
+}
+
+template <int D>
+int grid_pairs(const particle<D>* points, int num_points, float dt, float margin, uint64_t* pairs, int max_pairs, struct Arena* arena) {
+    vec<D>* lo = (vec<D>*) arena_alloc(arena, num_points*sizeof(vec<D>));
+    vec<D>* hi = (vec<D>*) arena_alloc(arena, num_points*sizeof(vec<D>));
+    double total_extent = 0.0;
+    for (int i = 0; i < num_points; i++) {
+        swept_box(points[i], dt, margin, &lo[i], &hi[i]);
+        for (int d = 0; d < D; d++) {
+            total_extent += hi[i][d] - lo[i][d];
+        }
+    }
+    float cell_size = num_points > 0 ? (float) (2.0*total_extent/((double) num_points*D)) : 1.0f;
+    if (cell_size <= 0.0f) {
+        cell_size = 1.0f;
+    }
+
+    uint32_t table_size = 1;
+    while (table_size < 2u*(uint32_t) num_points) {
+        table_size <<= 1;
+    }
+    uint32_t mask = table_size - 1;
+    int32_t* cells = (int32_t*) arena_alloc(arena, num_points*D*sizeof(int32_t));
+    uint32_t* keys = (uint32_t*) arena_alloc(arena, num_points*sizeof(uint32_t));
+    int* starts = (int*) arena_alloc(arena, (table_size + 1)*sizeof(int));
+    int* sorted = (int*) arena_alloc(arena, num_points*sizeof(int));
+    int* oversized = (int*) arena_alloc(arena, num_points*sizeof(int));
+    int num_oversized = 0;
+    memset(starts, 0, (table_size + 1)*sizeof(int));
+    for (int i = 0; i < num_points; i++) {
+        int fits = 1;
+        for (int d = 0; d < D; d++) {
+            fits &= hi[i][d] - lo[i][d] <= cell_size;
+            cells[i*D + d] = (int32_t) floorf(0.5f*(lo[i][d] + hi[i][d])/cell_size);
+        }
+        if (!fits) {
+            oversized[num_oversized++] = i;
+            keys[i] = table_size;
+            continue;
+        }
+        keys[i] = cell_hash<D>(&cells[i*D], mask);
+        starts[keys[i] + 1]++;
+    }
+    for (uint32_t k = 0; k < table_size; k++) {
+        starts[k + 1] += starts[k];
+    }
+    int* fill = (int*) arena_alloc(arena, table_size*sizeof(int));
+    memcpy(fill, starts, table_size*sizeof(int));
+    for (int i = 0; i < num_points; i++) {
+        if (keys[i] < table_size) {
+            sorted[fill[keys[i]]++] = i;
+        }
+    }
+
+    // A body fitting in a cell only overlaps bodies whose centers lie in the
+    // 3^D cells around its own. Hash collisions put foreign cells in a
+    // bucket, so the cell itself is compared too, which also keeps a pair
+    // from being reported twice.
+    int neighborhood = 1;
+    for (int d = 0; d < D; d++) {
+        neighborhood *= 3;
+    }
+    int found = 0;
+    for (int i = 0; i < num_points; i++) {
+        if (keys[i] == table_size) {
+            continue;
+        }
+        for (int n = 0; n < neighborhood; n++) {
+            int32_t cell[D];
+            for (int d = 0, rest = n; d < D; d++, rest /= 3) {
+                cell[d] = cells[i*D + d] + rest % 3 - 1;
+            }
+            uint32_t key = cell_hash<D>(cell, mask);
+            for (int s = starts[key]; s < starts[key + 1]; s++) {
+                int j = sorted[s];
+                if (j <= i || memcmp(&cells[j*D], cell, sizeof(cell)) != 0 || !boxes_overlap(lo[i], hi[i], lo[j], hi[j])) {
+                    continue;
+                }
+                if (found < max_pairs) {
+                    pairs[2*found] = points[i].id;
+                    pairs[2*found + 1] = points[j].id;
+                }
+                found++;
+            }
+        }
+    }
+    for (int o = 0; o < num_oversized; o++) {
+        int i = oversized[o];
+        for (int j = 0; j < num_points; j++) {
+            if (j == i || (keys[j] == table_size && j < i) || !boxes_overlap(lo[i], hi[i], lo[j], hi[j])) {
+                continue;
+            }
+            if (found < max_pairs) {
+                pairs[2*found] = points[i].id;
+                pairs[2*found + 1] = points[j].id;
+            }
+            found++;
+        }
+    }
+    return found;
+}
+
+template <int D>
+void verlet_list_init(verlet_list<D>* list, float skin) {
+    list->offsets = NULL;
+    list->neighbors = NULL;
+    list->num_rows = 0;
+    list->neighbor_capacity = 0;
+    list->reference = NULL;
+    list->reference_radius = NULL;
+    list->skin = skin;
+    list->builds = 0;
+    list->checks = 0;
+}
+
+template <int D>
+void verlet_list_free(verlet_list<D>* list) {
+    free(list->offsets);
+    free(list->neighbors);
+    free(list->reference);
+    free(list->reference_radius);
+    verlet_list_init(list, list->skin);
+}
+
+// A body may have strayed from its list once its displacement since the
+// build and any growth of its radius from merges add up to more than half the
+// skin. Swept paths need no extra room: each starts where the previous step's
+// check left the body, or inside the swept box used by the build.
+template <int D>
+int verlet_list_stale(const verlet_list<D>* list, const particle<D>* points, int num_points) {
+    int stale = 0;
+    #pragma omp parallel for reduction(|:stale)
+    for (int i = 0; i < num_points; i++) {
+        uint64_t id = points[i].id;
+        if (id >= list->num_rows) {
+            stale = 1;
+            continue;
+        }
+        float moved = dist(points[i].position, list->reference[id]);
+        stale |= moved + points[i].radius - list->reference_radius[id] > 0.5f*list->skin;
+    }
+    return stale;
+}
+
+// Rebuilds from grid candidates padded by half the skin, keeping the pairs
+// whose circles are within the skin of touching. Each pair is stored once,
+// in the row of the lower id.
+template <int D>
+int verlet_list_update(verlet_list<D>* list, const particle<D>* points, int num_points, const struct ParticleIndex* index, float dt, struct Arena* arena) {
+    list->checks++;
+    if (list->num_rows > 0 && !verlet_list_stale(list, points, num_points)) {
+        return 0;
+    }
+    list->builds++;
+    if (list->num_rows < index->num_ids) {
+        list->num_rows = index->num_ids;
+        list->offsets = (int*) realloc(list->offsets, (list->num_rows + 1)*sizeof(int));
+        list->reference = (vec<D>*) realloc(list->reference, list->num_rows*sizeof(vec<D>));
+        list->reference_radius = (float*) realloc(list->reference_radius, list->num_rows*sizeof(float));
+    }
+    for (int i = 0; i < num_points; i++) {
+        list->reference[points[i].id] = points[i].position;
+        list->reference_radius[points[i].id] = points[i].radius;
+    }
+
+    int max_pairs = 4*num_points;
+    uint64_t* pairs = (uint64_t*) arena_alloc(arena, 2*max_pairs*sizeof(uint64_t));
+    int found = grid_pairs(points, num_points, dt, 0.5f*list->skin, pairs, max_pairs, arena);
+    if (found > max_pairs) {
+        max_pairs = found;
+        pairs = (uint64_t*) arena_alloc(arena, 2*max_pairs*sizeof(uint64_t));
+        grid_pairs(points, num_points, dt, 0.5f*list->skin, pairs, max_pairs, arena);
+    }
+
+    int kept = 0;
+    for (int p = 0; p < found; p++) {
+        uint64_t a = pairs[2*p], b = pairs[2*p + 1];
+        const particle<D>& pa = points[particle_index_slot(index, a)];
+        const particle<D>& pb = points[particle_index_slot(index, b)];
+        float reach = pa.radius + pb.radius + list->skin + (magnitude(pa.velocity) + magnitude(pb.velocity))*dt;
+        if (dist_sq(pa.position, pb.position) <= reach*reach) {
+            pairs[2*kept] = a < b ? a : b;
+            pairs[2*kept + 1] = a < b ? b : a;
+            kept++;
+        }
+    }
+
+    memset(list->offsets, 0, (list->num_rows + 1)*sizeof(int));
+    for (int p = 0; p < kept; p++) {
+        list->offsets[pairs[2*p] + 1]++;
+    }
+    for (uint64_t row = 0; row < list->num_rows; row++) {
+        list->offsets[row + 1] += list->offsets[row];
+    }
+    if (list->neighbor_capacity < kept) {
+        list->neighbor_capacity = kept > 2*list->neighbor_capacity ? kept : 2*list->neighbor_capacity;
+        list->neighbors = (uint64_t*) realloc(list->neighbors, list->neighbor_capacity*sizeof(uint64_t));
+    }
+    int* fill = (int*) arena_alloc(arena, list->num_rows*sizeof(int));
+    memcpy(fill, list->offsets, list->num_rows*sizeof(int));
+    for (int p = 0; p < kept; p++) {
+        list->neighbors[fill[pairs[2*p]]++] = pairs[2*p + 1];
+    }
+    return 1;
+}
+
+template void sweep_prune_init<2>(sweep_prune<2>* sweep);
+template void sweep_prune_init<3>(sweep_prune<3>* sweep);
+template void sweep_prune_free<2>(sweep_prune<2>* sweep);
+template void sweep_prune_free<3>(sweep_prune<3>* sweep);
+template void sweep_prune_update<2>(sweep_prune<2>* sweep, const particle<2>* points, int num_points, const struct ParticleIndex* index, float dt);
+template void sweep_prune_update<3>(sweep_prune<3>* sweep, const particle<3>* points, int num_points, const struct ParticleIndex* index, float dt);
+template int sweep_prune_pairs<2>(const sweep_prune<2>* sweep, uint64_t* pairs, int max_pairs);
+template int sweep_prune_pairs<3>(const sweep_prune<3>* sweep, uint64_t* pairs, int max_pairs);
+template int grid_pairs<2>(const particle<2>* points, int num_points, float dt, float margin, uint64_t* pairs, int max_pairs, struct Arena* arena);
+template int grid_pairs<3>(const particle<3>* points, int num_points, float dt, float margin, uint64_t* pairs, int max_pairs, struct Arena* arena);
+template void verlet_list_init<2>(verlet_list<2>* list, float skin);
+template void verlet_list_init<3>(verlet_list<3>* list, float skin);
+template void verlet_list_free<2>(verlet_list<2>* list);
+template void verlet_list_free<3>(verlet_list<3>* list);
+template int verlet_list_update<2>(verlet_list<2>* list, const particle<2>* points, int num_points, const struct ParticleIndex* index, float dt, struct Arena* arena);
+template int verlet_list_update<3>(verlet_list<3>* list, const particle<3>* points, int num_points, const struct ParticleIndex* index, float dt, struct Arena* arena);
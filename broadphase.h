@@ -0,0 +1,81 @@
+#ifndef BROADPHASE_H
+#define BROADPHASE_H
+
+#include <stdint.h>
+
+#include "arena.h"
+#include "particle.h"
+#include "particle_index.h"
+
+// Collision broad phases. Both report candidate pairs as particle ids in
+// pairs[2k] and pairs[2k+1], since the narrow phase merges bodies and shifts
+// slots while it walks the list. Each body is bounded by the box around its
+// path over the last dt, so swept narrow-phase tests see every candidate.
+// Like quadtree_query(), they return the total number of pairs found, which
+// may exceed max_pairs; only the first max_pairs are written.
+
+// Sort-and-sweep on x. The entries are kept sorted across steps and
+// re-sorted with insertion sort, which is close to linear while bodies
+// rarely overtake each other along x.
+template <int D>
+struct sweep_entry {
+    uint64_t id;
+    vec<D> lo;
+    vec<D> hi;
+};
+
+template <int D>
+struct sweep_prune {
+    sweep_entry<D>* entries;
+    int count;
+    int capacity;
+    // Per id: 1 if the id has an entry.
+    char* listed;
+    uint64_t id_capacity;
+    // Insertion-sort moves in the last update, a measure of reordering.
+    long swaps;
+};
+
+template <int D>
+void sweep_prune_init(sweep_prune<D>* sweep);
+template <int D>
+void sweep_prune_free(sweep_prune<D>* sweep);
+template <int D>
+void sweep_prune_update(sweep_prune<D>* sweep, const particle<D>* points, int num_points, const struct ParticleIndex* index, float dt);
+template <int D>
+int sweep_prune_pairs(const sweep_prune<D>* sweep, uint64_t* pairs, int max_pairs);
+
+// Uniform grid rebuilt every step by counting sort on hashed cells. Cells are
+// twice the mean box size; the few bodies larger than a cell are tested
+// against everything instead of forcing a coarse grid on the rest.
+// margin pads every box, for callers that want pairs within some distance.
+template <int D>
+int grid_pairs(const particle<D>* points, int num_points, float dt, float margin, uint64_t* pairs, int max_pairs, struct Arena* arena);
+
+// Verlet neighbor lists: every pair within skin of touching, kept across
+// steps and rebuilt only once some body may have moved far enough to meet a
+// body outside its list. Rows are indexed by id in CSR form: the neighbors of
+// id a are neighbors[offsets[a]] up to neighbors[offsets[a+1]], each pair
+// stored once under its lower id.
+template <int D>
+struct verlet_list {
+    int* offsets;
+    uint64_t* neighbors;
+    uint64_t num_rows;
+    int neighbor_capacity;
+    // Position and radius of each id at the last build.
+    vec<D>* reference;
+    float* reference_radius;
+    float skin;
+    long builds;
+    long checks;
+};
+
+template <int D>
+void verlet_list_init(verlet_list<D>* list, float skin);
+template <int D>
+void verlet_list_free(verlet_list<D>* list);
+template <int D>
+int verlet_list_update(verlet_list<D>* list, const particle<D>* points, int num_points, const struct ParticleIndex* index, float dt, struct Arena* arena);
+
+#endif
@@ -0,0 +1,526 @@
+#include "domain.h"
+
+#include <float.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "physics.h"
+
+// Histogram bins per refinement round when searching for a cut; two rounds
+// place it within 1/65536 of the group's extent.
+const int orb_bins = 256;
+const int orb_rounds = 2;
+
+template <int D>
+void domain_init(orb_domain<D>* domain, MPI_Comm comm) {
+    domain->comm = comm;
+    MPI_Comm_rank(comm, &domain->rank);
+    MPI_Comm_size(comm, &domain->size);
+    domain->lo = (vec<D>*) malloc(domain->size*sizeof(vec<D>));
+    domain->hi = (vec<D>*) malloc(domain->size*sizeof(vec<D>));
+    // Until the first partition rank 0 owns everything.
+    for (int r = 0; r < domain->size; r++) {
+        for (int d = 0; d < D; d++) {
+            domain->lo[r][d] = r == 0 ? -INFINITY : INFINITY;
+            domain->hi[r][d] = INFINITY;
+        }
+    }
+    domain->partitions = 0;
+}
+
+template <int D>
+void domain_free(orb_domain<D>* domain) {
+    free(domain->lo);
+    free(domain->hi);
+    domain->lo = NULL;
+    domain->hi = NULL;
+}
+
+template <int D>
+float box_distance_sq(const vec<D>& p, const vec<D>& lo, const vec<D>& hi) {
+    float sum = 0.0f;
+    for (int d = 0; d < D; d++) {
+        float below = lo[d] - p[d];
+        float above = p[d] - hi[d];
+        float gap = below > above ? below : above;
+        if (gap > 0.0f) {
+            sum += gap*gap;
+        }
+    }
+    return sum;
+}
+
+// All-to-all exchange of fixed-size records, send_counts[r] of them bound for
+// rank r and stored contiguously by rank. Returns the received records,
+// grouped by sender, with the per-sender counts in *recv_counts.
+static void* exchange(MPI_Comm comm, int size, const void* send, const int* send_counts, size_t record_size, int** recv_counts, int* num_received, struct Arena* arena) {
+    int* counts = (int*) arena_alloc(arena, size*sizeof(int));
+    int* send_bytes = (int*) arena_alloc(arena, 4*size*sizeof(int));
+    int* send_displs = send_bytes + size;
+    int* recv_bytes = send_bytes + 2*size;
+    int* recv_displs = send_bytes + 3*size;
+    MPI_Alltoall(send_counts, 1, MPI_INT, counts, 1, MPI_INT, comm);
+    int sent = 0, received = 0;
+    for (int r = 0; r < size; r++) {
+        send_bytes[r] = send_counts[r]*(int) record_size;
+        send_displs[r] = sent*(int) record_size;
+        recv_bytes[r] = counts[r]*(int) record_size;
+        recv_displs[r] = received*(int) record_size;
+        sent += send_counts[r];
+        received += counts[r];
+    }
+    void* recv = arena_alloc(arena, received*record_size + 1);
+    MPI_Alltoallv(send, send_bytes, send_displs, MPI_BYTE, recv, recv_bytes, recv_displs, MPI_BYTE, comm);
+    if (recv_counts != NULL) {
+        *recv_counts = counts;
+    }
+    *num_received = received;
+    return recv;
+}
+
+// Groups of ranks are split level by level until each holds one rank. Every
+// level needs the particle extents of each group, then two rounds of
+// histograms along the chosen axis to place the cut; all of them are
+// reduced across ranks, so every rank computes the same boxes.
+template <int D>
+void domain_partition(orb_domain<D>* domain, const particle<D>* points, int num_points, struct Arena* arena) {
+    int size = domain->size;
+    int* group_of = (int*) arena_alloc(arena, num_points*sizeof(int));
+    memset(group_of, 0, num_points*sizeof(int));
+    int* begin = (int*) arena_alloc(arena, size*sizeof(int));
+    int* end = (int*) arena_alloc(arena, size*sizeof(int));
+    vec<D>* box_lo = (vec<D>*) arena_alloc(arena, size*sizeof(vec<D>));
+    vec<D>* box_hi = (vec<D>*) arena_alloc(arena, size*sizeof(vec<D>));
+    int num_groups = 1;
+    begin[0] = 0;
+    end[0] = size;
+    for (int d = 0; d < D; d++) {
+        box_lo[0][d] = -INFINITY;
+        box_hi[0][d] = INFINITY;
+    }
+
+    for (;;) {
+        int splitting = 0;
+        for (int g = 0; g < num_groups; g++) {
+            splitting |= end[g] - begin[g] > 1;
+        }
+        if (!splitting) {
+            break;
+        }
+        int G = num_groups;
+        // Lower bounds and negated upper bounds, so one MIN reduction does both.
+        float* extent = (float*) arena_alloc(arena, 2*G*D*sizeof(float));
+        long* counts = (long*) arena_alloc(arena, G*sizeof(long));
+        for (int k = 0; k < 2*G*D; k++) {
+            extent[k] = FLT_MAX;
+        }
+        memset(counts, 0, G*sizeof(long));
+        for (int i = 0; i < num_points; i++) {
+            int g = group_of[i];
+            counts[g]++;
+            for (int d = 0; d < D; d++) {
+                float x = points[i].position[d];
+                extent[g*D + d] = fminf(extent[g*D + d], x);
+                extent[(G + g)*D + d] = fminf(extent[(G + g)*D + d], -x);
+            }
+        }
+        MPI_Allreduce(MPI_IN_PLACE, extent, 2*G*D, MPI_FLOAT, MPI_MIN, domain->comm);
+        MPI_Allreduce(MPI_IN_PLACE, counts, G, MPI_LONG, MPI_SUM, domain->comm);
+
+        int* axis = (int*) arena_alloc(arena, G*sizeof(int));
+        float* window_lo = (float*) arena_alloc(arena, 3*G*sizeof(float));
+        float* window_width = window_lo + G;
+        float* cut = window_lo + 2*G;
+        long* target = (long*) arena_alloc(arena, 2*G*sizeof(long));
+        long* below = target + G;
+        for (int g = 0; g < G; g++) {
+            axis[g] = 0;
+            float widest = -1.0f;
+            for (int d = 0; d < D; d++) {
+                float width = -extent[(G + g)*D + d] - extent[g*D + d];
+                if (width > widest) {
+                    widest = width;
+                    axis[g] = d;
+                }
+            }
+            // An empty group has inverted extents; any cut will do.
+            window_lo[g] = widest >= 0.0f ? extent[g*D + axis[g]] : 0.0f;
+            window_width[g] = widest > 0.0f ? widest : 0.0f;
+            cut[g] = window_lo[g];
+            int left_ranks = (end[g] - begin[g])/2;
+            target[g] = counts[g]*left_ranks/(end[g] - begin[g]);
+            below[g] = 0;
+        }
+
+        long* hist = (long*) arena_alloc(arena, G*orb_bins*sizeof(long));
+        for (int round = 0; round < orb_rounds; round++) {
+            memset(hist, 0, G*orb_bins*sizeof(long));
+            for (int i = 0; i < num_points; i++) {
+                int g = group_of[i];
+                if (end[g] - begin[g] < 2 || window_width[g] <= 0.0f) {
+                    continue;
+                }
+                float x = points[i].position[axis[g]];
+                int b = (int) floorf((x - window_lo[g])/window_width[g]*orb_bins);
+                if (round == 0 && b == orb_bins) {
+                    b = orb_bins - 1;
+                }
+                if (b >= 0 && b < orb_bins) {
+                    hist[g*orb_bins + b]++;
+                }
+            }
+            MPI_Allreduce(MPI_IN_PLACE, hist, G*orb_bins, MPI_LONG, MPI_SUM, domain->comm);
+            for (int g = 0; g < G; g++) {
+                if (end[g] - begin[g] < 2 || window_width[g] <= 0.0f) {
+                    continue;
+                }
+                long cumulative = below[g];
+                int b = 0;
+                while (b < orb_bins - 1 && cumulative + hist[g*orb_bins + b] < target[g]) {
+                    cumulative += hist[g*orb_bins + b];
+                    b++;
+                }
+                float bin_width = window_width[g]/orb_bins;
+                float bin_lo = window_lo[g] + b*bin_width;
+                if (round == orb_rounds - 1) {
+                    // Take whichever edge of the bin comes closer to the target.
+                    long above = cumulative + hist[g*orb_bins + b];
+                    cut[g] = target[g] - cumulative <= above - target[g] ? bin_lo : bin_lo + bin_width;
+                } else {
+                    below[g] = cumulative;
+                    window_lo[g] = bin_lo;
+                    window_width[g] = bin_width;
+                }
+            }
+        }
+
+        // Children are laid out after all groups of this level.
+        int* next_begin = (int*) arena_alloc(arena, 2*size*sizeof(int));
+        int* next_end = next_begin + size;
+        vec<D>* next_lo = (vec<D>*) arena_alloc(arena, 2*size*sizeof(vec<D>));
+        vec<D>* next_hi = next_lo + size;
+        int* first_child = (int*) arena_alloc(arena, G*sizeof(int));
+        int num_next = 0;
+        for (int g = 0; g < G; g++) {
+            first_child[g] = num_next;
+            next_begin[num_next] = begin[g];
+            next_lo[num_next] = box_lo[g];
+            next_hi[num_next] = box_hi[g];
+            if (end[g] - begin[g] < 2) {
+                next_end[num_next++] = end[g];
+                continue;
+            }
+            int middle = begin[g] + (end[g] - begin[g])/2;
+            next_end[num_next] = middle;
+            next_hi[num_next][axis[g]] = cut[g];
+            num_next++;
+            next_begin[num_next] = middle;
+            next_end[num_next] = end[g];
+            next_lo[num_next] = box_lo[g];
+            next_hi[num_next] = box_hi[g];
+            next_lo[num_next][axis[g]] = cut[g];
+            num_next++;
+        }
+        for (int i = 0; i < num_points; i++) {
+            int g = group_of[i];
+            int split = end[g] - begin[g] > 1;
+            group_of[i] = first_child[g] + (split && points[i].position[axis[g]] >= cut[g]);
+        }
+        memcpy(begin, next_begin, num_next*sizeof(int));
+        memcpy(end, next_end, num_next*sizeof(int));
+        memcpy(box_lo, next_lo, num_next*sizeof(vec<D>));
+        memcpy(box_hi, next_hi, num_next*sizeof(vec<D>));
+        num_groups = num_next;
+    }
+    for (int g = 0; g < num_groups; g++) {
+        domain->lo[begin[g]] = box_lo[g];
+        domain->hi[begin[g]] = box_hi[g];
+    }
+    domain->partitions++;
+}
+
+template <int D>
+int domain_owner(const orb_domain<D>* domain, const vec<D>& position) {
+    for (int r = 0; r < domain->size; r++) {
+        int inside = 1;
+        for (int d = 0; d < D; d++) {
+            if (!(position[d] >= domain->lo[r][d] && position[d] < domain->hi[r][d])) {
+                inside = 0;
+            }
+        }
+        if (inside) {
+            return r;
+        }
+    }
+    // Only a non-finite position falls through; keep it where it is.
+    return domain->rank;
+}
+
+// Sends every body to the owner of its position; the array is replaced by
+// what this rank receives, including the bodies it keeps.
+template <int D>
+void domain_migrate(const orb_domain<D>* domain, particle<D>** points, int* num_points, int* capacity, struct Arena* arena) {
+    int size = domain->size;
+    int n = *num_points;
+    int* dest = (int*) arena_alloc(arena, n*sizeof(int));
+    int* counts = (int*) arena_alloc(arena, 2*size*sizeof(int));
+    int* offsets = counts + size;
+    memset(counts, 0, size*sizeof(int));
+    for (int i = 0; i < n; i++) {
+        dest[i] = domain_owner(domain, (*points)[i].position);
+        counts[dest[i]]++;
+    }
+    int offset = 0;
+    for (int r = 0; r < size; r++) {
+        offsets[r] = offset;
+        offset += counts[r];
+    }
+    particle<D>* send = (particle<D>*) arena_alloc(arena, n*sizeof(particle<D>) + 1);
+    for (int i = 0; i < n; i++) {
+        send[offsets[dest[i]]++] = (*points)[i];
+    }
+    int num_received;
+    particle<D>* received = (particle<D>*) exchange(domain->comm, size, send, counts, sizeof(particle<D>), NULL, &num_received, arena);
+    if (num_received > *capacity) {
+        *capacity = num_received > 2*(*capacity) ? num_received : 2*(*capacity);
+        *points = (particle<D>*) realloc(*points, (*capacity)*sizeof(particle<D>));
+    }
+    memcpy(*points, received, num_received*sizeof(particle<D>));
+    *num_points = num_received;
+}
+
+// Copies of the bodies that could touch something in another rank's box.
+// Only the weaker body of a pair decides a merge, and it is never the larger
+// one, so a body is sent wherever a body of its own radius could reach it.
+template <int D>
+particle<D>* domain_exchange_halo(const orb_domain<D>* domain, const particle<D>* points, int num_points, int* num_halo, int** halo_owner, struct Arena* arena) {
+    int size = domain->size;
+    int* counts = (int*) arena_alloc(arena, 2*size*sizeof(int));
+    int* offsets = counts + size;
+    memset(counts, 0, size*sizeof(int));
+    for (int i = 0; i < num_points; i++) {
+        for (int r = 0; r < size; r++) {
+            if (r != domain->rank && box_distance_sq(points[i].position, domain->lo[r], domain->hi[r]) < 4.0f*points[i].radius*points[i].radius) {
+                counts[r]++;
+            }
+        }
+    }
+    int total = 0;
+    for (int r = 0; r < size; r++) {
+        offsets[r] = total;
+        total += counts[r];
+    }
+    particle<D>* send = (particle<D>*) arena_alloc(arena, total*sizeof(particle<D>) + 1);
+    for (int i = 0; i < num_points; i++) {
+        for (int r = 0; r < size; r++) {
+            if (r != domain->rank && box_distance_sq(points[i].position, domain->lo[r], domain->hi[r]) < 4.0f*points[i].radius*points[i].radius) {
+                send[offsets[r]++] = points[i];
+            }
+        }
+    }
+    int* recv_counts;
+    particle<D>* received = (particle<D>*) exchange(domain->comm, size, send, counts, sizeof(particle<D>), &recv_counts, num_halo, arena);
+    int* owner = (int*) arena_alloc(arena, (*num_halo)*sizeof(int) + 1);
+    int k = 0;
+    for (int r = 0; r < size; r++) {
+        for (int c = 0; c < recv_counts[r]; c++) {
+            owner[k++] = r;
+        }
+    }
+    *halo_owner = owner;
+    return received;
+}
+
+// Locally essential tree: for each other rank, the local tree is cut where
+// nodes pass the opening test against the whole of that rank's box, so the
+// receiver sees the same field from these sources as it would from the full
+// set of remote bodies.
+template <int D>
+let_source<D>* domain_exchange_sources(const orb_domain<D>* domain, const lbvh<D>* tree, float theta, int* num_sources, struct Arena* arena) {
+    int size = domain->size;
+    int* counts = (int*) arena_alloc(arena, size*sizeof(int));
+    memset(counts, 0, size*sizeof(int));
+    int capacity = 1024, total = 0;
+    let_source<D>* send = (let_source<D>*) malloc(capacity*sizeof(let_source<D>));
+    for (int r = 0; r < size; r++) {
+        if (r == domain->rank || tree->num_leaves == 0) {
+            continue;
+        }
+        int stack[lbvh_stack_size];
+        int top = 0;
+        stack[top++] = 0;
+        while (top > 0) {
+            const lbvh_node<D>& node = tree->nodes[stack[--top]];
+            if (node.mass <= 0.0f) {
+                continue;
+            }
+            int emit = node.left < 0;
+            if (!emit) {
+                float size_sq = 0.0f;
+                for (int d = 0; d < D; d++) {
+                    float extent = node.hi[d] - node.lo[d];
+                    size_sq = fmaxf(size_sq, extent*extent);
+                }
+                emit = size_sq < theta*theta*box_distance_sq(node.com, domain->lo[r], domain->hi[r]);
+            }
+            if (!emit) {
+                stack[top++] = node.left;
+                stack[top++] = node.right;
+                continue;
+            }
+            if (total == capacity) {
+                capacity *= 2;
+                send = (let_source<D>*) realloc(send, capacity*sizeof(let_source<D>));
+            }
+            let_source<D> source = {node.com, node.mass};
+            send[total++] = source;
+            counts[r]++;
+        }
+    }
+    let_source<D>* received = (let_source<D>*) exchange(domain->comm, size, send, counts, sizeof(let_source<D>), NULL, num_sources, arena);
+    free(send);
+    return received;
+}
+
+template <int D>
+int stronger(const particle<D>& a, const particle<D>& b) {
+    return a.mass > b.mass || (a.mass == b.mass && a.id < b.id);
+}
+
+template <int D>
+int overlapping(const particle<D>& a, const particle<D>& b) {
+    vec<D> delta = a.position - b.position;
+    float reach = a.radius + b.radius;
+    return dot(delta, delta) < reach*reach;
+}
+
+template <int D>
+struct absorb_record {
+    uint64_t winner;
+    particle<D> body;
+};
+
+static int compare_ids(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*) a, y = *(const uint64_t*) b;
+    return x < y ? -1 : x > y;
+}
+
+// Merges between a local body and a halo copy from another rank. The rank of
+// the weaker body (lower mass, then higher id) sees the pair, and the body is
+// sent to the rank of its strongest overlapping partner and
+// merged there. A body that is itself absorbed this way cannot absorb
+// anything in the same step: every absorbed id is published first, and
+// bodies whose partner is leaving stay for the next step, so each body's
+// mass ends up in exactly one survivor. pairs holds candidate id pairs and
+// index maps ids to slots of the local bodies followed by the halo.
+// Returns the number of bodies merged into local ones.
+template <int D>
+int domain_merge_across(const orb_domain<D>* domain, particle<D>* points, int* num_points, const particle<D>* halo, const int* halo_owner, int num_halo, const uint64_t* pairs, int num_pairs, const struct ParticleIndex* index, struct Arena* arena) {
+    int size = domain->size;
+    int n = *num_points;
+    int* target = (int*) arena_alloc(arena, n*sizeof(int) + 1);
+    for (int i = 0; i < n; i++) {
+        target[i] = -1;
+    }
+    for (int p = 0; p < num_pairs; p++) {
+        int a = particle_index_slot(index, pairs[2*p]);
+        int b = particle_index_slot(index, pairs[2*p + 1]);
+        if (a < 0 || b < 0 || (a < n) == (b < n)) {
+            continue;
+        }
+        int local = a < n ? a : b;
+        int remote = (a < n ? b : a) - n;
+        if (!overlapping(points[local], halo[remote]) || !stronger(halo[remote], points[local])) {
+            continue;
+        }
+        if (target[local] < 0 || stronger(halo[remote], halo[target[local]])) {
+            target[local] = remote;
+        }
+    }
+
+    int num_losers = 0;
+    for (int i = 0; i < n; i++) {
+        num_losers += target[i] >= 0;
+    }
+    uint64_t* losers = (uint64_t*) arena_alloc(arena, num_losers*sizeof(uint64_t) + 1);
+    num_losers = 0;
+    for (int i = 0; i < n; i++) {
+        if (target[i] >= 0) {
+            losers[num_losers++] = points[i].id;
+        }
+    }
+    int* loser_counts = (int*) arena_alloc(arena, 2*size*sizeof(int));
+    int* loser_displs = loser_counts + size;
+    MPI_Allgather(&num_losers, 1, MPI_INT, loser_counts, 1, MPI_INT, domain->comm);
+    int all_losers = 0;
+    for (int r = 0; r < size; r++) {
+        loser_displs[r] = all_losers;
+        all_losers += loser_counts[r];
+    }
+    uint64_t* leaving = (uint64_t*) arena_alloc(arena, all_losers*sizeof(uint64_t) + 1);
+    MPI_Allgatherv(losers, num_losers, MPI_UINT64_T, leaving, loser_counts, loser_displs, MPI_UINT64_T, domain->comm);
+    qsort(leaving, all_losers, sizeof(uint64_t), compare_ids);
+
+    int* counts = (int*) arena_alloc(arena, 2*size*sizeof(int));
+    int* offsets = counts + size;
+    memset(counts, 0, size*sizeof(int));
+    for (int i = 0; i < n; i++) {
+        if (target[i] >= 0 && bsearch(&halo[target[i]].id, leaving, all_losers, sizeof(uint64_t), compare_ids) != NULL) {
+            target[i] = -1;
+        }
+        if (target[i] >= 0) {
+            counts[halo_owner[target[i]]]++;
+        }
+    }
+    int total = 0;
+    for (int r = 0; r < size; r++) {
+        offsets[r] = total;
+        total += counts[r];
+    }
+    absorb_record<D>* send = (absorb_record<D>*) arena_alloc(arena, total*sizeof(absorb_record<D>) + 1);
+    for (int i = 0; i < n; i++) {
+        if (target[i] >= 0) {
+            absorb_record<D> record = {halo[target[i]].id, points[i]};
+            send[offsets[halo_owner[target[i]]]++] = record;
+        }
+    }
+    int num_received;
+    absorb_record<D>* received = (absorb_record<D>*) exchange(domain->comm, size, send, counts, sizeof(absorb_record<D>), NULL, &num_received, arena);
+
+    // Winners never leave, so their slots are still valid here.
+    for (int k = 0; k < num_received; k++) {
+        int w = particle_index_slot(index, received[k].winner);
+        if (w < 0 || w >= n) {
+            continue;
+        }
+        int32_t lineage = points[w].lineage;
+        points[w] = merge(points[w], received[k].body);
+        points[w].lineage = lineage;
+    }
+    int kept = 0;
+    for (int i = 0; i < n; i++) {
+        if (target[i] < 0) {
+            points[kept++] = points[i];
+        }
+    }
+    *num_points = kept;
+    return num_received;
+}
+
+template void domain_init<2>(orb_domain<2>* domain, MPI_Comm comm);
+template void domain_init<3>(orb_domain<3>* domain, MPI_Comm comm);
+template void domain_free<2>(orb_domain<2>* domain);
+template void domain_free<3>(orb_domain<3>* domain);
+template void domain_partition<2>(orb_domain<2>* domain, const particle<2>* points, int num_points, struct Arena* arena);
+template void domain_partition<3>(orb_domain<3>* domain, const particle<3>* points, int num_points, struct Arena* arena);
+template int domain_owner<2>(const orb_domain<2>* domain, const vec<2>& position);
+template int domain_owner<3>(const orb_domain<3>* domain, const vec<3>& position);
+template void domain_migrate<2>(const orb_domain<2>* domain, particle<2>** points, int* num_points, int* capacity, struct Arena* arena);
+template void domain_migrate<3>(const orb_domain<3>* domain, particle<3>** points, int* num_points, int* capacity, struct Arena* arena);
+template particle<2>* domain_exchange_halo<2>(const orb_domain<2>* domain, const particle<2>* points, int num_points, int* num_halo, int** halo_owner, struct Arena* arena);
+template particle<3>* domain_exchange_halo<3>(const orb_domain<3>* domain, const particle<3>* points, int num_points, int* num_halo, int** halo_owner, struct Arena* arena);
+template let_source<2>* domain_exchange_sources<2>(const orb_domain<2>* domain, const lbvh<2>* tree, float theta, int* num_sources, struct Arena* arena);
+template let_source<3>* domain_exchange_sources<3>(const orb_domain<3>* domain, const lbvh<3>* tree, float theta, int* num_sources, struct Arena* arena);
+template int domain_merge_across<2>(const orb_domain<2>* domain, particle<2>* points, int* num_points, const particle<2>* halo, const int* halo_owner, int num_halo, const uint64_t* pairs, int num_pairs, const struct ParticleIndex* index, struct Arena* arena);
+template int domain_merge_across<3>(const orb_domain<3>* domain, particle<3>* points, int* num_points, const particle<3>* halo, const int* halo_owner, int num_halo, const uint64_t* pairs, int num_pairs, const struct ParticleIndex* index, struct Arena* arena);
@@ -0,0 +1,56 @@
+#ifndef DOMAIN_H
+#define DOMAIN_H
+
+#include <mpi.h>
+
+#include "arena.h"
+#include "lbvh.h"
+#include "particle.h"
+#include "particle_index.h"
+
+// Spatial decomposition of the particle set over the ranks of a
+// communicator by orthogonal recursive bisection (ORB). Each level splits
+// every group of ranks along the longest extent of its particles, at the
+// coordinate that divides the particle count in proportion to the ranks on
+// either side, so every rank ends up with a box holding about N/P bodies.
+// The outermost faces extend to infinity and every position has one owner.
+//
+// All functions are collective over the domain's communicator, and every
+// transient buffer they return comes from the arena.
+template <int D>
+struct orb_domain {
+    MPI_Comm comm;
+    int rank;
+    int size;
+    // Box of every rank, as [lo, hi) on every axis.
+    vec<D>* lo;
+    vec<D>* hi;
+    long partitions;
+};
+
+// Force source sent to another rank: a tree node far enough from that
+// rank's box to act as a point mass there, or a single body.
+template <int D>
+struct let_source {
+    vec<D> position;
+    float mass;
+};
+
+template <int D>
+void domain_init(orb_domain<D>* domain, MPI_Comm comm);
+template <int D>
+void domain_free(orb_domain<D>* domain);
+template <int D>
+void domain_partition(orb_domain<D>* domain, const particle<D>* points, int num_points, struct Arena* arena);
+template <int D>
+int domain_owner(const orb_domain<D>* domain, const vec<D>& position);
+template <int D>
+void domain_migrate(const orb_domain<D>* domain, particle<D>** points, int* num_points, int* capacity, struct Arena* arena);
+template <int D>
+particle<D>* domain_exchange_halo(const orb_domain<D>* domain, const particle<D>* points, int num_points, int* num_halo, int** halo_owner, struct Arena* arena);
+template <int D>
+let_source<D>* domain_exchange_sources(const orb_domain<D>* domain, const lbvh<D>* tree, float theta, int* num_sources, struct Arena* arena);
+template <int D>
+int domain_merge_across(const orb_domain<D>* domain, particle<D>* points, int* num_points, const particle<D>* halo, const int* halo_owner, int num_halo, const uint64_t* pairs, int num_pairs, const struct ParticleIndex* index, struct Arena* arena);
+
+#endif
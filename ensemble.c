@@ -0,0 +1,323 @@
+#include "ensemble.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "physics.h"
+
+static float* lane_array(size_t count) {
+    size_t bytes = (count*sizeof(float) + 63)/64*64;
+    float* array = (float*) aligned_alloc(64, bytes);
+    memset(array, 0, bytes);
+    return array;
+}
+
+template <int D>
+void ensemble_init(ensemble<D>* e, int num_systems, int capacity, float square_size) {
+    e->num_systems = num_systems;
+    e->num_blocks = (num_systems + ensemble_lanes - 1)/ensemble_lanes;
+    e->capacity = capacity;
+    size_t slots = (size_t) e->num_blocks*capacity*ensemble_lanes;
+    e->mass = lane_array(slots);
+    e->radius = lane_array(slots);
+    for (int d = 0; d < D; d++) {
+        e->position[d] = lane_array(slots);
+        e->velocity[d] = lane_array(slots);
+        e->acceleration[d] = lane_array(slots);
+    }
+    e->id = (uint64_t*) calloc(slots, sizeof(uint64_t));
+    int padded = e->num_blocks*ensemble_lanes;
+    e->count = (int*) calloc(padded, sizeof(int));
+    e->extent = (int*) calloc(padded, sizeof(int));
+    e->gravity = lane_array(padded);
+    e->damping = lane_array(padded);
+    e->square_size = square_size;
+    e->steps = 0;
+    e->merges = 0;
+}
+
+template <int D>
+void ensemble_free(ensemble<D>* e) {
+    free(e->mass);
+    free(e->radius);
+    for (int d = 0; d < D; d++) {
+        free(e->position[d]);
+        free(e->velocity[d]);
+        free(e->acceleration[d]);
+    }
+    free(e->id);
+    free(e->count);
+    free(e->extent);
+    free(e->gravity);
+    free(e->damping);
+    memset(e, 0, sizeof(*e));
+}
+
+static inline size_t slot_of(int capacity, int system, int k) {
+    return ((size_t) (system/ensemble_lanes)*capacity + k)*ensemble_lanes + system%ensemble_lanes;
+}
+
+template <int D>
+void ensemble_load(ensemble<D>* e, int system, const particle<D>* points, int num_points, float gravity, float damping) {
+    if (num_points > e->capacity) {
+        num_points = e->capacity;
+    }
+    for (int k = 0; k < e->capacity; k++) {
+        size_t i = slot_of(e->capacity, system, k);
+        int live = k < num_points;
+        e->mass[i] = live ? points[k].mass : 0.0f;
+        e->radius[i] = live ? points[k].radius : 0.0f;
+        for (int d = 0; d < D; d++) {
+            e->position[d][i] = live ? points[k].position[d] : 0.0f;
+            e->velocity[d][i] = live ? points[k].velocity[d] : 0.0f;
+            e->acceleration[d][i] = 0.0f;
+        }
+        e->id[i] = live ? points[k].id : 0;
+    }
+    e->count[system] = num_points;
+    e->extent[system] = num_points;
+    e->gravity[system] = gravity;
+    e->damping[system] = damping;
+}
+
+template <int D>
+int ensemble_store(const ensemble<D>* e, int system, particle<D>* points) {
+    int n = 0;
+    for (int k = 0; k < e->extent[system]; k++) {
+        size_t i = slot_of(e->capacity, system, k);
+        if (e->mass[i] <= 0.0f) {
+            continue;
+        }
+        particle<D> p;
+        memset(&p, 0, sizeof(p));
+        p.mass = e->mass[i];
+        p.radius = e->radius[i];
+        for (int d = 0; d < D; d++) {
+            p.position[d] = e->position[d][i];
+            p.velocity[d] = e->velocity[d][i];
+            p.acceleration[d] = e->acceleration[d][i]*e->gravity[system];
+        }
+        p.id = e->id[i];
+        p.lineage = -1;
+        points[n++] = p;
+    }
+    return n;
+}
+
+template <int D>
+particle<D> gather(const ensemble<D>* e, size_t i) {
+    particle<D> p;
+    memset(&p, 0, sizeof(p));
+    p.mass = e->mass[i];
+    p.radius = e->radius[i];
+    for (int d = 0; d < D; d++) {
+        p.position[d] = e->position[d][i];
+        p.velocity[d] = e->velocity[d][i];
+    }
+    p.id = e->id[i];
+    return p;
+}
+
+template <int D>
+void scatter(ensemble<D>* e, size_t i, const particle<D>& p) {
+    e->mass[i] = p.mass;
+    e->radius[i] = p.radius;
+    for (int d = 0; d < D; d++) {
+        e->position[d][i] = p.position[d];
+        e->velocity[d][i] = p.velocity[d];
+    }
+    e->id[i] = p.id;
+}
+
+// Pairwise accelerations, without the gravitational constant, for every
+// system of the block at once. Each pair is visited once and applied to both
+// bodies; dead slots have zero mass, and coincident bodies exert nothing.
+template <int D>
+void block_accelerations(ensemble<D>* e, size_t base, int extent) {
+    const int L = ensemble_lanes;
+    float* mass = e->mass + base;
+    float* position[D];
+    float* acceleration[D];
+    for (int d = 0; d < D; d++) {
+        position[d] = e->position[d] + base;
+        acceleration[d] = e->acceleration[d] + base;
+        memset(acceleration[d], 0, (size_t) extent*L*sizeof(float));
+    }
+    for (int i = 0; i < extent; i++) {
+        for (int j = i + 1; j < extent; j++) {
+            #pragma omp simd
+            for (int l = 0; l < L; l++) {
+                float delta[D];
+                float distance_sq = 0.0f;
+                #pragma GCC unroll 3
+                for (int d = 0; d < D; d++) {
+                    delta[d] = position[d][j*L + l] - position[d][i*L + l];
+                    distance_sq += delta[d]*delta[d];
+                }
+                float inverse = distance_sq > 0.0f ? 1.0f/(distance_sq*sqrtf(distance_sq)) : 0.0f;
+                float pull_i = mass[j*L + l]*inverse;
+                float pull_j = mass[i*L + l]*inverse;
+                #pragma GCC unroll 3
+                for (int d = 0; d < D; d++) {
+                    acceleration[d][i*L + l] += delta[d]*pull_i;
+                    acceleration[d][j*L + l] -= delta[d]*pull_j;
+                }
+            }
+        }
+    }
+}
+
+// Unit Euler step and the square boundary of the viewer's SQUARE mode, with
+// each lane's own constant and damping.
+template <int D>
+void block_integrate(ensemble<D>* e, size_t base, int extent, const float* gravity, const float* damping) {
+    const int L = ensemble_lanes;
+    const float size = e->square_size;
+    const float boxed = size > 0.0f;
+    float* radius = e->radius + base;
+    float* position[D];
+    float* velocity[D];
+    float* acceleration[D];
+    for (int d = 0; d < D; d++) {
+        position[d] = e->position[d] + base;
+        velocity[d] = e->velocity[d] + base;
+        acceleration[d] = e->acceleration[d] + base;
+    }
+    for (int k = 0; k < extent; k++) {
+        #pragma omp simd
+        for (int l = 0; l < L; l++) {
+            int i = k*L + l;
+            #pragma GCC unroll 3
+            for (int d = 0; d < D; d++) {
+                float v = velocity[d][i] + gravity[l]*acceleration[d][i];
+                float x = position[d][i] + v;
+                float over = boxed*(x + radius[i] > size);
+                x = over ? size - radius[i] : x;
+                float under = boxed*(x - radius[i] < -size);
+                x = under ? -size + radius[i] : x;
+                velocity[d][i] = v*(1.0f - (over + under - over*under)*(1.0f + damping[l]));
+                position[d][i] = x;
+            }
+        }
+    }
+}
+
+// Overlapping pairs are found a row at a time across all lanes; the rare
+// hits are merged one lane at a time with the viewer's merge rule, and the
+// absorbed slot is left dead until compaction.
+template <int D>
+int block_merges(ensemble<D>* e, size_t base, int extent, int first_system) {
+    const int L = ensemble_lanes;
+    float* mass = e->mass + base;
+    float* radius = e->radius + base;
+    float* position[D];
+    for (int d = 0; d < D; d++) {
+        position[d] = e->position[d] + base;
+    }
+    int merges = 0;
+    for (int i = 0; i < extent; i++) {
+        for (int j = i + 1; j < extent; j++) {
+            int hits = 0;
+            #pragma omp simd reduction(|:hits)
+            for (int l = 0; l < L; l++) {
+                float distance_sq = 0.0f;
+                #pragma GCC unroll 3
+                for (int d = 0; d < D; d++) {
+                    float delta = position[d][j*L + l] - position[d][i*L + l];
+                    distance_sq += delta*delta;
+                }
+                float reach = radius[i*L + l] + radius[j*L + l];
+                hits |= (mass[i*L + l] > 0.0f) & (mass[j*L + l] > 0.0f) & (distance_sq < reach*reach);
+            }
+            if (!hits) {
+                continue;
+            }
+            for (int l = 0; l < L; l++) {
+                size_t a = base + (size_t) i*L + l;
+                size_t b = base + (size_t) j*L + l;
+                particle<D> p1 = gather(e, a), p2 = gather(e, b);
+                if (p1.mass <= 0.0f || p2.mass <= 0.0f || dist_sq(p1.position, p2.position) >= (p1.radius + p2.radius)*(p1.radius + p2.radius)) {
+                    continue;
+                }
+                particle<D> merged = merge(p1, p2);
+                size_t survivor = merged.id == p1.id ? a : b;
+                size_t absorbed = survivor == a ? b : a;
+                scatter(e, survivor, merged);
+                particle<D> dead;
+                memset(&dead, 0, sizeof(dead));
+                scatter(e, absorbed, dead);
+                e->count[first_system + l]--;
+                merges++;
+            }
+        }
+    }
+    return merges;
+}
+
+// Moves the live bodies of each lane that lost some to the front of its slots.
+template <int D>
+void block_compact(ensemble<D>* e, size_t base, int first_system) {
+    const int L = ensemble_lanes;
+    for (int l = 0; l < L; l++) {
+        int s = first_system + l;
+        if (e->count[s] == e->extent[s]) {
+            continue;
+        }
+        int kept = 0;
+        for (int k = 0; k < e->extent[s]; k++) {
+            size_t i = base + (size_t) k*L + l;
+            if (e->mass[i] <= 0.0f) {
+                continue;
+            }
+            size_t to = base + (size_t) kept*L + l;
+            if (to != i) {
+                scatter(e, to, gather(e, i));
+                particle<D> dead;
+                memset(&dead, 0, sizeof(dead));
+                scatter(e, i, dead);
+            }
+            kept++;
+        }
+        e->extent[s] = kept;
+    }
+}
+
+template <int D>
+void ensemble_step(ensemble<D>* e, int steps) {
+    long merges = 0;
+    #pragma omp parallel for schedule(dynamic) reduction(+:merges)
+    for (int b = 0; b < e->num_blocks; b++) {
+        const int L = ensemble_lanes;
+        size_t base = (size_t) b*e->capacity*L;
+        const float* gravity = e->gravity + b*L;
+        const float* damping = e->damping + b*L;
+        for (int step = 0; step < steps; step++) {
+            // Lanes run to the longest system in the block, and compaction
+            // keeps that short as the systems merge down.
+            int extent = 0;
+            for (int l = 0; l < L; l++) {
+                extent = e->extent[b*L + l] > extent ? e->extent[b*L + l] : extent;
+            }
+            block_accelerations(e, base, extent);
+            block_integrate(e, base, extent, gravity, damping);
+            int merged = block_merges(e, base, extent, b*L);
+            if (merged > 0) {
+                block_compact(e, base, b*L);
+                merges += merged;
+            }
+        }
+    }
+    e->steps += steps;
+    e->merges += merges;
+}
+
+template void ensemble_init<2>(ensemble<2>* e, int num_systems, int capacity, float square_size);
+template void ensemble_init<3>(ensemble<3>* e, int num_systems, int capacity, float square_size);
+template void ensemble_free<2>(ensemble<2>* e);
+template void ensemble_free<3>(ensemble<3>* e);
+template void ensemble_load<2>(ensemble<2>* e, int system, const particle<2>* points, int num_points, float gravity, float damping);
+template void ensemble_load<3>(ensemble<3>* e, int system, const particle<3>* points, int num_points, float gravity, float damping);
+template int ensemble_store<2>(const ensemble<2>* e, int system, particle<2>* points);
+template int ensemble_store<3>(const ensemble<3>* e, int system, particle<3>* points);
+template void ensemble_step<2>(ensemble<2>* e, int steps);
+template void ensemble_step<3>(ensemble<3>* e, int steps);
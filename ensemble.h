@@ -0,0 +1,53 @@
+#ifndef ENSEMBLE_H
+#define ENSEMBLE_H
+
+#include <stdint.h>
+
+#include "particle.h"
+
+// Many small independent systems stepped together, for parameter studies
+// where each one alone is too small to fill a vector unit or a core.
+// Systems are grouped into blocks of ensemble_lanes, and within a block the
+// same body slot of every system is adjacent in memory, so the direct-sum
+// and collision loops run with one system per SIMD lane; blocks are spread
+// over threads. Each system has its own gravitational constant, boundary
+// damping and body count, and merges and compaction happen per system.
+const int ensemble_lanes = 16;
+
+template <int D>
+struct ensemble {
+    int num_systems;
+    int num_blocks;
+    // Body slots per system.
+    int capacity;
+    // Body k of system s is element (s/lanes*capacity + k)*lanes + s%lanes.
+    // Dead and unused slots have zero mass and radius.
+    float* mass;
+    float* radius;
+    float* position[D];
+    float* velocity[D];
+    float* acceleration[D];
+    uint64_t* id;
+    // Per system: live bodies, and slots in use since the last compaction.
+    int* count;
+    int* extent;
+    float* gravity;
+    float* damping;
+    // Half-size of the square box around every system; 0 leaves them open.
+    float square_size;
+    long steps;
+    long merges;
+};
+
+template <int D>
+void ensemble_init(ensemble<D>* e, int num_systems, int capacity, float square_size);
+template <int D>
+void ensemble_free(ensemble<D>* e);
+template <int D>
+void ensemble_load(ensemble<D>* e, int system, const particle<D>* points, int num_points, float gravity, float damping);
+template <int D>
+int ensemble_store(const ensemble<D>* e, int system, particle<D>* points);
+template <int D>
+void ensemble_step(ensemble<D>* e, int steps);
+
+#endif
@@ -0,0 +1,76 @@
+#include "escape.h"
+
+#include <stdlib.h>
+
+template <int D>
+void escape_list_init(escape_list<D>* list) {
+    list->capacity = 64;
+    list->records = (escape_record<D>*) malloc(list->capacity*sizeof(escape_record<D>));
+    list->count = 0;
+}
+
+template <int D>
+void escape_list_free(escape_list<D>* list) {
+    free(list->records);
+    list->records = NULL;
+    list->count = 0;
+    list->capacity = 0;
+}
+
+// Returns the number of bodies retired. Survivors keep their relative order
+// and their slots are updated in the index; retired IDs map to -1.
+template <int D>
+int escape_retire(particle<D>* points, int* num_points, struct ParticleIndex* index, escape_list<D>* list, float gravitational_constant, float radius, long step, double time) {
+    int n = *num_points;
+    float total_mass = 0.0f;
+    vec<D> moment = vec_zero<D>();
+    vec<D> momentum = vec_zero<D>();
+    for (int i = 0; i < n; i++) {
+        total_mass += points[i].mass;
+        moment += points[i].position * points[i].mass;
+        momentum += points[i].velocity * points[i].mass;
+    }
+    if (total_mass <= 0.0f) {
+        return 0;
+    }
+    vec<D> com_position = moment * (1.0f/total_mass);
+    vec<D> com_velocity = momentum * (1.0f/total_mass);
+    float radius_sq = radius*radius;
+
+    int kept = 0;
+    for (int i = 0; i < n; i++) {
+        vec<D> position = points[i].position - com_position;
+        float distance_sq = dot(position, position);
+        int escaped = 0;
+        vec<D> velocity;
+        if (distance_sq > radius_sq) {
+            velocity = points[i].velocity - com_velocity;
+            float energy = 0.5f*dot(velocity, velocity) - gravitational_constant*(total_mass - points[i].mass)/sqrtf(distance_sq);
+            escaped = energy > 0.0f;
+        }
+        if (!escaped) {
+            if (kept != i) {
+                points[kept] = points[i];
+                particle_index_move(index, points[kept].id, kept);
+            }
+            kept++;
+            continue;
+        }
+        if (list->count == list->capacity) {
+            list->capacity *= 2;
+            list->records = (escape_record<D>*) realloc(list->records, list->capacity*sizeof(escape_record<D>));
+        }
+        escape_record<D> record = {points[i].id, points[i].mass, step, time, position, velocity};
+        list->records[list->count++] = record;
+        particle_index_move(index, points[i].id, -1);
+    }
+    *num_points = kept;
+    return n - kept;
+}
+
+template void escape_list_init<2>(escape_list<2>* list);
+template void escape_list_init<3>(escape_list<3>* list);
+template void escape_list_free<2>(escape_list<2>* list);
+template void escape_list_free<3>(escape_list<3>* list);
+template int escape_retire<2>(particle<2>* points, int* num_points, struct ParticleIndex* index, escape_list<2>* list, float gravitational_constant, float radius, long step, double time);
+template int escape_retire<3>(particle<3>* points, int* num_points, struct ParticleIndex* index, escape_list<3>* list, float gravitational_constant, float radius, long step, double time);
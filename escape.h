@@ -0,0 +1,36 @@
+#ifndef ESCAPE_H
+#define ESCAPE_H
+
+#include "particle.h"
+#include "particle_index.h"
+
+// Bodies that left the system for good. A body counts as escaped once it is
+// beyond the escape radius from the barycenter with positive specific energy
+// against the rest of the system taken as a point mass; it is then removed
+// from the particle array and recorded here.
+template <int D>
+struct escape_record {
+    uint64_t id;
+    float mass;
+    long step;
+    double time;
+    // Barycentric position and velocity when the body was retired.
+    vec<D> position;
+    vec<D> velocity;
+};
+
+template <int D>
+struct escape_list {
+    escape_record<D>* records;
+    int count;
+    int capacity;
+};
+
+template <int D>
+void escape_list_init(escape_list<D>* list);
+template <int D>
+void escape_list_free(escape_list<D>* list);
+template <int D>
+int escape_retire(particle<D>* points, int* num_points, struct ParticleIndex* index, escape_list<D>* list, float gravitational_constant, float radius, long step, double time);
+
+#endif
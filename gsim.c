@@ -0,0 +1,327 @@
+#include "gsim.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "loader.h"
+#include "simulation.h"
+
+static_assert((int) GSIM_TELEPORT_RANDOM == TELEPORT_RANDOM && (int) GSIM_MULTI_BELT == MULTI_BELT
+    && (int) GSIM_LINEAR_BVH == LINEAR_BVH && (int) GSIM_HERMITE == HERMITE && (int) GSIM_VERLET_LIST == VERLET_LIST,
+    "gsim.h constants must match simulation.h");
+
+struct gsim {
+    struct SimulationState state;
+    Particle* points;
+    int num_points;
+};
+
+// The core holds one simulation in its globals. Each call swaps the handle's
+// state in and back out, restoring whatever was there before, so handles and
+// code driving the globals directly can be mixed.
+static pthread_mutex_t core_lock = PTHREAD_MUTEX_INITIALIZER;
+
+template <typename F>
+static void with_state(gsim* sim, F fn) {
+    pthread_mutex_lock(&core_lock);
+    struct SimulationState saved;
+    simulation_save(&saved);
+    simulation_load(&sim->state);
+    fn();
+    simulation_save(&sim->state);
+    simulation_load(&saved);
+    pthread_mutex_unlock(&core_lock);
+}
+
+gsim* gsim_create(void) {
+    gsim* sim = (gsim*) calloc(1, sizeof(gsim));
+    simulation_runtime_acquire();
+    // The configuration starts out as the process's; the state is fresh.
+    pthread_mutex_lock(&core_lock);
+    simulation_save(&sim->state);
+    pthread_mutex_unlock(&core_lock);
+    with_state(sim, []() {
+        simulation_reset(0);
+    });
+    return sim;
+}
+
+void gsim_destroy(gsim* sim) {
+    if (sim == NULL) {
+        return;
+    }
+    with_state(sim, []() {
+        simulation_release();
+    });
+    free(sim->points);
+    free(sim);
+    simulation_runtime_release();
+}
+
+void gsim_get_layout(gsim_layout* layout) {
+    layout->dimensions = dimensions;
+    layout->record_size = sizeof(Particle);
+    layout->radius_offset = offsetof(Particle, radius);
+    layout->mass_offset = offsetof(Particle, mass);
+    layout->position_offset = offsetof(Particle, position);
+    layout->velocity_offset = offsetof(Particle, velocity);
+    layout->acceleration_offset = offsetof(Particle, acceleration);
+    layout->id_offset = offsetof(Particle, id);
+}
+
+int gsim_generate(gsim* sim, int count, unsigned int seed) {
+    if (count < 0) {
+        return -1;
+    }
+    Particle* points = alloc_points(count);
+    with_state(sim, [&]() {
+        simulation_release();
+        srand(seed);
+        gen_points(count, points);
+        simulation_reset(count);
+    });
+    free(sim->points);
+    sim->points = points;
+    sim->num_points = count;
+    return 0;
+}
+
+int gsim_load(gsim* sim, int count, const float* positions, const float* velocities, const float* masses) {
+    if (count < 0 || (count > 0 && (positions == NULL || masses == NULL))) {
+        return -1;
+    }
+    for (int i = 0; i < count; i++) {
+        if (!(masses[i] > 0.0f)) {
+            return -1;
+        }
+    }
+    Particle* points = alloc_points(count);
+    with_state(sim, [&]() {
+        simulation_release();
+        for (int i = 0; i < count; i++) {
+            vec<dimensions> position;
+            for (int d = 0; d < dimensions; d++) {
+                position[d] = positions[i*dimensions + d];
+            }
+            points[i] = p_init(masses[i], position, 0.0f, 0.0f);
+            for (int d = 0; d < dimensions && velocities != NULL; d++) {
+                points[i].velocity[d] = velocities[i*dimensions + d];
+            }
+            points[i].id = i;
+        }
+        simulation_reset(count);
+    });
+    free(sim->points);
+    sim->points = points;
+    sim->num_points = count;
+    return 0;
+}
+
+int gsim_load_file(gsim* sim, const char* path) {
+    struct LoadSource source;
+    if (load_open(&source, path, dimensions, &task_pool) != 0) {
+        return -1;
+    }
+    int count = (int) source.num_rows;
+    Particle* points = alloc_points(count);
+    int status;
+    with_state(sim, [&]() {
+        // The radius rule reads the handle's rad_mass_factor.
+        status = load_fill(&source, points, &task_pool);
+        if (status == 0) {
+            simulation_release();
+            simulation_reset(count);
+        }
+    });
+    load_close(&source);
+    if (status != 0) {
+        free(points);
+        return -1;
+    }
+    free(sim->points);
+    sim->points = points;
+    sim->num_points = count;
+    return 0;
+}
+
+void gsim_step(gsim* sim) {
+    gsim_advance(sim, 1);
+}
+
+void gsim_advance(gsim* sim, int steps) {
+    with_state(sim, [&]() {
+        for (int s = 0; s < steps; s++) {
+            iterate(sim->points, &sim->num_points, &tree);
+        }
+    });
+}
+
+int gsim_set_force_mode(gsim* sim, int mode) {
+    if (mode < DIRECT_SUM || mode > LINEAR_BVH) {
+        return -1;
+    }
+    sim->state.force_mode = mode;
+    return 0;
+}
+
+int gsim_set_integrator(gsim* sim, int integrator) {
+    if (integrator < EULER || integrator > HERMITE) {
+        return -1;
+    }
+    sim->state.integrator = integrator;
+    return 0;
+}
+
+int gsim_set_broad_phase(gsim* sim, int broad_phase) {
+    if (broad_phase < TREE_OR_ALL_PAIRS || broad_phase > VERLET_LIST) {
+        return -1;
+    }
+    sim->state.broad_phase = broad_phase;
+    return 0;
+}
+
+int gsim_set_collision_mode(gsim* sim, int mode) {
+    if (mode < NO_BORDER || mode > TELEPORT_RANDOM) {
+        return -1;
+    }
+    sim->state.collision_mode = mode;
+    return 0;
+}
+
+int gsim_set_pointgen_mode(gsim* sim, int mode) {
+    if (mode < RANDOM_STILL || mode > MULTI_BELT) {
+        return -1;
+    }
+    sim->state.pointgen_mode = mode;
+    return 0;
+}
+
+int gsim_set_damping_factor(gsim* sim, float damping) {
+    if (!(damping >= 0.0f && damping <= 1.0f)) {
+        return -1;
+    }
+    sim->state.damping_factor = damping;
+    return 0;
+}
+
+int gsim_set_rad_mass_factor(gsim* sim, int factor) {
+    if (factor <= 0) {
+        return -1;
+    }
+    sim->state.rad_mass_factor = factor;
+    return 0;
+}
+
+int gsim_set_escape_radius(gsim* sim, float radius) {
+    if (!(radius >= 0.0f)) {
+        return -1;
+    }
+    sim->state.escape_radius = radius;
+    return 0;
+}
+
+int gsim_set_passive_mass_threshold(gsim* sim, float mass) {
+    if (!(mass >= 0.0f)) {
+        return -1;
+    }
+    sim->state.passive_mass_threshold = mass;
+    return 0;
+}
+
+int gsim_set_respa(gsim* sim, int interval, float cutoff) {
+    if (interval < 1 || !(cutoff > 0.0f)) {
+        return -1;
+    }
+    sim->state.respa_interval = interval;
+    sim->state.respa_cutoff = cutoff;
+    return 0;
+}
+
+int gsim_set_swept_collisions(gsim* sim, int enabled) {
+    sim->state.swept_collisions = enabled != 0;
+    return 0;
+}
+
+int gsim_set_reorder_interval(gsim* sim, int interval) {
+    if (interval < 0) {
+        return -1;
+    }
+    sim->state.reorder_interval = interval;
+    return 0;
+}
+
+int gsim_set_opening_angle(gsim* sim, float theta) {
+    if (!(theta > 0.0f)) {
+        return -1;
+    }
+    sim->state.opening_angle = theta;
+    return 0;
+}
+
+int gsim_set_autotune(gsim* sim, int enabled, float error_budget) {
+    if (!(error_budget > 0.0f)) {
+        return -1;
+    }
+    sim->state.autotune = enabled != 0;
+    sim->state.autotune_error_budget = error_budget;
+    // Enabling tunes again at the next step.
+    sim->state.autotune_count = 0;
+    return 0;
+}
+
+int gsim_get_collision_mode(const gsim* sim) {
+    return sim->state.collision_mode;
+}
+
+int gsim_count(const gsim* sim) {
+    return sim->num_points;
+}
+
+long gsim_step_count(const gsim* sim) {
+    return sim->state.step_count;
+}
+
+double gsim_time(const gsim* sim) {
+    return sim->state.simulated_time;
+}
+
+int gsim_merges(const gsim* sim) {
+    return sim->state.particle_index.num_merges;
+}
+
+double gsim_energy(const gsim* sim) {
+    return total_energy(sim->points, sim->num_points);
+}
+
+double gsim_bodies_energy(const void* bodies, int count) {
+    return total_energy((const Particle*) bodies, count);
+}
+
+void* gsim_bodies(gsim* sim) {
+    return sim->points;
+}
+
+static void* field(gsim* sim, size_t offset) {
+    return sim->points != NULL ? (char*) sim->points + offset : NULL;
+}
+
+float* gsim_radii(gsim* sim) {
+    return (float*) field(sim, offsetof(Particle, radius));
+}
+
+float* gsim_masses(gsim* sim) {
+    return (float*) field(sim, offsetof(Particle, mass));
+}
+
+float* gsim_positions(gsim* sim) {
+    return (float*) field(sim, offsetof(Particle, position));
+}
+
+float* gsim_velocities(gsim* sim) {
+    return (float*) field(sim, offsetof(Particle, velocity));
+}
+
+const uint64_t* gsim_ids(gsim* sim) {
+    return (const uint64_t*) field(sim, offsetof(Particle, id));
+}
@@ -0,0 +1,137 @@
+#ifndef GSIM_H
+#define GSIM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// C interface to the simulation, built as libgsim.a and libgsim.so. A gsim
+// handle owns one simulation: its bodies, configuration and the state kept
+// across steps. Handles are independent, but the core runs one step at a
+// time, so steps of different handles called from different threads take
+// turns.
+//
+// Bodies live in one array of fixed-size records, described by gsim_layout.
+// gsim_bodies() and the field accessors point straight into that array, so
+// reading state costs no copy; body k's value of a field is at
+// (char*) field + k*record_size. The pointers stay valid until the next call
+// that steps, generates or loads, since steps merge, compact and re-sort the
+// array. Writes through them take effect at the next step, except to ids,
+// which must not change.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct gsim gsim;
+
+typedef struct gsim_layout {
+    int dimensions;
+    size_t record_size;
+    size_t radius_offset;
+    size_t mass_offset;
+    size_t position_offset;
+    size_t velocity_offset;
+    size_t acceleration_offset;
+    size_t id_offset;
+} gsim_layout;
+
+enum {
+    GSIM_NO_BORDER = 1,
+    GSIM_SQUARE = 2,
+    GSIM_CIRCLE = 3,
+    GSIM_TELEPORT_CENTER = 4,
+    GSIM_TELEPORT_RANDOM = 5
+};
+
+enum {
+    GSIM_RANDOM_STILL = 1,
+    GSIM_RANDOM_VELOCITIES = 2,
+    GSIM_OUTWARDS_VELOCITIES = 3,
+    GSIM_ASTEROID_BELT = 4,
+    GSIM_PLUMMER_SPHERE = 5,
+    GSIM_EXPONENTIAL_DISK = 6,
+    GSIM_UNIFORM_DISC = 7,
+    GSIM_MULTI_BELT = 8
+};
+
+enum {
+    GSIM_DIRECT_SUM = 1,
+    GSIM_BARNES_HUT = 2,
+    GSIM_LINEAR_BVH = 3
+};
+
+enum {
+    GSIM_EULER = 1,
+    GSIM_WISDOM_HOLMAN = 2,
+    GSIM_HERMITE = 3
+};
+
+enum {
+    GSIM_TREE_OR_ALL_PAIRS = 1,
+    GSIM_SWEEP_AND_PRUNE = 2,
+    GSIM_UNIFORM_GRID = 3,
+    GSIM_VERLET_LIST = 4
+};
+
+// An empty simulation with the default configuration.
+gsim* gsim_create(void);
+void gsim_destroy(gsim* sim);
+void gsim_get_layout(gsim_layout* layout);
+
+// Replace the bodies, either from the configured generator or from packed
+// arrays of dimensions floats per body (velocities may be NULL). Radii
+// follow from the masses, and ids are 0..count-1. Both reset the step count
+// and merge history. Return 0, or -1 on a bad argument.
+int gsim_generate(gsim* sim, int count, unsigned int seed);
+int gsim_load(gsim* sim, int count, const float* positions, const float* velocities, const float* masses);
+// Replace the bodies from a file, in one of the formats loader.h describes:
+// a CSV file, or raw float32 column files named by a pattern with %s.
+// Returns 0, or -1 with a message on stderr.
+int gsim_load_file(gsim* sim, const char* path);
+
+void gsim_step(gsim* sim);
+void gsim_advance(gsim* sim, int steps);
+
+// Configuration, in effect from the next step. Setters return 0, or -1 and
+// change nothing if the value is out of range.
+int gsim_set_force_mode(gsim* sim, int mode);
+int gsim_set_integrator(gsim* sim, int integrator);
+int gsim_set_broad_phase(gsim* sim, int broad_phase);
+int gsim_set_collision_mode(gsim* sim, int mode);
+int gsim_set_pointgen_mode(gsim* sim, int mode);
+int gsim_set_damping_factor(gsim* sim, float damping);
+int gsim_set_rad_mass_factor(gsim* sim, int factor);
+int gsim_set_escape_radius(gsim* sim, float radius);
+int gsim_set_passive_mass_threshold(gsim* sim, float mass);
+int gsim_set_respa(gsim* sim, int interval, float cutoff);
+int gsim_set_swept_collisions(gsim* sim, int enabled);
+int gsim_set_reorder_interval(gsim* sim, int interval);
+// Opening angle of the tree force modes.
+int gsim_set_opening_angle(gsim* sim, float theta);
+// With tuning enabled, the first step and any step after merges or escapes
+// have cut the body count by a quarter first pick the force mode, opening
+// angle and broad phase that run fastest with an RMS relative field error
+// within error_budget, logging the trials to stdout.
+int gsim_set_autotune(gsim* sim, int enabled, float error_budget);
+int gsim_get_collision_mode(const gsim* sim);
+
+int gsim_count(const gsim* sim);
+long gsim_step_count(const gsim* sim);
+double gsim_time(const gsim* sim);
+int gsim_merges(const gsim* sim);
+double gsim_energy(const gsim* sim);
+// Total energy of count records copied out of a simulation.
+double gsim_bodies_energy(const void* bodies, int count);
+
+void* gsim_bodies(gsim* sim);
+float* gsim_radii(gsim* sim);
+float* gsim_masses(gsim* sim);
+float* gsim_positions(gsim* sim);
+float* gsim_velocities(gsim* sim);
+const uint64_t* gsim_ids(gsim* sim);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,68 @@
+#include "hermite.h"
+
+#include <math.h>
+
+// The particle's own position and velocity are overwritten with the
+// prediction; the start-of-step values go to old_position and old_velocity.
+template <int D>
+void hermite_predict(particle<D>* points, int num_points, float dt, vec<D>* old_position, vec<D>* old_velocity) {
+    float dt2 = dt*dt/2.0f;
+    float dt3 = dt*dt*dt/6.0f;
+    #pragma omp parallel for
+    for (int i = 0; i < num_points; i++) {
+        particle<D>& p = points[i];
+        old_position[i] = p.position;
+        old_velocity[i] = p.velocity;
+        p.position += p.velocity*dt + p.acceleration*dt2 + p.jerk*dt3;
+        p.velocity += p.acceleration*dt + p.jerk*dt2;
+    }
+}
+
+// acceleration and jerk hold the values at the predicted state and replace
+// the particles' start-of-step ones. Returns the smallest Aarseth step
+//     sqrt(eta * (|a||a2| + |j|^2) / (|j||a3| + |a2|^2))
+// over all bodies, evaluated at the end of the step.
+template <int D>
+float hermite_correct(particle<D>* points, int num_points, float dt, const vec<D>* old_position, const vec<D>* old_velocity, const vec<D>* acceleration, const vec<D>* jerk, float eta) {
+    float min_step = INFINITY;
+    #pragma omp parallel for reduction(min:min_step)
+    for (int i = 0; i < num_points; i++) {
+        particle<D>& p = points[i];
+        vec<D> a0 = p.acceleration, j0 = p.jerk;
+        vec<D> a1 = acceleration[i], j1 = jerk[i];
+        p.velocity = old_velocity[i] + (a0 + a1)*(dt/2.0f) + (j0 - j1)*(dt*dt/12.0f);
+        p.position = old_position[i] + (old_velocity[i] + p.velocity)*(dt/2.0f) + (a0 - a1)*(dt*dt/12.0f);
+        p.acceleration = a1;
+        p.jerk = j1;
+
+        vec<D> snap = ((a0 - a1)*-6.0f - (j0*4.0f + j1*2.0f)*dt) * (1.0f/(dt*dt));
+        vec<D> crackle = ((a0 - a1)*12.0f + (j0 + j1)*(6.0f*dt)) * (1.0f/(dt*dt*dt));
+        snap += crackle*dt;
+        float a = magnitude(a1), j = magnitude(j1), s = magnitude(snap), c = magnitude(crackle);
+        float denominator = j*c + s*s;
+        if (denominator > 0.0f) {
+            min_step = fminf(min_step, sqrtf(eta*(a*s + j*j)/denominator));
+        }
+    }
+    return min_step;
+}
+
+// Starting step before any higher derivatives are known: eta * min |a|/|j|.
+template <int D>
+float hermite_initial_step(const particle<D>* points, int num_points, float eta) {
+    float min_step = INFINITY;
+    for (int i = 0; i < num_points; i++) {
+        float j = magnitude(points[i].jerk);
+        if (j > 0.0f) {
+            min_step = fminf(min_step, eta*magnitude(points[i].acceleration)/j);
+        }
+    }
+    return min_step;
+}
+
+template void hermite_predict<2>(particle<2>* points, int num_points, float dt, vec<2>* old_position, vec<2>* old_velocity);
+template void hermite_predict<3>(particle<3>* points, int num_points, float dt, vec<3>* old_position, vec<3>* old_velocity);
+template float hermite_correct<2>(particle<2>* points, int num_points, float dt, const vec<2>* old_position, const vec<2>* old_velocity, const vec<2>* acceleration, const vec<2>* jerk, float eta);
+template float hermite_correct<3>(particle<3>* points, int num_points, float dt, const vec<3>* old_position, const vec<3>* old_velocity, const vec<3>* acceleration, const vec<3>* jerk, float eta);
+template float hermite_initial_step<2>(const particle<2>* points, int num_points, float eta);
+template float hermite_initial_step<3>(const particle<3>* points, int num_points, float eta);
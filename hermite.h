@@ -0,0 +1,20 @@
+#ifndef HERMITE_H
+#define HERMITE_H
+
+#include "particle.h"
+
+// Fourth-order Hermite predictor-corrector with a shared timestep. A step
+// predicts positions and velocities from the acceleration and jerk stored in
+// the particles (hermite_predict), evaluates both again at the predicted
+// state, and corrects with the two-point Hermite interpolant
+// (hermite_correct). The corrector also yields the second and third
+// derivatives of the acceleration, from which it returns Aarseth's step
+// estimate, so each step costs a single force evaluation.
+template <int D>
+void hermite_predict(particle<D>* points, int num_points, float dt, vec<D>* old_position, vec<D>* old_velocity);
+template <int D>
+float hermite_correct(particle<D>* points, int num_points, float dt, const vec<D>* old_position, const vec<D>* old_velocity, const vec<D>* acceleration, const vec<D>* jerk, float eta);
+template <int D>
+float hermite_initial_step(const particle<D>* points, int num_points, float eta);
+
+#endif
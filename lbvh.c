@@ -0,0 +1,214 @@
+#include "lbvh.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+#include "morton.h"
+
+template <int D>
+void lbvh_init(lbvh<D>* tree) {
+    tree->nodes = NULL;
+    tree->parent = NULL;
+    tree->visits = NULL;
+    tree->num_leaves = 0;
+    tree->capacity = 0;
+    tree->min_source_mass = 0.0f;
+    tree->builds = 0;
+}
+
+template <int D>
+void lbvh_free(lbvh<D>* tree) {
+    free(tree->nodes);
+    free(tree->parent);
+    free(tree->visits);
+    lbvh_init(tree);
+}
+
+// Length of the common prefix of sorted keys i and j, or -1 when j is out of
+// range. Equal codes fall back to comparing the indices, so every key is
+// distinct and duplicates still split into a proper binary tree.
+static inline int common_prefix(const uint64_t* codes, int n, int i, int j) {
+    if (j < 0 || j >= n) {
+        return -1;
+    }
+    uint64_t diff = codes[i] ^ codes[j];
+    if (diff == 0) {
+        return 64 + __builtin_clz((uint32_t) i ^ (uint32_t) j);
+    }
+    return __builtin_clzll(diff);
+}
+
+// Internal node i covers a range of sorted keys with i at one end. The
+// direction of the range comes from which neighbor shares the longer prefix,
+// its far end from a search for the last key sharing more than the
+// neighbor on the other side, and the split from the first bit where the
+// range's keys differ.
+static void emit_internal_node(const uint64_t* codes, int n, int i, int* left, int* right) {
+    int dir = common_prefix(codes, n, i, i + 1) > common_prefix(codes, n, i, i - 1) ? 1 : -1;
+    int min_prefix = common_prefix(codes, n, i, i - dir);
+    int max_length = 2;
+    while (common_prefix(codes, n, i, i + max_length*dir) > min_prefix) {
+        max_length *= 2;
+    }
+    int length = 0;
+    for (int step = max_length/2; step >= 1; step /= 2) {
+        if (common_prefix(codes, n, i, i + (length + step)*dir) > min_prefix) {
+            length += step;
+        }
+    }
+    int j = i + length*dir;
+
+    int node_prefix = common_prefix(codes, n, i, j);
+    int offset = 0;
+    int divisor = 2;
+    int step;
+    do {
+        step = (length + divisor - 1)/divisor;
+        if (common_prefix(codes, n, i, i + (offset + step)*dir) > node_prefix) {
+            offset += step;
+        }
+        divisor *= 2;
+    } while (step > 1);
+    int split = i + offset*dir + (dir < 0 ? -1 : 0);
+
+    int first = i < j ? i : j;
+    int last = i < j ? j : i;
+    *left = first == split ? n - 1 + split : split;
+    *right = last == split + 1 ? n - 1 + split + 1 : split + 1;
+}
+
+template <int D>
+void merge_children(lbvh_node<D>* nodes, int node) {
+    const lbvh_node<D>& a = nodes[nodes[node].left];
+    const lbvh_node<D>& b = nodes[nodes[node].right];
+    lbvh_node<D>& n = nodes[node];
+    for (int d = 0; d < D; d++) {
+        n.lo[d] = a.lo[d] < b.lo[d] ? a.lo[d] : b.lo[d];
+        n.hi[d] = a.hi[d] > b.hi[d] ? a.hi[d] : b.hi[d];
+    }
+    n.mass = a.mass + b.mass;
+    n.com = n.mass > 0.0f ? (a.com*a.mass + b.com*b.mass) * (1.0f/n.mass) : (a.com + b.com) * 0.5f;
+}
+
+template <int D>
+void lbvh_build(lbvh<D>* tree, const particle<D>* points, int num_points, struct Arena* arena) {
+    tree->builds++;
+    tree->num_leaves = num_points;
+    if (num_points == 0) {
+        return;
+    }
+    int num_nodes = 2*num_points - 1;
+    if (num_nodes > tree->capacity) {
+        int capacity = num_nodes > 2*tree->capacity ? num_nodes : 2*tree->capacity;
+        tree->nodes = (lbvh_node<D>*) realloc(tree->nodes, capacity*sizeof(lbvh_node<D>));
+        tree->parent = (int*) realloc(tree->parent, capacity*sizeof(int));
+        tree->visits = (int*) realloc(tree->visits, capacity*sizeof(int));
+        tree->capacity = capacity;
+    }
+
+    uint64_t* codes = (uint64_t*) arena_alloc(arena, num_points*sizeof(uint64_t));
+    uint32_t* order = (uint32_t*) arena_alloc(arena, num_points*sizeof(uint32_t));
+    morton_codes(points, num_points, codes);
+    #pragma omp parallel for
+    for (int i = 0; i < num_points; i++) {
+        order[i] = i;
+    }
+    radix_sort(codes, order, num_points, D*morton_bits, arena);
+
+    lbvh_node<D>* nodes = tree->nodes;
+    int* parent = tree->parent;
+    int* visits = tree->visits;
+    parent[0] = -1;
+    #pragma omp parallel for
+    for (int i = 0; i < num_points - 1; i++) {
+        int left, right;
+        emit_internal_node(codes, num_points, i, &left, &right);
+        nodes[i].left = left;
+        nodes[i].right = right;
+        parent[left] = i;
+        parent[right] = i;
+        visits[i] = 0;
+    }
+
+    // Each leaf climbs towards the root; the first child to reach a node
+    // stops there and the second, which knows both children are final,
+    // merges them and carries on.
+    #pragma omp parallel for
+    for (int k = 0; k < num_points; k++) {
+        int leaf = num_points - 1 + k;
+        const particle<D>& p = points[order[k]];
+        nodes[leaf].lo = p.position;
+        nodes[leaf].hi = p.position;
+        nodes[leaf].com = p.position;
+        nodes[leaf].mass = p.mass >= tree->min_source_mass ? p.mass : 0.0f;
+        nodes[leaf].left = -1;
+        nodes[leaf].right = (int) order[k];
+        int node = parent[leaf];
+        while (node >= 0) {
+            int arrived;
+            #pragma omp atomic capture seq_cst
+            arrived = visits[node]++;
+            if (arrived == 0) {
+                break;
+            }
+            merge_children(nodes, node);
+            node = parent[node];
+        }
+    }
+}
+
+// Same opening criterion as quadtree_field: a node is taken as one mass when
+// its widest side is under theta times its distance and the body lies
+// outside its bounds.
+template <int D>
+vec<D> lbvh_field(const lbvh<D>* tree, const particle<D>* points, int slot, float theta) {
+    vec<D> field = vec_zero<D>();
+    if (tree->num_leaves == 0) {
+        return field;
+    }
+    const vec<D>& pos = points[slot].position;
+    int stack[lbvh_stack_size];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+        const lbvh_node<D>& node = tree->nodes[stack[--top]];
+        if (node.mass <= 0.0f) {
+            continue;
+        }
+        if (node.left < 0) {
+            if (node.right != slot) {
+                vec<D> delta = node.com - pos;
+                float distance_sq = dot(delta, delta);
+                field += delta * (node.mass/(distance_sq*sqrtf(distance_sq)));
+            }
+            continue;
+        }
+        vec<D> delta = node.com - pos;
+        float distance_sq = dot(delta, delta);
+        float size = 0.0f;
+        int inside = 1;
+        for (int d = 0; d < D; d++) {
+            float extent = node.hi[d] - node.lo[d];
+            size = extent > size ? extent : size;
+            if (pos[d] < node.lo[d] || pos[d] > node.hi[d]) {
+                inside = 0;
+            }
+        }
+        if (size*size < theta*theta*distance_sq && !inside) {
+            field += delta * (node.mass/(distance_sq*sqrtf(distance_sq)));
+        } else {
+            stack[top++] = node.left;
+            stack[top++] = node.right;
+        }
+    }
+    return field;
+}
+
+template void lbvh_init<2>(lbvh<2>* tree);
+template void lbvh_init<3>(lbvh<3>* tree);
+template void lbvh_free<2>(lbvh<2>* tree);
+template void lbvh_free<3>(lbvh<3>* tree);
+template void lbvh_build<2>(lbvh<2>* tree, const particle<2>* points, int num_points, struct Arena* arena);
+template void lbvh_build<3>(lbvh<3>* tree, const particle<3>* points, int num_points, struct Arena* arena);
+template vec<2> lbvh_field<2>(const lbvh<2>* tree, const particle<2>* points, int slot, float theta);
+template vec<3> lbvh_field<3>(const lbvh<3>* tree, const particle<3>* points, int slot, float theta);
@@ -0,0 +1,55 @@
+#ifndef LBVH_H
+#define LBVH_H
+
+#include "arena.h"
+#include "particle.h"
+
+// Linear bounding volume hierarchy over the particle array, rebuilt from
+// scratch for every force pass (Karras, "Maximizing parallelism in the
+// construction of BVHs, octrees and k-d trees", 2012). Particles are sorted
+// by Morton code, every internal node is emitted independently from the
+// sorted codes, and bounds and mass moments are then accumulated bottom-up.
+// All steps are parallel loops over flat arrays.
+//
+// For N particles nodes[0, N-1) are the internal nodes, with the root at 0,
+// and nodes[N-1, 2N-1) are the leaves in Morton order, one particle each.
+template <int D>
+struct lbvh_node {
+    vec<D> lo;
+    vec<D> hi;
+    vec<D> com;
+    float mass;
+    // Children of an internal node; a leaf has left = -1 and keeps its
+    // particle's slot in right.
+    int left;
+    int right;
+};
+
+// Codes are 64 bits and ties are broken by 32 more bits of index, so no root
+// to leaf path is longer than 96 nodes; a traversal holds at most one
+// pending sibling per level.
+const int lbvh_stack_size = 128;
+
+template <int D>
+struct lbvh {
+    lbvh_node<D>* nodes;
+    int* parent;
+    int* visits;
+    int num_leaves;
+    int capacity;
+    // Particles lighter than this are leaves with no mass, so as in the
+    // quadtree fields only come from the heavier (active) bodies.
+    float min_source_mass;
+    long builds;
+};
+
+template <int D>
+void lbvh_init(lbvh<D>* tree);
+template <int D>
+void lbvh_free(lbvh<D>* tree);
+template <int D>
+void lbvh_build(lbvh<D>* tree, const particle<D>* points, int num_points, struct Arena* arena);
+template <int D>
+vec<D> lbvh_field(const lbvh<D>* tree, const particle<D>* points, int slot, float theta);
+
+#endif
@@ -0,0 +1,382 @@
+#include "loader.h"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "physics.h"
+
+const int load_row_grain = 4096;
+
+static const double powers_of_ten[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// Decimal number at p, without strtof's locale lookups. Digits past the
+// 17th cannot change a float, so they only move the exponent. Returns the
+// end of the number, or NULL if there is none.
+static const char* parse_float(const char* p, const char* end, float* value) {
+    while (p < end && (*p == ' ' || *p == '\t')) {
+        p++;
+    }
+    int negative = p < end && *p == '-';
+    if (p < end && (*p == '-' || *p == '+')) {
+        p++;
+    }
+    uint64_t mantissa = 0;
+    int exponent = 0;
+    int digits = 0;
+    while (p < end && (unsigned) (*p - '0') < 10) {
+        if (mantissa < 100000000000000000ull) {
+            mantissa = mantissa*10 + (*p - '0');
+        } else {
+            exponent++;
+        }
+        digits++;
+        p++;
+    }
+    if (p < end && *p == '.') {
+        p++;
+        while (p < end && (unsigned) (*p - '0') < 10) {
+            if (mantissa < 100000000000000000ull) {
+                mantissa = mantissa*10 + (*p - '0');
+                exponent--;
+            }
+            digits++;
+            p++;
+        }
+    }
+    if (digits == 0) {
+        return NULL;
+    }
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        p++;
+        int negative_exponent = p < end && *p == '-';
+        if (p < end && (*p == '-' || *p == '+')) {
+            p++;
+        }
+        if (p == end || (unsigned) (*p - '0') >= 10) {
+            return NULL;
+        }
+        int e = 0;
+        while (p < end && (unsigned) (*p - '0') < 10) {
+            if (e < 10000) {
+                e = e*10 + (*p - '0');
+            }
+            p++;
+        }
+        exponent += negative_exponent ? -e : e;
+    }
+    double v = (double) mantissa;
+    if (exponent < 0) {
+        v = exponent >= -22 ? v/powers_of_ten[-exponent] : v*pow(10.0, exponent);
+    } else if (exponent > 0) {
+        v = exponent <= 22 ? v*powers_of_ten[exponent] : v*pow(10.0, exponent);
+    }
+    *value = (float) (negative ? -v : v);
+    return p;
+}
+
+static int is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+// Rows are the lines holding anything but whitespace.
+static long count_rows(const char* p, const char* end) {
+    long rows = 0;
+    while (p < end) {
+        if (is_space(*p)) {
+            p++;
+            continue;
+        }
+        rows++;
+        const char* newline = (const char*) memchr(p, '\n', end - p);
+        p = newline != NULL ? newline + 1 : end;
+    }
+    return rows;
+}
+
+static const void* map_file(const char* path, size_t* size) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat info;
+    const void* data = NULL;
+    if (fstat(fd, &info) == 0) {
+        *size = info.st_size;
+        // An empty file maps to nothing, but is still a valid empty input.
+        data = "";
+        if (*size > 0) {
+            void* mapped = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+            data = mapped != MAP_FAILED ? mapped : NULL;
+            if (data != NULL) {
+                madvise(mapped, *size, MADV_WILLNEED);
+            }
+        }
+    }
+    close(fd);
+    return data;
+}
+
+static void unmap_file(const void* data, size_t size) {
+    if (data != NULL && size > 0) {
+        munmap((void*) data, size);
+    }
+}
+
+static int open_csv(struct LoadSource* source, const char* path, struct TaskPool* pool) {
+    source->data = (const char*) map_file(path, &source->size);
+    if (source->data == NULL) {
+        perror(path);
+        return -1;
+    }
+    const char* p = source->data;
+    const char* end = p + source->size;
+    while (p < end && is_space(*p)) {
+        p++;
+    }
+    const char* newline = p < end ? (const char*) memchr(p, '\n', end - p) : NULL;
+    const char* line_end = newline != NULL ? newline : end;
+    if (p < end && !(*p == '-' || *p == '+' || *p == '.' || (unsigned) (*p - '0') < 10)) {
+        // A header line.
+        p = line_end;
+        while (p < end && is_space(*p)) {
+            p++;
+        }
+        newline = p < end ? (const char*) memchr(p, '\n', end - p) : NULL;
+        line_end = newline != NULL ? newline : end;
+    }
+    source->num_columns = 1;
+    for (const char* c = p; c < line_end; c++) {
+        source->num_columns += *c == ',';
+    }
+    int D = source->dimensions;
+    if (p < end && source->num_columns != 2*D + 1 && source->num_columns != 2*D + 2) {
+        fprintf(stderr, "load: %s has %d columns, expected %d or %d\n", path, source->num_columns, 2*D + 1, 2*D + 2);
+        return -1;
+    }
+    source->has_radius = source->num_columns == 2*D + 2;
+
+    // Chunks start at line breaks, so no row straddles two of them.
+    size_t remaining = end - p;
+    source->num_chunks = (int) ((remaining + load_chunk_size - 1)/load_chunk_size);
+    source->chunks = (struct LoadChunk*) malloc((source->num_chunks + 1)*sizeof(struct LoadChunk));
+    for (int c = 0; c < source->num_chunks; c++) {
+        const char* begin = p + c*load_chunk_size;
+        if (c > 0) {
+            const char* newline = (const char*) memchr(begin - 1, '\n', end - (begin - 1));
+            begin = newline != NULL ? newline + 1 : end;
+        }
+        source->chunks[c].begin = begin;
+    }
+    for (int c = 0; c < source->num_chunks; c++) {
+        source->chunks[c].end = c + 1 < source->num_chunks ? source->chunks[c + 1].begin : end;
+    }
+    task_for(pool, 0, source->num_chunks, 1, [&](int begin, int end) {
+        for (int c = begin; c < end; c++) {
+            source->chunks[c].first_row = count_rows(source->chunks[c].begin, source->chunks[c].end);
+        }
+    });
+    long rows = 0;
+    for (int c = 0; c < source->num_chunks; c++) {
+        long chunk_rows = source->chunks[c].first_row;
+        source->chunks[c].first_row = rows;
+        rows += chunk_rows;
+    }
+    if (rows > INT_MAX) {
+        fprintf(stderr, "load: %s has too many rows\n", path);
+        return -1;
+    }
+    source->num_rows = rows;
+    return 0;
+}
+
+static int open_columns(struct LoadSource* source, const char* pattern) {
+    const char* names_2d[] = {"x", "y", "vx", "vy", "mass", "radius"};
+    const char* names_3d[] = {"x", "y", "z", "vx", "vy", "vz", "mass", "radius"};
+    int D = source->dimensions;
+    const char** names = D == 2 ? names_2d : names_3d;
+    int num_columns = 2*D + 2;
+    // The pattern is not a format string; only its first %s is replaced.
+    const char* slot = strstr(pattern, "%s");
+    size_t column_size = 0;
+    for (int k = 0; k < num_columns; k++) {
+        char path[1024];
+        snprintf(path, sizeof(path), "%.*s%s%s", (int) (slot - pattern), pattern, names[k], slot + 2);
+        source->columns[k] = (const float*) map_file(path, &source->column_sizes[k]);
+        if (source->columns[k] == NULL) {
+            if (k == num_columns - 1) {
+                // No radius column.
+                break;
+            }
+            perror(path);
+            return -1;
+        }
+        if (k > 0 && source->column_sizes[k] != column_size) {
+            fprintf(stderr, "load: %s is %zu bytes, but %s is %zu\n", path, source->column_sizes[k], names[0], column_size);
+            return -1;
+        }
+        column_size = source->column_sizes[k];
+    }
+    if (column_size % sizeof(float) != 0 || column_size/sizeof(float) > INT_MAX) {
+        fprintf(stderr, "load: %s columns are %zu bytes, not a count of float32 values\n", pattern, column_size);
+        return -1;
+    }
+    source->has_radius = source->columns[num_columns - 1] != NULL;
+    source->num_columns = source->has_radius ? num_columns : num_columns - 1;
+    source->num_rows = column_size/sizeof(float);
+    return 0;
+}
+
+int load_open(struct LoadSource* source, const char* path, int dimensions, struct TaskPool* pool) {
+    memset(source, 0, sizeof(*source));
+    source->dimensions = dimensions;
+    int status;
+    if (strstr(path, "%s") != NULL) {
+        source->format = LOAD_COLUMNS;
+        status = open_columns(source, path);
+    } else {
+        source->format = LOAD_CSV;
+        status = open_csv(source, path, pool);
+    }
+    if (status != 0) {
+        load_close(source);
+    }
+    return status;
+}
+
+void load_close(struct LoadSource* source) {
+    unmap_file(source->data, source->size);
+    free(source->chunks);
+    for (int k = 0; k < load_max_columns; k++) {
+        unmap_file(source->columns[k], source->column_sizes[k]);
+    }
+    memset(source, 0, sizeof(*source));
+}
+
+// Body from one row of values in the CSV's column order. Returns 0 if the
+// mass is not positive.
+template <int D>
+int make_body(const float* values, int has_radius, long row, particle<D>* p) {
+    float mass = values[2*D];
+    if (!(mass > 0.0f)) {
+        return 0;
+    }
+    vec<D> position, velocity;
+    for (int d = 0; d < D; d++) {
+        position[d] = values[d];
+        velocity[d] = values[D + d];
+    }
+    float radius = has_radius ? values[2*D + 1] : radius_for_mass(mass);
+    *p = {radius, mass, position, velocity, vec_zero<D>(), vec_zero<D>(), vec_zero<D>(), (uint64_t) row, -1};
+    return 1;
+}
+
+// Parses the rows of one chunk. Returns the index of the first bad row, or
+// -1 if all are good.
+template <int D>
+long parse_chunk(const struct LoadSource* source, const struct LoadChunk* chunk, particle<D>* points) {
+    const char* p = chunk->begin;
+    const char* end = chunk->end;
+    long row = chunk->first_row;
+    float values[load_max_columns];
+    for (;;) {
+        while (p < end && is_space(*p)) {
+            p++;
+        }
+        if (p == end) {
+            return -1;
+        }
+        int n = 0;
+        for (;;) {
+            p = parse_float(p, end, &values[n++]);
+            if (p == NULL) {
+                return row;
+            }
+            while (p < end && (*p == ' ' || *p == '\t')) {
+                p++;
+            }
+            if (p == end || *p != ',') {
+                break;
+            }
+            if (n == source->num_columns) {
+                return row;
+            }
+            p++;
+        }
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) {
+            p++;
+        }
+        if (n != source->num_columns || (p < end && *p != '\n')) {
+            return row;
+        }
+        if (!make_body(values, source->has_radius, row, &points[row])) {
+            return row;
+        }
+        row++;
+    }
+}
+
+template <int D>
+int load_fill(const struct LoadSource* source, particle<D>* points, struct TaskPool* pool) {
+    if (source->dimensions != D) {
+        return -1;
+    }
+    long bad_row = LONG_MAX;
+    if (source->format == LOAD_CSV) {
+        long* bad_rows = (long*) malloc((source->num_chunks + 1)*sizeof(long));
+        task_for(pool, 0, source->num_chunks, 1, [&](int begin, int end) {
+            for (int c = begin; c < end; c++) {
+                bad_rows[c] = parse_chunk(source, &source->chunks[c], points);
+            }
+        });
+        for (int c = 0; c < source->num_chunks; c++) {
+            if (bad_rows[c] >= 0 && bad_rows[c] < bad_row) {
+                bad_row = bad_rows[c];
+            }
+        }
+        free(bad_rows);
+    } else {
+        int num_blocks = (int) ((source->num_rows + load_row_grain - 1)/load_row_grain);
+        long* bad_rows = (long*) malloc((num_blocks + 1)*sizeof(long));
+        task_for(pool, 0, num_blocks, 1, [&](int begin, int end) {
+            for (int b = begin; b < end; b++) {
+                bad_rows[b] = -1;
+                long last = b*(long) load_row_grain + load_row_grain;
+                last = last < source->num_rows ? last : source->num_rows;
+                for (long row = b*(long) load_row_grain; row < last; row++) {
+                    float values[load_max_columns];
+                    for (int k = 0; k < source->num_columns; k++) {
+                        values[k] = source->columns[k][row];
+                    }
+                    if (!make_body(values, source->has_radius, row, &points[row])) {
+                        bad_rows[b] = row;
+                        break;
+                    }
+                }
+            }
+        });
+        for (int b = 0; b < num_blocks; b++) {
+            if (bad_rows[b] >= 0 && bad_rows[b] < bad_row) {
+                bad_row = bad_rows[b];
+            }
+        }
+        free(bad_rows);
+    }
+    if (bad_row != LONG_MAX) {
+        fprintf(stderr, "load: row %ld is malformed or has a mass that is not positive\n", bad_row + 1);
+        return -1;
+    }
+    return 0;
+}
+
+template int load_fill<2>(const struct LoadSource* source, particle<2>* points, struct TaskPool* pool);
+template int load_fill<3>(const struct LoadSource* source, particle<3>* points, struct TaskPool* pool);
@@ -0,0 +1,61 @@
+#ifndef LOADER_H
+#define LOADER_H
+
+#include <stddef.h>
+
+#include "particle.h"
+#include "taskpool.h"
+
+// Bulk loading of initial conditions made by external tools, from either
+//  - a CSV file with one body per row: the position, then the velocity,
+//    then the mass, and optionally the radius (x,y,vx,vy,mass[,radius] in
+//    2D). A first line that does not start with a number is a header.
+//  - raw float32 column files, one per field, named by substituting x, y, z,
+//    vx, vy, vz, mass and radius for the %s in a pattern such as
+//    "ics/%s.f32". The radius file may be missing.
+// Bodies without a radius get the merge rule's radius for their mass. Files
+// are memory-mapped; CSV is cut into chunks at line breaks, and the chunks'
+// rows are counted and then parsed in parallel, each straight into its place
+// in the particle array.
+
+enum load_formats {
+    LOAD_CSV = 1,
+    LOAD_COLUMNS = 2
+};
+
+const int load_max_columns = 8;
+const size_t load_chunk_size = 1 << 20;
+
+struct LoadChunk {
+    const char* begin;
+    const char* end;
+    // Rows before this chunk.
+    long first_row;
+};
+
+struct LoadSource {
+    int format;
+    int dimensions;
+    long num_rows;
+    int has_radius;
+    // LOAD_CSV: the mapped file and its chunks.
+    const char* data;
+    size_t size;
+    struct LoadChunk* chunks;
+    int num_chunks;
+    int num_columns;
+    // LOAD_COLUMNS: one mapped file per field, in the CSV's column order.
+    const float* columns[load_max_columns];
+    size_t column_sizes[load_max_columns];
+};
+
+// Maps path, a CSV file or a column pattern containing %s, and counts its
+// rows. Returns 0, or -1 with a message on stderr.
+int load_open(struct LoadSource* source, const char* path, int dimensions, struct TaskPool* pool);
+void load_close(struct LoadSource* source);
+// Fills points[0, num_rows), with ids 0..num_rows-1. Returns 0, or -1 with a
+// message on stderr if a row is malformed or has a mass that is not positive.
+template <int D>
+int load_fill(const struct LoadSource* source, particle<D>* points, struct TaskPool* pool);
+
+#endif
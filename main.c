@@ -1,313 +1,1413 @@
 #include <math.h>
+#include <float.h>
+#include <limits.h>
 #include <time.h>
 #include <stdlib.h>
+#include <omp.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
 #include "render.h"
+#include "pipeline.h"
+#include "gsim.h"
+#include "publish.h"
+#include "simulation.h"
+#include "morton.h"
+#include "ensemble.h"
+#include "sweep.h"
 
-const float gravitational_constant = 0.000001f;
-const float damping_factor = 0.5f;
-const int disable_merging = 0;
 int print_flag = 0;
-const int rad_mass_factor = 20;
-enum collision_modes {
-    NO_BORDER = 1,
-    SQUARE = 2,
-    CIRCLE = 3,
-    TELEPORT_CENTER = 4,
-    TELEPORT_RANDOM = 5
+float zoom_factor = 1.0f;
+
+// Steps between binary snapshots of the particle array and between energy
+// reports on stdout, both written off the step thread (0 disables either).
+int snapshot_interval = 0;
+const char* snapshot_pattern = "snapshot_%06ld.bin";
+int diagnostics_interval = 0;
+
+// 3D states are projected onto the view plane by a perspective camera before
+// rendering.
+const float camera_distance = 4.0f;
+
+// Position of body k in an array of records laid out as gsim_layout says.
+const float* body_position(const char* bodies, const gsim_layout& layout, int k) {
+    return (const float*) (bodies + k*layout.record_size + layout.position_offset);
+}
+
+// Perspective scale for a camera on the +z axis looking at the origin; points
+// behind the camera collapse to nothing. Planar states are drawn as-is.
+float projection_scale(const float* position, int dims) {
+    if (dims < 3) {
+        return 1.0f;
+    }
+    float depth = camera_distance - position[2];
+    return depth > 0.0f ? camera_distance/depth : 0.0f;
+}
+
+void project(const char* bodies, const gsim_layout& layout, int k, float zoom, float* x, float* y, float* radius) {
+    const float* position = body_position(bodies, layout, k);
+    float scale = projection_scale(position, layout.dimensions)*zoom;
+    *x = position[0]*scale;
+    *y = position[1]*scale;
+    *radius = *(const float*) (bodies + k*layout.record_size + layout.radius_offset)*scale;
+}
+
+// View changes from the window, applied by the step thread before its next
+// step so the live bodies are only ever touched by that thread.
+struct ViewInput {
+    float pan[3];
+    float zoom;
+    pthread_mutex_t lock;
+};
+
+void inputs(GLFWwindow *window, const char* bodies, const gsim_layout& layout, int num_points, ViewInput* view) {
+    float pan_factor = 0.01;
+    if(glfwGetKey(window, GLFW_KEY_SPACE) == GLFW_PRESS && !print_flag) {
+        // Debug key
+        for (int i = 0; i + 1 < num_points; i++) {
+            const float* p1 = body_position(bodies, layout, 0);
+            const float* p2 = body_position(bodies, layout, 1);
+            printf("Angle between p1 and p2: %f\n", atan2f(p2[1] - p1[1], p2[0] - p1[0]));
+            printf("Angle between p2 and p1: %f", atan2f(p1[1] - p2[1], p1[0] - p2[0]));
+            printf("\n");
+            print_flag = 1;
+        }
+        printf("------------------------------------------\n");
+    } else if (glfwGetKey(window, GLFW_KEY_SPACE) == GLFW_RELEASE) {
+        print_flag = 0;
+    }
+    pthread_mutex_lock(&view->lock);
+    if(glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS) {
+        view->pan[1] -= pan_factor;
+    }
+    if(glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS) {
+        view->pan[1] += pan_factor;
+    }
+    if(glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS) {
+        view->pan[0] -= pan_factor;
+    }
+    if(glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS) {
+        view->pan[0] += pan_factor;
+    }
+    if(glfwGetKey(window, GLFW_KEY_UP) == GLFW_PRESS) {
+        view->zoom *= 1.01;
+    }
+    if(glfwGetKey(window, GLFW_KEY_DOWN) == GLFW_PRESS) {
+        view->zoom *= 1.0/1.01;
+    }
+    pthread_mutex_unlock(&view->lock);
+}
+
+// The viewer's frame as a dependency graph. A step (forces, collisions,
+// integration) captures its state into a frame slot; the render copy, the
+// snapshot writer and the diagnostics each read that copy, and drawing
+// waits for the render copy. The step and every consumer run on threads of
+// their own, so step n+1 is computed while frame n is prepared, written and
+// drawn, and the frame time approaches the slowest stage rather than the sum.
+// The simulation itself is reached only through libgsim.
+enum frame_stages {
+    STAGE_STEP = 1,
+    STAGE_RENDER_COPY = 2,
+    STAGE_SNAPSHOT = 4,
+    STAGE_DIAGNOSTICS = 8,
+    STAGE_DRAW = 16
 };
-const int collision_mode = NO_BORDER;
+const int num_frame_stages = 5;
 
-enum pointgen_modes {
-    RANDOM_STILL = 1,
-    RANDOM_VELOCITIES = 2,
-    OUTWARDS_VELOCITIES = 3,
-    ASTEROID_BELT = 4,
+// One step's state as captured for the stages downstream of it: the body
+// records exactly as libgsim holds them.
+struct Frame {
+    char* bodies;
+    int num_points;
+    int capacity;
+    long step;
+    float zoom;
+    float* center_x;
+    float* center_y;
+    float* radii;
 };
-const int pointgen_mode = ASTEROID_BELT;
-float zoom_factor = 1.0f;
 
-struct vec2 {
-    float x;
-    float y;
+struct FrameGraph {
+    struct Pipeline pipeline;
+    Frame frames[pipeline_depth];
+    // Live simulation, only touched by the step stage.
+    gsim* sim;
+    gsim_layout layout;
+    int num_h_circles;
+    // Frames to run; -1 runs until the draw stage stops the pipeline.
+    long num_frames;
+    ViewInput view;
+    // Draws a frame and returns 0 to stop the pipeline.
+    int (*draw)(struct FrameGraph* graph, Frame* frame, void* context);
+    void* context;
+    // Seconds spent in each stage, indexed by the stage's bit.
+    double stage_time[num_frame_stages];
 };
 
-float magnitude(struct vec2 v) {
-    return sqrt(v.x*v.x + v.y*v.y);
+void step_stage(FrameGraph* graph, Frame* frame) {
+    const gsim_layout& layout = graph->layout;
+    pthread_mutex_lock(&graph->view.lock);
+    float pan[3] = {graph->view.pan[0], graph->view.pan[1], graph->view.pan[2]};
+    zoom_factor *= graph->view.zoom;
+    memset(graph->view.pan, 0, sizeof(graph->view.pan));
+    graph->view.zoom = 1.0f;
+    pthread_mutex_unlock(&graph->view.lock);
+    if (pan[0] != 0.0f || pan[1] != 0.0f || pan[2] != 0.0f) {
+        char* positions = (char*) gsim_positions(graph->sim);
+        for (int i = 0; i < gsim_count(graph->sim); i++) {
+            float* position = (float*) (positions + i*layout.record_size);
+            for (int d = 0; d < layout.dimensions; d++) {
+                position[d] += pan[d];
+            }
+        }
+    }
+    gsim_step(graph->sim);
+
+    int n = gsim_count(graph->sim);
+    if (frame->capacity < n + graph->num_h_circles) {
+        frame->capacity = n + graph->num_h_circles;
+        frame->bodies = (char*) realloc(frame->bodies, frame->capacity*layout.record_size);
+        frame->center_x = (float*) realloc(frame->center_x, frame->capacity*sizeof(float));
+        frame->center_y = (float*) realloc(frame->center_y, frame->capacity*sizeof(float));
+        frame->radii = (float*) realloc(frame->radii, frame->capacity*sizeof(float));
+    }
+    memcpy(frame->bodies, gsim_bodies(graph->sim), n*layout.record_size);
+    frame->num_points = n;
+    frame->step = gsim_step_count(graph->sim);
+    frame->zoom = zoom_factor;
+}
+
+// A plain loop: pipelined, this runs alongside the next step, and a loop on
+// the shared pool would make the step's own loops find it busy and run on
+// one thread.
+void render_copy_stage(FrameGraph* graph, Frame* frame) {
+    int n = frame->num_points;
+    for (int i = 0; i < n; i++) {
+        project(frame->bodies, graph->layout, i, frame->zoom, &frame->center_x[i], &frame->center_y[i], &frame->radii[i]);
+    }
+    for (int i = 0; i < graph->num_h_circles; i++) {
+        project(frame->bodies, graph->layout, i, frame->zoom, &frame->center_x[n+i], &frame->center_y[n+i], &frame->radii[n+i]);
+    }
 }
 
-struct Particle {
-    float radius;
-    float mass;
-    struct vec2 position;
-    struct vec2 velocity;
-    struct vec2 acceleration;
-    struct vec2 force;
+void snapshot_stage(FrameGraph* graph, Frame* frame) {
+    if (snapshot_interval <= 0 || frame->step % snapshot_interval != 0) {
+        return;
+    }
+    char path[256];
+    snprintf(path, sizeof(path), snapshot_pattern, frame->step);
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "Could not write snapshot %s\n", path);
+        return;
+    }
+    int32_t header[2] = {graph->layout.dimensions, frame->num_points};
+    fwrite(header, sizeof(header), 1, file);
+    fwrite(&frame->step, sizeof(frame->step), 1, file);
+    fwrite(frame->bodies, graph->layout.record_size, frame->num_points, file);
+    fclose(file);
+}
+
+void diagnostics_stage(FrameGraph* graph, Frame* frame) {
+    if (diagnostics_interval <= 0 || frame->step % diagnostics_interval != 0) {
+        return;
+    }
+    const gsim_layout& layout = graph->layout;
+    double momentum[3] = {0.0, 0.0, 0.0};
+    for (int i = 0; i < frame->num_points; i++) {
+        const char* body = frame->bodies + i*layout.record_size;
+        const float* velocity = (const float*) (body + layout.velocity_offset);
+        float mass = *(const float*) (body + layout.mass_offset);
+        for (int d = 0; d < layout.dimensions; d++) {
+            momentum[d] += velocity[d]*mass;
+        }
+    }
+    printf("step %6ld: %d bodies, energy %.6e, momentum %.3e\n", frame->step, frame->num_points,
+        gsim_bodies_energy(frame->bodies, frame->num_points),
+        sqrt(momentum[0]*momentum[0] + momentum[1]*momentum[1] + momentum[2]*momentum[2]));
+}
+
+struct FrameStage {
+    unsigned int stage;
+    unsigned int needs;
+    void (*run)(FrameGraph* graph, Frame* frame);
 };
 
-struct hcircle {
-    float radius;
-    struct vec2 position;
+// Stages after the step, in the order a sequential frame runs them.
+const FrameStage frame_consumers[] = {
+    {STAGE_RENDER_COPY, STAGE_STEP, render_copy_stage},
+    {STAGE_SNAPSHOT, STAGE_STEP, snapshot_stage},
+    {STAGE_DIAGNOSTICS, STAGE_STEP, diagnostics_stage},
 };
+const int num_frame_consumers = sizeof(frame_consumers)/sizeof(frame_consumers[0]);
 
-void print_particle(struct Particle p) {
-    printf("Particle with radius %f, mass %f:\nPosition: (%f, %f)\nVelocity: (%f, %f)\nAcceleration: (%f, %f)\nForce: (%f, %f)\n", p.radius, p.mass, p.position.x, p.position.y, p.velocity.x, p.velocity.y, p.acceleration.x, p.acceleration.y, p.force.x, p.force.y);
+void run_stage(FrameGraph* graph, const FrameStage& stage, Frame* frame) {
+    double start = wall_time();
+    stage.run(graph, frame);
+    graph->stage_time[__builtin_ctz(stage.stage)] += wall_time() - start;
 }
 
-float dist(struct vec2 v1, struct vec2 v2) {
-    struct vec2 dist_vec2 = {v1.x - v2.x, v1.y - v2.y}; 
-    return magnitude(dist_vec2);
+struct StageThread {
+    FrameGraph* graph;
+    const FrameStage* stage;
+    pthread_t thread;
+};
+
+void* step_thread(void* arg) {
+    FrameGraph* graph = ((StageThread*) arg)->graph;
+    const FrameStage step = {STAGE_STEP, 0, step_stage};
+    for (long f = 0; f != graph->num_frames; f++) {
+        int slot = pipeline_acquire(&graph->pipeline, f);
+        if (slot < 0) {
+            break;
+        }
+        run_stage(graph, step, &graph->frames[slot]);
+        pipeline_complete(&graph->pipeline, f, STAGE_STEP);
+    }
+    return NULL;
 }
 
-struct Particle merge(struct Particle p1, struct Particle p2) {
-    struct vec2 empty_vec = {0.0f, 0.0f};
-    float mass = p1.mass + p2.mass;
-    float radius = sqrt(mass/pi)/rad_mass_factor;
-    struct vec2 position;
-    if (p1.mass > p2.mass) {
-        position.x = p1.position.x;
-        position.y = p1.position.y;
-    } else if (p1.mass < p2.mass) {
-        position.x = p2.position.x;
-        position.y = p2.position.y;
-    } else {
-        position.x = (p1.position.x + p2.position.x) / 2.0f;
-        position.y = (p1.position.y + p2.position.y) / 2.0f;
+void* consumer_thread(void* arg) {
+    StageThread* self = (StageThread*) arg;
+    FrameGraph* graph = self->graph;
+    for (long f = 0; f != graph->num_frames; f++) {
+        int slot = pipeline_wait(&graph->pipeline, f, self->stage->needs);
+        if (slot < 0) {
+            break;
+        }
+        run_stage(graph, *self->stage, &graph->frames[slot]);
+        pipeline_complete(&graph->pipeline, f, self->stage->stage);
     }
-    struct vec2 velocity;
-    velocity.x = (p1.mass*p1.velocity.x + p2.mass*p2.velocity.x)/(mass);
-    velocity.y = (p1.mass*p1.velocity.y + p2.mass*p2.velocity.y)/(mass);
-    struct Particle p = {radius, mass, position, velocity, empty_vec, empty_vec};
-    return p;
-}
-
-void check_collision(struct Particle* points, int* num_points, int p1_index, int p2_index) {
-    float distance = dist(points[p1_index].position, points[p2_index].position);
-    distance -= points[p1_index].radius + points[p2_index].radius;
-    if (distance <= 0.0f && !disable_merging) {
-        // print_particle(points[p1_index]);
-        // print_particle(points[p2_index]);
-        points[p1_index] = merge(points[p1_index], points[p2_index]);
-        // print_particle(points[p1_index]); 
-        for (int i = p2_index; i < *num_points-1; i++) {
-            points[i] = points[i+1];
-        }
-        *num_points = *num_points-1;
-        struct Particle* new_points = (struct Particle*) realloc(points, *num_points*sizeof(struct Particle));
-        points = new_points;
-    }
-}
-
-float get_angle(struct vec2 p1, struct vec2 p2) {
-    return atan2f(p2.y - p1.y, p2.x - p1.x);
-}
-
-void set_force(struct Particle* p1, struct Particle* p2) {
-    float distance = dist((*p1).position, (*p2).position);
-    float force = gravitational_constant*(*p1).mass*(*p2).mass/(distance*distance);
-    float angle = get_angle((*p1).position, (*p2).position);
-    
-    float force_x = force * cosf(angle);
-    float force_y = force * sinf(angle);
-    (*p1).force.x += force_x;
-    (*p1).force.y += force_y;
-}
-
-void square_boundary(struct Particle* p) {
-    int square_size = 1.0f;
-    if ((*p).position.x+(*p).radius > square_size) {
-        (*p).position.x = square_size-(*p).radius; 
-        (*p).velocity.x = -1.0f*square_size*damping_factor*(*p).velocity.x;
-    }if ((*p).position.y+(*p).radius > square_size) {
-        (*p).position.y = square_size-(*p).radius; 
-        (*p).velocity.y = -1.0f*square_size*damping_factor*(*p).velocity.y;
-    } if ((*p).position.x-(*p).radius < -1.0f*square_size) {
-        (*p).position.x = -1.0f*square_size+(*p).radius; 
-        (*p).velocity.x = -1.0f*square_size*damping_factor*(*p).velocity.x;
-    } if ((*p).position.y-(*p).radius < -1.0f*square_size) {
-        (*p).position.y = -1.0f*square_size+(*p).radius; 
-        (*p).velocity.y = -1.0f*square_size*damping_factor*(*p).velocity.y;
-    }
-}
-
-void circle_boundary(struct Particle* p) {
-    int max_rad = 1.0f;
-    struct vec2 empty = {0.0f, 0.0f};
-    float distance = dist(empty, (*p).position) + (*p).radius;
-    if (distance >= max_rad) {
-        float angle = -1.0f*get_angle(empty, (*p).position);
-        float diff = distance - max_rad;
-        (*p).position.x -= diff * cosf(angle);
-        (*p).velocity.x = -1.0f*(*p).velocity.x;
-        (*p).position.y += diff * sinf(angle);
-        (*p).velocity.y = -1.0f*(*p).velocity.y;
-
-    }
-}
-
-void center_teleport(struct Particle* p) {
-    int max_rad = 1.0f;
-    struct vec2 empty = {0.0f, 0.0f};
-    float distance = dist(empty, (*p).position) + (*p).radius;
-    if (distance >= max_rad) {
-        (*p).position.x = 0;
-        (*p).position.y = 0;
-    }
-}
-
-void random_teleport(struct Particle* p) {
-    int max_rad = 1.0f;
-    struct vec2 empty = {0.0f, 0.0f};
-    float distance = dist(empty, (*p).position) + (*p).radius;
-    if (distance >= max_rad) {
-        float angle = (float)(rand()%360)*(pi/180);
-        float dist = ((float) rand())/RAND_MAX;
-        (*p).position.x = dist * cosf(angle);
-        (*p).position.y = dist * sinf(angle);
-    }
-}
-
-void apply_constants(struct Particle* p) {
-    (*p).acceleration.x = (*p).force.x / (*p).mass;
-    (*p).acceleration.y = (*p).force.y / (*p).mass;
-
-    (*p).velocity.x += (*p).acceleration.x;
-    (*p).velocity.y += (*p).acceleration.y;
-    
-    (*p).position.x += (*p).velocity.x;
-    (*p).position.y += (*p).velocity.y;
-
-    if(collision_mode == SQUARE) {square_boundary(p);}
-    else if(collision_mode == CIRCLE) {circle_boundary(p);}
-    else if(collision_mode == TELEPORT_CENTER) {center_teleport(p);}
-    else if(collision_mode == TELEPORT_RANDOM) {random_teleport(p);}
-}
-
-void iterate(struct Particle* points, int* num_points) {
-    for (int i = 0; i < *num_points; i++) {
-        for (int k = 0; k < *num_points; k++) {
-            if (i != k) {
-                set_force(&points[i], &points[k]);
-                check_collision(points, num_points, i, k);
+    return NULL;
+}
+
+void frame_graph_init(FrameGraph* graph, gsim* sim, int num_h_circles) {
+    memset(graph, 0, sizeof(*graph));
+    pipeline_init(&graph->pipeline, STAGE_STEP | STAGE_RENDER_COPY | STAGE_SNAPSHOT | STAGE_DIAGNOSTICS | STAGE_DRAW);
+    graph->sim = sim;
+    gsim_get_layout(&graph->layout);
+    graph->num_h_circles = num_h_circles;
+    graph->num_frames = -1;
+    graph->view.zoom = 1.0f;
+    pthread_mutex_init(&graph->view.lock, NULL);
+}
+
+void frame_graph_free(FrameGraph* graph) {
+    for (int s = 0; s < pipeline_depth; s++) {
+        free(graph->frames[s].bodies);
+        free(graph->frames[s].center_x);
+        free(graph->frames[s].center_y);
+        free(graph->frames[s].radii);
+    }
+    pipeline_free(&graph->pipeline);
+    pthread_mutex_destroy(&graph->view.lock);
+}
+
+// Runs the graph with drawing on the calling thread, which must own the GL
+// context. Unpipelined, every stage of a frame runs in turn on this thread.
+void frame_graph_run(FrameGraph* graph, int pipelined) {
+    const FrameStage draw = {STAGE_DRAW, STAGE_RENDER_COPY, NULL};
+    if (!pipelined) {
+        const FrameStage step = {STAGE_STEP, 0, step_stage};
+        for (long f = 0; f != graph->num_frames; f++) {
+            Frame* frame = &graph->frames[0];
+            run_stage(graph, step, frame);
+            for (int c = 0; c < num_frame_consumers; c++) {
+                run_stage(graph, frame_consumers[c], frame);
+            }
+            double start = wall_time();
+            int running = graph->draw(graph, frame, graph->context);
+            graph->stage_time[__builtin_ctz(draw.stage)] += wall_time() - start;
+            if (!running) {
+                break;
             }
         }
+        return;
     }
-    for(int i = 0; i < *num_points; i++) {
-        apply_constants(&points[i]);
-        // print_particle(points[i]);
-        points[i].force.x = 0.0f;
-        points[i].force.y = 0.0f;
+    StageThread threads[1 + num_frame_consumers];
+    threads[0].graph = graph;
+    threads[0].stage = NULL;
+    pthread_create(&threads[0].thread, NULL, step_thread, &threads[0]);
+    for (int c = 0; c < num_frame_consumers; c++) {
+        threads[1 + c].graph = graph;
+        threads[1 + c].stage = &frame_consumers[c];
+        pthread_create(&threads[1 + c].thread, NULL, consumer_thread, &threads[1 + c]);
     }
+    for (long f = 0; f != graph->num_frames; f++) {
+        int slot = pipeline_wait(&graph->pipeline, f, draw.needs);
+        if (slot < 0) {
+            break;
+        }
+        double start = wall_time();
+        int running = graph->draw(graph, &graph->frames[slot], graph->context);
+        graph->stage_time[__builtin_ctz(draw.stage)] += wall_time() - start;
+        pipeline_complete(&graph->pipeline, f, draw.stage);
+        if (!running) {
+            pipeline_stop(&graph->pipeline);
+            break;
+        }
+    }
+    for (int t = 0; t < 1 + num_frame_consumers; t++) {
+        pthread_join(threads[t].thread, NULL);
+    }
+}
+
+struct Viewer {
+    GLFWwindow* window;
+    unsigned int VAO;
+    unsigned int program;
+};
+
+int draw_frame(FrameGraph* graph, Frame* frame, void* context) {
+    Viewer* viewer = (Viewer*) context;
+    inputs(viewer->window, frame->bodies, graph->layout, frame->num_points, &graph->view);
+    render(viewer->window, &viewer->VAO, viewer->program, frame->num_points, graph->num_h_circles, frame->center_x, frame->center_y, frame->radii);
+    return !glfwWindowShouldClose(viewer->window);
+}
+
+// Headless timing of iterate() on a fixed seed. Every case starts from the
+// same initial conditions so the rows are directly comparable.
+
+
+// The belt's central mass with light asteroids on circular orbits spread
+// along a spiral, so the motion is almost purely Keplerian.
+template <int D>
+void gen_kepler_test(int num_points, particle<D>* points) {
+    float asteroid_mass = 0.00001f;
+    points[0] = p_init(0.005f*num_points*10, vec_zero<D>(), 0.0f, 0.0f);
+    for (int i = 1; i < num_points; i++) {
+        float angle = 2.0f*pi*i/(num_points-1);
+        float radius = 1.7f + 1.2f*i/num_points;
+        vec<D> position = vec_zero<D>();
+        position[0] = radius*cosf(angle);
+        position[1] = radius*sinf(angle);
+        float vel = sqrtf(gravitational_constant*points[0].mass/radius);
+        points[i] = p_init(asteroid_mass, position, vel, angle + pi/2);
+    }
+    for (int i = 0; i < num_points; i++) {
+        points[i].id = i;
+    }
+}
+
+// The Kepler belt with every other asteroid kicked outward well past escape
+// speed, so half the bodies leave within a few dozen steps.
+template <int D>
+void gen_escape_test(int num_points, particle<D>* points) {
+    gen_kepler_test(num_points, points);
+    for (int i = 1; i < num_points; i += 2) {
+        points[i].velocity += points[i].position * (0.05f/magnitude(points[i].position));
+    }
+}
+
+// Pairs of bodies on separate lanes flying head-on at each other, closing
+// faster per step than their separation, so overlap checks never see them
+// touch.
+template <int D>
+void gen_crossing_test(int num_points, particle<D>* points) {
+    for (int i = 0; i < num_points; i++) {
+        vec<D> position = vec_zero<D>();
+        position[0] = i % 2 == 0 ? -0.1f : 0.1f;
+        position[1] = 0.05f*(i/2) - 1.0f;
+        points[i] = p_init(0.005f, position, 0.15f, i % 2 == 0 ? 0.0f : pi);
+        points[i].id = i;
+    }
+}
+
+// Slow bodies spread evenly over the unit square (or cube).
+template <int D>
+void gen_field_test(int num_points, particle<D>* points) {
+    for (int i = 0; i < num_points; i++) {
+        vec<D> position;
+        for (int d = 0; d < D; d++) {
+            position[d] = (float) rand()/RAND_MAX*2.0f - 1.0f;
+        }
+        points[i] = p_init(0.005f, position, 0.0005f*(rand()%10), (float) (rand()%360)*(pi/180));
+        points[i].id = i;
+    }
+}
+
+// The same squeezed into a thin vertical band: every body overlaps every
+// other on x, the worst case for sorting along that axis.
+template <int D>
+void gen_band_test(int num_points, particle<D>* points) {
+    gen_field_test(num_points, points);
+    for (int i = 0; i < num_points; i++) {
+        points[i].position[0] *= 0.02f;
+    }
+}
+
+// An equal-mass binary started at apocenter with eccentricity 0.9, whose
+// pericenter passages are far shorter than a step of the belt integrators.
+template <int D>
+void gen_binary_test(int num_points, particle<D>* points) {
+    float mass = 0.5f;
+    float semi_major = 0.5f, eccentricity = 0.9f;
+    float apocenter = semi_major*(1.0f + eccentricity);
+    float vel = sqrtf(gravitational_constant*2.0f*mass*(1.0f - eccentricity)/apocenter);
+    vec<D> position = vec_zero<D>();
+    position[0] = apocenter/2.0f;
+    points[0] = p_init(mass, position, vel/2.0f, pi/2);
+    points[1] = p_init(mass, position*-1.0f, vel/2.0f, -pi/2);
+    for (int i = 0; i < num_points; i++) {
+        points[i].id = i;
+    }
+}
+
+// rebuild_tree discards the tree before every step, for comparison with the
+// incremental update. A positive duration runs until that much simulated time
+// has passed instead of for a fixed number of steps.
+// Returns the final particle array, which the caller frees; its length is left
+// in *num_points.
+// Fresh simulation state from the given seed.
+Particle* bench_setup(int num_points, void (*generate)(int, Particle*), unsigned int seed = 1) {
+    srand(seed);
+    Particle* points = (Particle*) malloc(sizeof(Particle)*num_points);
+    generate(num_points, points);
+    simulation_reset(num_points);
+    return points;
+}
+
+void bench_teardown() {
+    simulation_release();
+}
+
+Particle* bench_run(const char* name, int* num_points_out, int steps, int rebuild_tree, void (*generate)(int, Particle*) = gen_points<dimensions>, double duration = 0.0) {
+    int num_points = *num_points_out;
+    Particle* points = bench_setup(num_points, generate);
+    double initial_energy = total_energy(points, num_points);
+    double start = wall_time();
+    if (duration > 0.0) {
+        steps = 0;
+    }
+    for (int s = 0; duration > 0.0 ? simulated_time < duration : s < steps; s++) {
+        if (rebuild_tree) {
+            quadtree_free(&tree);
+        }
+        iterate(points, &num_points, &tree);
+        if (duration > 0.0) {
+            steps++;
+        }
+    }
+    double elapsed = wall_time() - start;
+    double energy_error = fabs((total_energy(points, num_points) - initial_energy)/initial_energy);
+    printf("%-32s %8d particles %10.3f ms/step (tree %.3f, force %.3f, integrate %.3f) %10.3f ms total, %6ld evals, dE/E %.2e\n", name, num_points, 1000.0*elapsed/steps,
+        1000.0*step_timings.tree/steps, 1000.0*step_timings.force/steps, 1000.0*step_timings.integrate/steps, 1000.0*elapsed, force_evaluations, energy_error);
+    if (escapes.count > 0) {
+        double speed = 0.0;
+        for (int i = 0; i < escapes.count; i++) {
+            speed += magnitude(escapes.records[i].velocity);
+        }
+        printf("    %d escaped, first at step %ld, mean escape speed %.2e\n", escapes.count, escapes.records[0].step, speed/escapes.count);
+    }
+    bench_teardown();
+    *num_points_out = num_points;
+    return points;
 }
 
-struct Particle p_init(float mass, struct vec2 position, struct vec2 empty_vec, float vel, float angle) {
-    float radius = sqrt(mass/pi)/rad_mass_factor;
-    struct vec2 velocity = {vel*cosf(angle), vel*sinf(angle)};
-    struct Particle p = {radius, mass, position, velocity, empty_vec, empty_vec};
-    return p;
+void bench_case(const char* name, int num_points, int steps, int rebuild_tree, void (*generate)(int, Particle*) = gen_points<dimensions>, double duration = 0.0) {
+    free(bench_run(name, &num_points, steps, rebuild_tree, generate, duration));
 }
 
-void gen_points(int num_points, struct Particle* points) {
-    struct vec2 origin = {0.0f, 0.0f};
+// RMS distance between the bodies of two runs from the same initial state,
+// matched by id; bodies that only exist in one run are ignored.
+double position_deviation(const Particle* points, int num_points, const Particle* reference, int num_reference, int num_ids) {
+    int* slot_of = (int*) malloc(num_ids*sizeof(int));
+    for (int i = 0; i < num_ids; i++) {
+        slot_of[i] = -1;
+    }
+    for (int i = 0; i < num_reference; i++) {
+        slot_of[reference[i].id] = i;
+    }
+    double sum = 0.0;
+    int matched = 0;
     for (int i = 0; i < num_points; i++) {
-        float x_pos = (float) rand() / (float) (RAND_MAX/2) - 1.0f;
-        float y_pos = (float) rand() / (float) (RAND_MAX/2) - 1.0f;
-        struct vec2 position = {x_pos, y_pos};
-        // printf("(%f, %f)", x_pos, y_pos);
-        if (pointgen_mode == RANDOM_STILL) {
-            float initial_mass = 0.005f;
-            points[i] = p_init(initial_mass, position, origin, 0.0f, 0.0f);
-        } else if (pointgen_mode == RANDOM_VELOCITIES) {
-            float vel = 0.001 * (rand()%10);
-            float angle = (float)(rand()%360)*(pi/180);
-            float initial_mass = 0.005f;
-            points[i] = p_init(initial_mass, position, origin, vel, angle);
-        } else if (pointgen_mode == OUTWARDS_VELOCITIES) {
-            float vel = 0.001;
-            float initial_mass = 0.005f;
-            float angle = get_angle(origin, position);
-            points[i] = p_init(initial_mass, position, origin, vel, angle);
-        } else if (pointgen_mode == ASTEROID_BELT) {
-            float asteroid_mass = 0.005f;
-            if (i == 0) {
-                float center_point_mass = asteroid_mass * num_points*10;
-                float center_point_vel = 0.0f;
-                float center_point_angle = 0.0f;
-                points[i] = p_init(center_point_mass, origin, origin, center_point_vel, center_point_angle);
-            } else {
-                // get asteroid pos in belt
-                float min_asteroid_radius = 1.7f;
-                float max_asteroid_radius = 2.9f;
-                float asteroid_gen_angle = (float)(rand()%360)*(pi/180);
-                float asteroid_gen_pos = (rand()%1000)*(max_asteroid_radius-min_asteroid_radius)/1000+min_asteroid_radius;
-                float asteroid_x = asteroid_gen_pos * cosf(asteroid_gen_angle);
-                float asteroid_y = asteroid_gen_pos * sinf(asteroid_gen_angle);
-                struct vec2 asteroid_pos = {asteroid_x, asteroid_y};
-                // regular stuff
-                float dist_from_center = dist(asteroid_pos, points[0].position)-points[0].radius;
-                float asteroid_vel = sqrt(gravitational_constant*points[0].mass/dist_from_center)*1.1;
-                float asteroid_angle = get_angle(origin, asteroid_pos) + pi/2;
-                points[i] = p_init(asteroid_mass, asteroid_pos, origin, asteroid_vel, asteroid_angle);
-                print_particle(points[i]);
+        int r = slot_of[points[i].id];
+        if (r >= 0) {
+            sum += dist_sq(points[i].position, reference[r].position);
+            matched++;
+        }
+    }
+    free(slot_of);
+    return matched > 0 ? sqrt(sum/matched) : 0.0;
+}
+
+// Every respa_interval in intervals against the unsplit run, over the same
+// number of steps.
+void bench_respa(const char* backend, int num_points, int steps) {
+    char name[64];
+    int num_reference = num_points;
+    snprintf(name, sizeof(name), "%s, respa off", backend);
+    double start = wall_time();
+    Particle* reference = bench_run(name, &num_reference, steps, 0);
+    double reference_time = wall_time() - start;
+    int intervals[] = {4, 8};
+    for (int n = 0; n < 2; n++) {
+        respa_interval = intervals[n];
+        int num_split = num_points;
+        snprintf(name, sizeof(name), "%s, respa K=%d", backend, respa_interval);
+        start = wall_time();
+        Particle* split = bench_run(name, &num_split, steps, 0);
+        double split_time = wall_time() - start;
+        printf("    cutoff %.2f: speedup %.2fx, rms position deviation %.2e\n", respa_cutoff, reference_time/split_time,
+            position_deviation(split, num_split, reference, num_reference, num_points));
+        free(split);
+    }
+    respa_interval = 1;
+    free(reference);
+}
+
+// Test particles under both tree force modes. With one active body each
+// tree gives its exact field, so the runs should agree to rounding.
+void bench_passive_trees(int num_points, int steps) {
+    int saved_force_mode = force_mode;
+    force_mode = BARNES_HUT;
+    int num_reference = num_points;
+    Particle* reference = bench_run("tree, test particles", &num_reference, steps, 0);
+    force_mode = LINEAR_BVH;
+    int num_bvh = num_points;
+    Particle* bvh_points = bench_run("linear bvh, test particles", &num_bvh, steps, 0);
+    printf("    rms position deviation from the tree %.2e\n", position_deviation(bvh_points, num_bvh, reference, num_reference, num_points));
+    free(bvh_points);
+    free(reference);
+    force_mode = saved_force_mode;
+}
+
+// Broad phases alone, on bodies drifting in straight lines so successive
+// steps stay coherent. Reports the candidate pairs each one hands to the
+// narrow phase.
+void bench_broad_phase(const char* name, void (*generate)(int, Particle*), int num_points, int steps) {
+    srand(1);
+    Particle* points = (Particle*) malloc(sizeof(Particle)*num_points);
+    generate(num_points, points);
+    particle_index_init(&particle_index, num_points);
+    sweep_prune_init(&sweep);
+    verlet_list_init(&neighbor_lists, verlet_skin);
+    int max_pairs = 16*num_points;
+    uint64_t* pairs = (uint64_t*) malloc(2*max_pairs*sizeof(uint64_t));
+    double sweep_time = 0.0, grid_time = 0.0, verlet_time = 0.0;
+    long sweep_pairs = 0, grid_found = 0, swaps = 0, verlet_pairs = 0;
+    for (int s = 0; s < steps; s++) {
+        for (int i = 0; i < num_points; i++) {
+            points[i].position += points[i].velocity;
+        }
+        arena_reset(&step_arena);
+        double start = wall_time();
+        sweep_prune_update(&sweep, points, num_points, &particle_index, 1.0f);
+        sweep_pairs += sweep_prune_pairs(&sweep, pairs, max_pairs);
+        double swept = wall_time();
+        grid_found += grid_pairs(points, num_points, 1.0f, 0.0f, pairs, max_pairs, &step_arena);
+        double gridded = wall_time();
+        verlet_list_update(&neighbor_lists, points, num_points, &particle_index, 1.0f, &step_arena);
+        verlet_pairs += neighbor_lists.offsets[neighbor_lists.num_rows];
+        verlet_time += wall_time() - gridded;
+        grid_time += gridded - swept;
+        sweep_time += swept - start;
+        if (s > 0) {
+            swaps += sweep.swaps;
+        }
+    }
+    printf("%-32s %8d particles  sweep %8.3f ms/step (%ld pairs, %ld swaps/step)  grid %8.3f ms/step (%ld pairs)  verlet %8.3f ms/step (%ld pairs, %ld builds)\n", name, num_points,
+        1000.0*sweep_time/steps, sweep_pairs/steps, swaps/(steps > 1 ? steps - 1 : 1), 1000.0*grid_time/steps, grid_found/steps,
+        1000.0*verlet_time/steps, verlet_pairs/steps, neighbor_lists.builds);
+    free(pairs);
+    free(points);
+    sweep_prune_free(&sweep);
+    verlet_list_free(&neighbor_lists);
+    particle_index_free(&particle_index);
+}
+
+// Generation time of every initial-condition mode at full size, and the
+// virial ratio 2K/|W| of a small sample (1 for a system in equilibrium).
+void bench_initial_conditions(int num_points, int sample_points) {
+    const char* names[] = {"random still", "random velocities", "outwards velocities", "asteroid belt",
+        "plummer sphere", "exponential disk", "uniform disc", "multi belt"};
+    int saved_pointgen_mode = pointgen_mode;
+    Particle* points = alloc_points(num_points);
+    for (int mode = RANDOM_STILL; mode <= MULTI_BELT; mode++) {
+        pointgen_mode = mode;
+        srand(1);
+        double start = wall_time();
+        gen_points(num_points, points);
+        double elapsed = wall_time() - start;
+        gen_points(sample_points, points);
+        double kinetic = 0.0;
+        for (int i = 0; i < sample_points; i++) {
+            kinetic += 0.5*points[i].mass*dot(points[i].velocity, points[i].velocity);
+        }
+        double potential = total_energy(points, sample_points) - kinetic;
+        printf("%-32s %8d particles %10.3f ms, %d threads (virial ratio %.3f at %d)\n", names[mode - 1], num_points,
+            1000.0*elapsed, task_pool.num_workers, 2.0*kinetic/fabs(potential), sample_points);
+    }
+    free(points);
+    pointgen_mode = saved_pointgen_mode;
+}
+
+// Bulk loading of a generated field written out as CSV and as float32 column
+// files, against reading the same bytes with read(). The files were just
+// written, so both come from the page cache and the comparison is parser
+// against memory bandwidth.
+double bench_read_file(const char* path, size_t* bytes) {
+    double start = wall_time();
+    int fd = open(path, O_RDONLY);
+    char* buffer = (char*) malloc(1 << 20);
+    ssize_t n;
+    *bytes = 0;
+    while ((n = read(fd, buffer, 1 << 20)) > 0) {
+        *bytes += n;
+    }
+    close(fd);
+    free(buffer);
+    return wall_time() - start;
+}
+
+void bench_loader(int num_points) {
+    const char* csv_path = "/tmp/gsim_bench_load.csv";
+    const char* column_pattern = "/tmp/gsim_bench_load_%s.f32";
+    const char* column_names[] = {"x", "y", "vx", "vy", "mass"};
+    Particle* points = alloc_points(num_points);
+    int saved_pointgen_mode = pointgen_mode;
+    pointgen_mode = RANDOM_VELOCITIES;
+    srand(1);
+    gen_points(num_points, points);
+    pointgen_mode = saved_pointgen_mode;
+    FILE* file = fopen(csv_path, "w");
+    fprintf(file, "x,y,vx,vy,mass\n");
+    for (int i = 0; i < num_points; i++) {
+        fprintf(file, "%.9g,%.9g,%.9g,%.9g,%.9g\n", points[i].position[0], points[i].position[1],
+            points[i].velocity[0], points[i].velocity[1], points[i].mass);
+    }
+    fclose(file);
+    float* column = (float*) malloc(sizeof(float)*num_points);
+    for (int k = 0; k < 5; k++) {
+        for (int i = 0; i < num_points; i++) {
+            column[i] = k < 2 ? points[i].position[k] : k < 4 ? points[i].velocity[k - 2] : points[i].mass;
+        }
+        char path[256];
+        snprintf(path, sizeof(path), "/tmp/gsim_bench_load_%s.f32", column_names[k]);
+        file = fopen(path, "wb");
+        fwrite(column, sizeof(float), num_points, file);
+        fclose(file);
+    }
+    free(column);
+
+    const char* labels[] = {"load csv", "load columns"};
+    const char* paths[] = {csv_path, column_pattern};
+    for (int format = 0; format < 2; format++) {
+        size_t bytes = 0, column_bytes;
+        double read_time = 0.0;
+        if (format == 0) {
+            read_time = bench_read_file(csv_path, &bytes);
+        } else {
+            for (int k = 0; k < 5; k++) {
+                char path[256];
+                snprintf(path, sizeof(path), "/tmp/gsim_bench_load_%s.f32", column_names[k]);
+                read_time += bench_read_file(path, &column_bytes);
+                bytes += column_bytes;
             }
-            
         }
-        
+        gsim* sim = gsim_create();
+        double start = wall_time();
+        int status = gsim_load_file(sim, paths[format]);
+        double elapsed = wall_time() - start;
+        int mismatches = 0;
+        const Particle* loaded = (const Particle*) gsim_bodies(sim);
+        for (int i = 0; status == 0 && i < num_points; i++) {
+            mismatches += loaded[i].position[0] != points[i].position[0] || loaded[i].velocity[1] != points[i].velocity[1]
+                || loaded[i].radius != points[i].radius;
+        }
+        printf("%-32s %8d particles %10.3f ms (%.0f MB/s; read() %.0f MB/s), %d threads, %d mismatches\n", labels[format],
+            gsim_count(sim), 1000.0*elapsed, bytes/elapsed*1e-6, bytes/read_time*1e-6, task_pool.num_workers,
+            status == 0 ? mismatches : -1);
+        gsim_destroy(sim);
+    }
+    remove(csv_path);
+    for (int k = 0; k < 5; k++) {
+        char path[256];
+        snprintf(path, sizeof(path), "/tmp/gsim_bench_load_%s.f32", column_names[k]);
+        remove(path);
     }
+    free(points);
 }
 
-void inputs(GLFWwindow *window, struct Particle* points, int num_points) {
-    float pan_factor = 0.01;
-    if(glfwGetKey(window, GLFW_KEY_SPACE) == GLFW_PRESS && !print_flag) {
-        // Debug key
+// Build cost of both hierarchies over the same belt, and the RMS relative
+// error of their fields against direct summation on a sample of bodies.
+void bench_tree_build(int num_points, int builds) {
+    Particle* points = (Particle*) malloc(sizeof(Particle)*num_points);
+    srand(1);
+    gen_points(num_points, points);
+    particle_index_init(&particle_index, num_points);
+    quadtree_init(&tree);
+    lbvh_init(&bvh);
+    double quadtree_time = 0.0, bvh_time = 0.0;
+    for (int b = 0; b < builds; b++) {
+        arena_reset(&step_arena);
+        double start = wall_time();
+        quadtree_build(&tree, points, num_points, &particle_index);
+        double built = wall_time();
+        lbvh_build(&bvh, points, num_points, &step_arena);
+        bvh_time += wall_time() - built;
+        quadtree_time += built - start;
+    }
+    int samples = 256;
+    int measured = 0;
+    double quadtree_error = 0.0, bvh_error = 0.0;
+    for (int s = 0; s < samples; s++) {
+        int i = (int) ((long) s*num_points/samples);
+        vec<dimensions> exact = vec_zero<dimensions>();
+        for (int k = 0; k < num_points; k++) {
+            if (k != i) {
+                vec<dimensions> delta = points[k].position - points[i].position;
+                float distance_sq = dot(delta, delta);
+                exact += delta * (points[k].mass/(distance_sq*sqrtf(distance_sq)));
+            }
+        }
+        // Bodies sharing a position with another have no finite field.
+        float norm_sq = dot(exact, exact);
+        if (!isfinite(norm_sq)) {
+            continue;
+        }
+        vec<dimensions> error = quadtree_field(&tree, points, &particle_index, i, opening_angle) - exact;
+        quadtree_error += dot(error, error)/norm_sq;
+        error = lbvh_field(&bvh, points, i, opening_angle) - exact;
+        bvh_error += dot(error, error)/norm_sq;
+        measured++;
+    }
+    printf("%-32s %8d particles  quadtree %8.3f ms/build (field error %.2e)  linear bvh %8.3f ms/build (field error %.2e), %d threads\n", "tree build", num_points,
+        1000.0*quadtree_time/builds, sqrt(quadtree_error/measured), 1000.0*bvh_time/builds, sqrt(bvh_error/measured), omp_get_max_threads());
+    quadtree_free(&tree);
+    lbvh_free(&bvh);
+    particle_index_free(&particle_index);
+    free(points);
+}
+
+// What the tuner picks for the belt, with its heavy center, and for an even
+// field, each at a small and a larger size; the steps after tuning show how
+// the pick holds up.
+void bench_autotune(int num_points, int pointgen, int steps) {
+    int saved_pointgen_mode = pointgen_mode;
+    int saved_force_mode = force_mode;
+    float saved_opening_angle = opening_angle;
+    int saved_broad_phase = broad_phase;
+    pointgen_mode = pointgen;
+    autotune = 1;
+    printf("%s, %d particles\n", pointgen == ASTEROID_BELT ? "belt" : "random field", num_points);
+    int n = num_points;
+    Particle* points = bench_setup(num_points, gen_points<dimensions>);
+    double start = wall_time();
+    iterate(points, &n, &tree);
+    double tuned = wall_time();
+    for (int s = 1; s < steps; s++) {
+        iterate(points, &n, &tree);
+    }
+    printf("%-32s %8d particles %10.3f ms tuning, then %10.3f ms/step\n", "autotuned", n, 1000.0*(tuned - start),
+        1000.0*(wall_time() - tuned)/(steps - 1));
+    bench_teardown();
+    free(points);
+    autotune = 0;
+    pointgen_mode = saved_pointgen_mode;
+    force_mode = saved_force_mode;
+    opening_angle = saved_opening_angle;
+    broad_phase = saved_broad_phase;
+}
+
+// Busy time of each pool worker over Barnes-Hut steps of the belt, whose
+// dense center makes per-body force costs very uneven.
+void bench_task_pool(int num_points, int steps) {
+    int saved_force_mode = force_mode;
+    int saved_broad_phase = broad_phase;
+    force_mode = BARNES_HUT;
+    broad_phase = UNIFORM_GRID;
+    task_pool_reset_stats(&task_pool);
+    bench_case("tree, task pool", num_points, steps, 0);
+    task_pool_print_stats(&task_pool, "task pool", steps);
+    broad_phase = saved_broad_phase;
+    force_mode = saved_force_mode;
+}
+
+// Many small belts differing in seed and gravitational constant, first each
+// through iterate() on its own, as separate runs of the viewer would step
+// them, then all together in the ensemble. Both use direct sums and merges.
+void bench_ensemble(int num_systems, int num_points, int steps) {
+    int saved_force_mode = force_mode;
+    force_mode = DIRECT_SUM;
+    int separate_systems = 16;
+    double start = wall_time();
+    for (int s = 0; s < separate_systems; s++) {
+        Particle* points = bench_setup(num_points, gen_points<dimensions>);
+        int n = num_points;
+        for (int step = 0; step < steps; step++) {
+            iterate(points, &n, &tree);
+        }
+        bench_teardown();
+        free(points);
+    }
+    double separate = (wall_time() - start)/((double) separate_systems*steps);
+    force_mode = saved_force_mode;
+
+    ensemble<dimensions> systems;
+    ensemble_init(&systems, num_systems, num_points, 0.0f);
+    Particle* points = (Particle*) malloc(sizeof(Particle)*num_points);
+    double initial_mass = 0.0;
+    for (int s = 0; s < num_systems; s++) {
+        srand(1 + s);
+        gen_points(num_points, points);
         for (int i = 0; i < num_points; i++) {
-            // print_particle(points[i]);
-            printf("Angle between p1 and p2: %f\n", get_angle(points[0].position, points[1].position));
-            printf("Angle between p2 and p1: %f", get_angle(points[1].position, points[0].position));
-            printf("\n");
-            print_flag = 1;
+            initial_mass += points[i].mass;
         }
-        printf("------------------------------------------\n");
-    } else if (glfwGetKey(window, GLFW_KEY_SPACE) == GLFW_RELEASE) {
-        print_flag = 0;
+        ensemble_load(&systems, s, points, num_points, gravitational_constant*(1.0f + 0.05f*(s % 8)), damping_factor);
     }
-    if(glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS) {
-        for(int i = 0; i < num_points; i++) {
-            points[i].position.y -= pan_factor;
+    start = wall_time();
+    ensemble_step(&systems, steps);
+    double together = (wall_time() - start)/((double) num_systems*steps);
+    double final_mass = 0.0;
+    int survivors = 0;
+    for (int s = 0; s < num_systems; s++) {
+        int n = ensemble_store(&systems, s, points);
+        for (int i = 0; i < n; i++) {
+            final_mass += points[i].mass;
         }
+        survivors += n;
     }
-    if(glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS) {
-        for(int i = 0; i < num_points; i++) {
-            points[i].position.y += pan_factor;
+    printf("%-32s %8d particles %10.0f system-steps/s separately, %10.0f in the ensemble (%.1fx), %d systems, %ld merges, %d left, dM/M %.2e\n", "ensemble", num_points,
+        1.0/separate, 1.0/together, separate/together, num_systems, systems.merges, survivors, fabs(final_mass - initial_mass)/initial_mass);
+    free(points);
+    ensemble_free(&systems);
+}
+
+// Headless stand-in for drawing: the swap blocks for a fixed time without
+// using the CPU.
+int sleep_draw(FrameGraph* graph, Frame* frame, void* context) {
+    double ms = *(double*) context;
+    struct timespec ts = {0, (long) (ms*1e6)};
+    nanosleep(&ts, NULL);
+    return 1;
+}
+
+// Frame time with the stages run back to back and as a pipeline; the latter
+// should approach the slowest stage rather than their sum.
+void bench_frame_graph(int num_points, int frames, double draw_ms) {
+    int saved_diagnostics = diagnostics_interval;
+    diagnostics_interval = frames/2;
+    const char* names[] = {"step", "render copy", "snapshot", "diagnostics", "draw"};
+    double step_ms[2];
+    for (int pipelined = 0; pipelined < 2; pipelined++) {
+        gsim* sim = gsim_create();
+        gsim_set_force_mode(sim, GSIM_BARNES_HUT);
+        gsim_generate(sim, num_points, 1);
+        FrameGraph graph;
+        frame_graph_init(&graph, sim, 0);
+        graph.num_frames = frames;
+        graph.draw = sleep_draw;
+        graph.context = &draw_ms;
+        task_pool_reset_stats(&task_pool);
+        double start = wall_time();
+        frame_graph_run(&graph, pipelined);
+        double elapsed = wall_time() - start;
+        step_ms[pipelined] = 1000.0*graph.stage_time[0]/frames;
+        printf("%-32s %8d particles %10.3f ms/frame (", pipelined ? "frame graph, pipelined" : "frame graph, sequential", num_points, 1000.0*elapsed/frames);
+        for (int s = 0; s < num_frame_stages; s++) {
+            printf("%s%s %.3f", s > 0 ? ", " : "", names[s], 1000.0*graph.stage_time[s]/frames);
         }
+        printf(")\n");
+        printf("    %ld of %ld pool loops ran inline behind another stage's\n", task_pool.contended, task_pool.loops + task_pool.contended);
+        frame_graph_free(&graph);
+        gsim_destroy(sim);
     }
-    if(glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS) {
-        for(int i = 0; i < num_points; i++) {
-            points[i].position.x -= pan_factor;
+    // The other stages must not take the step's workers: its time per frame
+    // should be the same with the pipeline on.
+    printf("    step throughput pipelined/sequential %.2f\n", step_ms[0]/step_ms[1]);
+    diagnostics_interval = saved_diagnostics;
+}
+
+// One fused integrate-and-boundary pass over a large array, from the same
+// state every time so each mode sees the same share of boundary hits.
+template <int Mode>
+void bench_boundary(const char* name, Particle* points, const Particle* initial, int num_points, int passes) {
+    double elapsed = 0.0;
+    for (int pass = 0; pass < passes; pass++) {
+        memcpy(points, initial, num_points*sizeof(Particle));
+        double start = wall_time();
+        integrate_pass<Mode>(points, num_points, hash32(pass));
+        elapsed += wall_time() - start;
+    }
+    double bytes = 2.0*num_points*sizeof(Particle)*passes;
+    printf("%-32s %8d particles %10.3f ms/pass, %6.2f GB/s\n", name, num_points, 1000.0*elapsed/passes, bytes/elapsed*1e-9);
+}
+
+// NO_BORDER is the bare streaming cost the boundary modes should approach.
+void bench_boundaries() {
+    int num_points = 1 << 20;
+    Particle* initial = (Particle*) malloc(sizeof(Particle)*num_points);
+    Particle* points = (Particle*) malloc(sizeof(Particle)*num_points);
+    srand(1);
+    for (int i = 0; i < num_points; i++) {
+        vec<dimensions> position, velocity;
+        for (int d = 0; d < dimensions; d++) {
+            position[d] = ((float) rand()/RAND_MAX*2.0f - 1.0f)*1.2f;
+            velocity[d] = ((float) rand()/RAND_MAX*2.0f - 1.0f)*0.01f;
         }
+        initial[i] = p_init(0.005f, position, 0.0f, 0.0f);
+        initial[i].velocity = velocity;
+        initial[i].id = i;
     }
-    if(glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS) {
-        for(int i = 0; i < num_points; i++) {
-            points[i].position.x += pan_factor;
+    int passes = 20;
+    bench_boundary<NO_BORDER>("integrate, no border", points, initial, num_points, passes);
+    bench_boundary<SQUARE>("integrate, square", points, initial, num_points, passes);
+    bench_boundary<CIRCLE>("integrate, circle", points, initial, num_points, passes);
+    bench_boundary<TELEPORT_CENTER>("integrate, teleport center", points, initial, num_points, passes);
+    bench_boundary<TELEPORT_RANDOM>("integrate, teleport random", points, initial, num_points, passes);
+    free(points);
+    free(initial);
+}
+
+void run_benchmarks() {
+    int num_points = 2000;
+    int steps = 10;
+    int saved_interval = reorder_interval;
+
+    int saved_force_mode = force_mode;
+
+    // Direct sums are never re-sorted.
+    force_mode = DIRECT_SUM;
+    bench_case("direct", num_points, steps, 0);
+
+    force_mode = BARNES_HUT;
+    reorder_interval = 0;
+    bench_case("tree, generation order", num_points, steps, 0);
+    reorder_interval = saved_interval;
+    bench_case("tree, morton order", num_points, steps, 0);
+    bench_case("tree, rebuilt every step", num_points, steps, 1);
+    force_mode = LINEAR_BVH;
+    bench_case("linear bvh", num_points, steps, 0);
+
+    // Asteroids (0.005) go passive; only the central body sources gravity.
+    force_mode = DIRECT_SUM;
+    reorder_interval = saved_interval;
+    passive_mass_threshold = 0.01f;
+    bench_case("direct, test particles", num_points, steps, 0);
+    bench_passive_trees(num_points, steps);
+    passive_mass_threshold = 0.0f;
+
+    // Every pair should merge once, leaving half the bodies.
+    swept_collisions = 0;
+    bench_case("crossing pairs, overlap only", 80, 3, 0, gen_crossing_test<dimensions>);
+    swept_collisions = 1;
+    bench_case("crossing pairs, swept", 80, 3, 0, gen_crossing_test<dimensions>);
+
+    // Same escaping belt with and without retirement; the retired run's step
+    // cost should fall to that of the bound half.
+    force_mode = DIRECT_SUM;
+    float saved_escape_radius = escape_radius;
+    escape_radius = 0.0f;
+    bench_case("escapers kept", 600, 60, 0, gen_escape_test<dimensions>);
+    escape_radius = 4.0f;
+    bench_case("escapers retired", 600, 60, 0, gen_escape_test<dimensions>);
+    escape_radius = saved_escape_radius;
+
+    force_mode = DIRECT_SUM;
+    bench_respa("direct", num_points, 16);
+    force_mode = BARNES_HUT;
+    bench_respa("tree", num_points, 16);
+
+    // Two orbits of a well-separated belt: same simulated time, so the total
+    // times and energy errors compare the integrators directly.
+    int saved_integrator = integrator;
+    int simulated_time = 5000;
+    force_mode = DIRECT_SUM;
+    integrator = EULER;
+    bench_case("euler, kepler belt", 64, simulated_time, 0, gen_kepler_test<dimensions>);
+    integrator = WISDOM_HOLMAN;
+    bench_case("wisdom-holman, kepler belt", 64, (int) (simulated_time/wh_time_step), 0, gen_kepler_test<dimensions>);
+    integrator = HERMITE;
+    bench_case("hermite, kepler belt", 64, 0, 0, gen_kepler_test<dimensions>, simulated_time);
+
+    // Two orbits of the eccentric binary, whose close pericenter passages
+    // are what the adaptive Hermite step is for.
+    double binary_time = 4442.0;
+    integrator = EULER;
+    bench_case("euler, eccentric binary", 2, (int) binary_time, 0, gen_binary_test<dimensions>);
+    integrator = HERMITE;
+    bench_case("hermite, eccentric binary", 2, 0, 0, gen_binary_test<dimensions>, binary_time);
+    integrator = saved_integrator;
+
+    force_mode = saved_force_mode;
+
+    bench_boundaries();
+
+    bench_autotune(1000, ASTEROID_BELT, 10);
+    bench_autotune(1000, RANDOM_STILL, 10);
+    bench_autotune(5000, ASTEROID_BELT, 5);
+    bench_autotune(20000, RANDOM_STILL, 3);
+
+    bench_tree_build(1 << 20, 5);
+    bench_initial_conditions(10000000, 2000);
+    bench_loader(10000000);
+    bench_task_pool(20000, 10);
+    bench_frame_graph(num_points, 40, 5.0);
+    bench_ensemble(1024, 100, 50);
+
+    bench_broad_phase("broad phase, belt", gen_points<dimensions>, 20000, 20);
+    bench_broad_phase("broad phase, slow field", gen_field_test<dimensions>, 20000, 20);
+    bench_broad_phase("broad phase, vertical band", gen_band_test<dimensions>, 20000, 20);
+    int saved_broad_phase = broad_phase;
+    force_mode = BARNES_HUT;
+    broad_phase = TREE_OR_ALL_PAIRS;
+    bench_case("tree, tree query collisions", num_points, steps, 0);
+    broad_phase = SWEEP_AND_PRUNE;
+    bench_case("tree, sweep-and-prune collisions", num_points, steps, 0);
+    broad_phase = UNIFORM_GRID;
+    bench_case("tree, grid collisions", num_points, steps, 0);
+    broad_phase = VERLET_LIST;
+    bench_case("tree, verlet list collisions", num_points, steps, 0);
+    broad_phase = saved_broad_phase;
+    force_mode = saved_force_mode;
+}
+
+// Sweep points set globals by name; seed, points and steps shape the run
+// itself. Unknown names and out-of-range values are rejected before anything
+// is forked.
+struct SweepJob {
+    struct Sweep sweep;
+    int num_points;
+    int steps;
+};
+
+// A whole number in [lo, hi], as the enum-valued settings take.
+static int sweep_choice(double value, double lo, double hi) {
+    return value >= lo && value <= hi && value == floor(value);
+}
+
+// Returns 0, or -1 and sets nothing if the name is unknown or the value is
+// out of the range the gsim_set_* setters accept.
+int sweep_setting(const char* name, double value, unsigned int* seed, int* num_points, int* steps) {
+    if (strcmp(name, "damping_factor") == 0) {
+        if (!(value >= 0.0 && value <= 1.0)) {
+            return -1;
+        }
+        damping_factor = (float) value;
+    } else if (strcmp(name, "rad_mass_factor") == 0) {
+        if (!sweep_choice(value, 1, INT_MAX)) {
+            return -1;
+        }
+        rad_mass_factor = (int) value;
+    } else if (strcmp(name, "collision_mode") == 0) {
+        if (!sweep_choice(value, NO_BORDER, TELEPORT_RANDOM)) {
+            return -1;
+        }
+        collision_mode = (int) value;
+    } else if (strcmp(name, "pointgen_mode") == 0) {
+        if (!sweep_choice(value, RANDOM_STILL, MULTI_BELT)) {
+            return -1;
+        }
+        pointgen_mode = (int) value;
+    } else if (strcmp(name, "force_mode") == 0) {
+        if (!sweep_choice(value, DIRECT_SUM, LINEAR_BVH)) {
+            return -1;
+        }
+        force_mode = (int) value;
+    } else if (strcmp(name, "integrator") == 0) {
+        if (!sweep_choice(value, EULER, HERMITE)) {
+            return -1;
+        }
+        integrator = (int) value;
+    } else if (strcmp(name, "seed") == 0) {
+        if (!sweep_choice(value, 0, UINT_MAX)) {
+            return -1;
+        }
+        *seed = (unsigned int) value;
+    } else if (strcmp(name, "points") == 0) {
+        if (!sweep_choice(value, 0, INT_MAX)) {
+            return -1;
+        }
+        *num_points = (int) value;
+    } else if (strcmp(name, "steps") == 0) {
+        if (!sweep_choice(value, 0, INT_MAX)) {
+            return -1;
         }
+        *steps = (int) value;
+    } else {
+        return -1;
     }
-    if(glfwGetKey(window, GLFW_KEY_UP) == GLFW_PRESS) {
-        zoom_factor *= 1.01;
+    return 0;
+}
+
+// Runs in the forked child, which is pinned to one CPU, so the task pool
+// gets no helper threads.
+int sweep_point_run(const double* values, char* row, size_t row_size, void* context) {
+    const SweepJob* job = (const SweepJob*) context;
+    unsigned int seed = 1;
+    int num_points = job->num_points;
+    int steps = job->steps;
+    for (int k = 0; k < job->sweep.num_parameters; k++) {
+        sweep_setting(job->sweep.parameters[k].name, values[k], &seed, &num_points, &steps);
     }
-    if(glfwGetKey(window, GLFW_KEY_DOWN) == GLFW_PRESS) {
-        zoom_factor *= 1.0/1.01;
+    arena_init(&step_arena, 1 << 20);
+    task_pool_init(&task_pool, 1);
+    Particle* points = bench_setup(num_points, gen_points<dimensions>, seed);
+    double initial_energy = total_energy(points, num_points);
+    double start = wall_time();
+    for (int s = 0; s < steps; s++) {
+        iterate(points, &num_points, &tree);
     }
+    double elapsed = wall_time() - start;
+    double energy_error = fabs((total_energy(points, num_points) - initial_energy)/initial_energy);
+    snprintf(row, row_size, "%d,%d,%.6e,%.3f", num_points, particle_index.num_merges, energy_error, elapsed);
+    bench_teardown();
+    free(points);
+    task_pool_free(&task_pool);
+    arena_free(&step_arena);
+    return 0;
+}
 
+// ./main --sweep results.csv [--workers N] [--points N] [--steps N] name=v1,v2,...
+int run_sweep(int argc, char** argv) {
+    SweepJob job;
+    job.num_points = 1000;
+    job.steps = 100;
+    int workers = 0;
+    const char* path = argv[2];
+    sweep_init(&job.sweep, 0);
+    for (int a = 3; a < argc; a++) {
+        if (a + 1 < argc && strcmp(argv[a], "--workers") == 0) {
+            workers = atoi(argv[++a]);
+        } else if (a + 1 < argc && strcmp(argv[a], "--points") == 0) {
+            job.num_points = atoi(argv[++a]);
+        } else if (a + 1 < argc && strcmp(argv[a], "--steps") == 0) {
+            job.steps = atoi(argv[++a]);
+        } else if (sweep_add(&job.sweep, argv[a]) != 0) {
+            fprintf(stderr, "sweep: bad parameter '%s'\n", argv[a]);
+            return 1;
+        }
+    }
+    unsigned int seed;
+    int num_points, steps;
+    for (int k = 0; k < job.sweep.num_parameters; k++) {
+        const SweepParameter& parameter = job.sweep.parameters[k];
+        for (int v = 0; v < parameter.num_values; v++) {
+            if (sweep_setting(parameter.name, parameter.values[v], &seed, &num_points, &steps) != 0) {
+                fprintf(stderr, "sweep: unknown parameter or bad value %s=%g\n", parameter.name, parameter.values[v]);
+                return 1;
+            }
+        }
+    }
+    if (workers > 0) {
+        job.sweep.workers = workers;
+    }
+    printf("sweep: %ld points on %d workers into %s\n", sweep_size(&job.sweep), job.sweep.workers, path);
+    if (sweep_run(&job.sweep, path, "final_count,merges,energy_error,wall_time", sweep_point_run, &job) != 0) {
+        return 1;
+    }
+    printf("sweep: %ld run, %ld already done, %ld failed\n", job.sweep.completed, job.sweep.skipped, job.sweep.failed);
+    return job.sweep.failed > 0;
 }
 
-int main() {
+volatile sig_atomic_t publish_stop = 0;
+
+void publish_interrupt(int signal) {
+    publish_stop = 1;
+}
+
+// Headless run, of generated or loaded bodies, publishing every
+// publish_every-th step to a shared-memory ring until steps run out (0 runs
+// until interrupted). --escape R retires unbound bodies beyond R.
+int run_publish(int argc, char** argv) {
+    const char* name = argv[2];
+    int num_points = 1000;
+    long steps = 0;
+    int publish_every = 1;
+    int num_slots = 4;
+    const char* load_path = NULL;
+    float error_budget = 0.0f;
+    float escape = 0.0f;
+    for (int a = 3; a < argc; a++) {
+        if (a + 1 < argc && strcmp(argv[a], "--points") == 0) {
+            num_points = atoi(argv[++a]);
+        } else if (a + 1 < argc && strcmp(argv[a], "--steps") == 0) {
+            steps = atol(argv[++a]);
+        } else if (a + 1 < argc && strcmp(argv[a], "--every") == 0) {
+            publish_every = atoi(argv[++a]);
+        } else if (a + 1 < argc && strcmp(argv[a], "--slots") == 0) {
+            num_slots = atoi(argv[++a]);
+        } else if (a + 1 < argc && strcmp(argv[a], "--load") == 0) {
+            load_path = argv[++a];
+        } else if (a + 1 < argc && strcmp(argv[a], "--autotune") == 0) {
+            error_budget = (float) atof(argv[++a]);
+        } else if (a + 1 < argc && strcmp(argv[a], "--escape") == 0) {
+            escape = (float) atof(argv[++a]);
+        } else {
+            fprintf(stderr, "publish: bad argument '%s'\n", argv[a]);
+            return 1;
+        }
+    }
+    if (publish_every < 1) {
+        publish_every = 1;
+    }
+    gsim* sim = gsim_create();
+    if (error_budget > 0.0f) {
+        gsim_set_autotune(sim, 1, error_budget);
+    }
+    if (gsim_set_escape_radius(sim, escape) != 0) {
+        fprintf(stderr, "publish: bad escape radius\n");
+        gsim_destroy(sim);
+        return 1;
+    }
+    if (load_path != NULL ? gsim_load_file(sim, load_path) != 0 : gsim_generate(sim, num_points, time(NULL)) != 0) {
+        gsim_destroy(sim);
+        return 1;
+    }
+    num_points = gsim_count(sim);
+    gsim_publisher* publisher = gsim_publisher_open(name, num_points, num_slots);
+    if (publisher == NULL) {
+        perror("publish: shared memory");
+        gsim_destroy(sim);
+        return 1;
+    }
+    signal(SIGINT, publish_interrupt);
+    signal(SIGTERM, publish_interrupt);
+    printf("publish: %d bodies to %s every %d steps in %d slots\n", num_points, name, publish_every, num_slots);
+    double step_time = 0.0;
+    double publish_time = 0.0;
+    long frames = 0;
+    gsim_publish(publisher, sim);
+    for (long s = 0; (steps == 0 || s < steps) && !publish_stop; s++) {
+        double start = wall_time();
+        gsim_step(sim);
+        double stepped = wall_time();
+        if (gsim_step_count(sim) % publish_every == 0) {
+            gsim_publish(publisher, sim);
+            frames++;
+        }
+        step_time += stepped - start;
+        publish_time += wall_time() - stepped;
+    }
+    printf("publish: %ld steps, %ld frames, %.3f ms/step, %.3f ms/frame published\n", gsim_step_count(sim), frames,
+        1000.0*step_time/fmax(gsim_step_count(sim), 1), 1000.0*publish_time/fmax(frames, 1));
+    gsim_publisher_close(publisher);
+    gsim_destroy(sim);
+    return 0;
+}
+
+// The viewer as one more reader of a published ring: it copies the newest
+// frame out, keeps the copy only if it was not torn, and never holds up the
+// publisher.
+int run_view(const char* name) {
+    gsim_reader* reader = gsim_reader_open(name);
+    if (reader == NULL) {
+        fprintf(stderr, "view: nothing published as %s\n", name);
+        return 1;
+    }
+    const gsim_layout& layout = *gsim_reader_layout(reader);
+    GLFWwindow* window = init();
+    unsigned int program = programInit();
+    unsigned int VAO = 0;
+    ViewInput view;
+    memset(&view, 0, sizeof(view));
+    view.zoom = 1.0f;
+    pthread_mutex_init(&view.lock, NULL);
+    float pan_x = 0.0f;
+    float pan_y = 0.0f;
+    int capacity = 0;
+    int num_points = 0;
+    // The last good frame, copied out of the ring, and the copy in progress.
+    // Nothing keeps pointing into a slot, which the publisher may rewrite at
+    // any time.
+    char* bodies = NULL;
+    char* incoming = NULL;
+    float* center_x = NULL;
+    float* center_y = NULL;
+    float* radii = NULL;
+    gsim_frame frame;
+    while (!glfwWindowShouldClose(window)) {
+        pthread_mutex_lock(&view.lock);
+        zoom_factor *= view.zoom;
+        pan_x += view.pan[0];
+        pan_y += view.pan[1];
+        memset(view.pan, 0, sizeof(view.pan));
+        view.zoom = 1.0f;
+        pthread_mutex_unlock(&view.lock);
+        if (gsim_reader_begin(reader, &frame) == 0) {
+            if (capacity < frame.count) {
+                capacity = frame.count;
+                bodies = (char*) realloc(bodies, capacity*layout.record_size);
+                incoming = (char*) realloc(incoming, capacity*layout.record_size);
+                center_x = (float*) realloc(center_x, capacity*sizeof(float));
+                center_y = (float*) realloc(center_y, capacity*sizeof(float));
+                radii = (float*) realloc(radii, capacity*sizeof(float));
+            }
+            memcpy(incoming, frame.bodies, frame.count*layout.record_size);
+            // A torn frame keeps the last good one on screen.
+            if (gsim_reader_end(reader, &frame)) {
+                char* swap = bodies;
+                bodies = incoming;
+                incoming = swap;
+                num_points = frame.count;
+            }
+        }
+        for (int i = 0; i < num_points; i++) {
+            project(bodies, layout, i, zoom_factor, &center_x[i], &center_y[i], &radii[i]);
+            center_x[i] += pan_x*zoom_factor;
+            center_y[i] += pan_y*zoom_factor;
+        }
+        inputs(window, bodies, layout, num_points, &view);
+        render(window, &VAO, program, num_points, 0, center_x, center_y, radii);
+    }
+    glfwTerminate();
+    free(bodies);
+    free(incoming);
+    free(center_x);
+    free(center_y);
+    free(radii);
+    pthread_mutex_destroy(&view.lock);
+    gsim_reader_close(reader);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    // Sweeps fork their runs, which must not inherit pool threads.
+    if (argc > 2 && strcmp(argv[1], "--sweep") == 0) {
+        return run_sweep(argc, argv);
+    }
+    simulation_runtime_acquire();
+    if (argc > 2 && strcmp(argv[1], "--publish") == 0) {
+        int status = run_publish(argc, argv);
+        simulation_runtime_release();
+        return status;
+    }
+    if (argc > 2 && strcmp(argv[1], "--view") == 0) {
+        int status = run_view(argv[2]);
+        simulation_runtime_release();
+        return status;
+    }
+    if (argc > 1 && strcmp(argv[1], "--bench") == 0) {
+        run_benchmarks();
+        arena_print_stats(&step_arena, "Step");
+        simulation_runtime_release();
+        return 0;
+    }
+
     srand(time(NULL));
+    gsim* sim = gsim_create();
+    const char* load_path = NULL;
+    for (int a = 1; a + 1 < argc; a += 2) {
+        if (strcmp(argv[a], "--load") == 0) {
+            load_path = argv[a + 1];
+        } else if (strcmp(argv[a], "--autotune") == 0) {
+            gsim_set_autotune(sim, 1, (float) atof(argv[a + 1]));
+        }
+    }
+    if (load_path != NULL) {
+        if (gsim_load_file(sim, load_path) != 0) {
+            gsim_destroy(sim);
+            simulation_runtime_release();
+            return 1;
+        }
+    } else {
+        gsim_generate(sim, 1000, time(NULL));
+    }
     GLFWwindow* window = init();
     unsigned int program = programInit();
-    unsigned int VAO;
+    unsigned int VAO = 0;
 
-    int num_points = 1000;
-    struct Particle* points = (struct Particle*) malloc(sizeof(struct Particle)*num_points);
-    gen_points(num_points, points);
     // points[0] = p_init(0.2f, 0.0f, 0.0f);
     // points[1] = p_init(0.2f, 0.0f, 0.5f);
     // points[1] = p_init(0.2f, 0.5f, 0.5f);
@@ -316,37 +1416,28 @@ int main() {
     // points[4] = p_init(0.2f, -0.5f, 0.5f);
 
     int num_h_circles = 0;
-    if (collision_mode == CIRCLE || collision_mode == TELEPORT_CENTER || collision_mode == TELEPORT_RANDOM) {
+    int boundary_mode = gsim_get_collision_mode(sim);
+    if (boundary_mode == GSIM_CIRCLE || boundary_mode == GSIM_TELEPORT_CENTER || boundary_mode == GSIM_TELEPORT_RANDOM) {
         num_h_circles += 1;
     }
-    struct hcircle* hcircles = (struct hcircle*) malloc(sizeof(struct hcircle)*num_h_circles);
+    hcircle<dimensions>* hcircles = (hcircle<dimensions>*) malloc(sizeof(hcircle<dimensions>)*num_h_circles);
     if (num_h_circles > 0) {
-        struct vec2 center = {0.0f, 0.0f};
-        struct hcircle boundary = {1.0f, center};
+        hcircle<dimensions> boundary = {1.0f, vec_zero<dimensions>()};
         hcircles[0] = boundary;
     }
-    
-    float center_x[num_points+num_h_circles];
-    float center_y[num_points+num_h_circles];
-    float radii[num_points+num_h_circles];
+
     // iterate(points, num_points);
     // iterate(points, num_points);
-    while(!glfwWindowShouldClose(window)) {
-        inputs(window, points, num_points);
-        iterate(points, &num_points);
-
-        for (int i = 0; i < num_points; i++) {
-            center_x[i] = points[i].position.x*zoom_factor;
-            center_y[i] = points[i].position.y*zoom_factor;
-            radii[i] = points[i].radius*zoom_factor;
-        }
-        for (int i = 0; i < num_h_circles; i++) {
-            center_x[num_points+i] = points[i].position.x*zoom_factor;
-            center_y[num_points+i] = points[i].position.y*zoom_factor;
-            radii[num_points+i] = points[i].radius*zoom_factor;
-        }
-
-        render(window, &VAO, program, num_points, num_h_circles, center_x, center_y, radii);
-    }
+    Viewer viewer = {window, VAO, program};
+    FrameGraph graph;
+    frame_graph_init(&graph, sim, num_h_circles);
+    graph.draw = draw_frame;
+    graph.context = &viewer;
+    frame_graph_run(&graph, 1);
+    frame_graph_free(&graph);
+    gsim_destroy(sim);
+    arena_print_stats(&step_arena, "Step");
+    arena_print_stats(&render_arena, "Render");
     glfwTerminate();
+    simulation_runtime_release();
 }
\ No newline at end of file
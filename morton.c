@@ -0,0 +1,160 @@
+#include "morton.h"
+
+#include <float.h>
+#include <string.h>
+#include <omp.h>
+
+// Spread the low 21 bits of x so that D-1 zero bits separate each of them.
+template <int D>
+uint64_t spread_bits(uint32_t x);
+
+template <>
+uint64_t spread_bits<2>(uint32_t x) {
+    uint64_t v = x & 0x1fffff;
+    v = (v | (v << 16)) & 0x0000ffff0000ffffull;
+    v = (v | (v << 8)) & 0x00ff00ff00ff00ffull;
+    v = (v | (v << 4)) & 0x0f0f0f0f0f0f0f0full;
+    v = (v | (v << 2)) & 0x3333333333333333ull;
+    v = (v | (v << 1)) & 0x5555555555555555ull;
+    return v;
+}
+
+template <>
+uint64_t spread_bits<3>(uint32_t x) {
+    uint64_t v = x & 0x1fffff;
+    v = (v | (v << 32)) & 0x001f00000000ffffull;
+    v = (v | (v << 16)) & 0x001f0000ff0000ffull;
+    v = (v | (v << 8)) & 0x100f00f00f00f00full;
+    v = (v | (v << 4)) & 0x10c30c30c30c30c3ull;
+    v = (v | (v << 2)) & 0x1249249249249249ull;
+    return v;
+}
+
+template <int D>
+uint64_t morton_encode(const uint32_t* cell) {
+    uint64_t code = 0;
+    for (int d = 0; d < D; d++) {
+        code |= spread_bits<D>(cell[d]) << d;
+    }
+    return code;
+}
+
+template <int D>
+void morton_codes(const particle<D>* points, int num_points, uint64_t* codes) {
+    float lo[D], hi[D];
+    for (int d = 0; d < D; d++) {
+        lo[d] = FLT_MAX;
+        hi[d] = -FLT_MAX;
+    }
+    #pragma omp parallel for reduction(min: lo[:D]) reduction(max: hi[:D])
+    for (int i = 0; i < num_points; i++) {
+        for (int d = 0; d < D; d++) {
+            lo[d] = fminf(lo[d], points[i].position[d]);
+            hi[d] = fmaxf(hi[d], points[i].position[d]);
+        }
+    }
+    // One scale for every axis keeps the curve's cells square.
+    float extent = 0.0f;
+    for (int d = 0; d < D; d++) {
+        extent = fmaxf(extent, hi[d] - lo[d]);
+    }
+    float scale = extent > 0.0f ? (float) ((1u << morton_bits) - 1) / extent : 0.0f;
+
+    #pragma omp parallel for
+    for (int i = 0; i < num_points; i++) {
+        uint32_t cell[D];
+        for (int d = 0; d < D; d++) {
+            cell[d] = (uint32_t) ((points[i].position[d] - lo[d]) * scale);
+        }
+        codes[i] = morton_encode<D>(cell);
+    }
+}
+
+// Stable LSD radix sort on 8-bit digits. Each thread histograms and scatters
+// its own contiguous chunk, so equal keys keep their relative order.
+void radix_sort(uint64_t* keys, uint32_t* values, int n, int key_bits, struct Arena* arena) {
+    const int radix = 256;
+    int max_threads = omp_get_max_threads();
+    uint64_t* key_buf = (uint64_t*) arena_alloc(arena, n*sizeof(uint64_t));
+    uint32_t* value_buf = (uint32_t*) arena_alloc(arena, n*sizeof(uint32_t));
+    int* histograms = (int*) arena_alloc(arena, max_threads*radix*sizeof(int));
+    uint64_t* src_keys = keys;
+    uint32_t* src_values = values;
+
+    for (int shift = 0; shift < key_bits; shift += 8) {
+        int skip = 0;
+        #pragma omp parallel num_threads(max_threads)
+        {
+            int thread = omp_get_thread_num();
+            int num_threads = omp_get_num_threads();
+            int* hist = histograms + thread*radix;
+            int begin = (int) ((long) n*thread/num_threads);
+            int end = (int) ((long) n*(thread+1)/num_threads);
+            memset(hist, 0, radix*sizeof(int));
+            for (int i = begin; i < end; i++) {
+                hist[(src_keys[i] >> shift) & (radix-1)]++;
+            }
+            #pragma omp barrier
+            #pragma omp single
+            {
+                int offset = 0;
+                for (int digit = 0; digit < radix; digit++) {
+                    int digit_total = 0;
+                    for (int t = 0; t < num_threads; t++) {
+                        int count = histograms[t*radix + digit];
+                        histograms[t*radix + digit] = offset;
+                        offset += count;
+                        digit_total += count;
+                    }
+                    if (digit_total == n) {
+                        skip = 1;
+                    }
+                }
+            }
+            if (!skip) {
+                for (int i = begin; i < end; i++) {
+                    int pos = hist[(src_keys[i] >> shift) & (radix-1)]++;
+                    key_buf[pos] = src_keys[i];
+                    value_buf[pos] = src_values[i];
+                }
+            }
+        }
+        if (!skip) {
+            uint64_t* key_tmp = src_keys;
+            uint32_t* value_tmp = src_values;
+            src_keys = key_buf;
+            src_values = value_buf;
+            key_buf = key_tmp;
+            value_buf = value_tmp;
+        }
+    }
+    if (src_keys != keys) {
+        memcpy(keys, src_keys, n*sizeof(uint64_t));
+        memcpy(values, src_values, n*sizeof(uint32_t));
+    }
+}
+
+template <int D>
+void morton_reorder(particle<D>* points, int num_points, struct Arena* arena) {
+    uint64_t* codes = (uint64_t*) arena_alloc(arena, num_points*sizeof(uint64_t));
+    uint32_t* perm = (uint32_t*) arena_alloc(arena, num_points*sizeof(uint32_t));
+    morton_codes(points, num_points, codes);
+    for (int i = 0; i < num_points; i++) {
+        perm[i] = i;
+    }
+    radix_sort(codes, perm, num_points, D*morton_bits, arena);
+
+    particle<D>* sorted = (particle<D>*) arena_alloc(arena, num_points*sizeof(particle<D>));
+    #pragma omp parallel for
+    for (int i = 0; i < num_points; i++) {
+        sorted[i] = points[perm[i]];
+    }
+    memcpy(points, sorted, num_points*sizeof(particle<D>));
+}
+
+template uint64_t morton_encode<2>(const uint32_t* cell);
+template uint64_t morton_encode<3>(const uint32_t* cell);
+template void morton_codes<2>(const particle<2>* points, int num_points, uint64_t* codes);
+template void morton_codes<3>(const particle<3>* points, int num_points, uint64_t* codes);
+template void morton_reorder<2>(particle<2>* points, int num_points, struct Arena* arena);
+template void morton_reorder<3>(particle<3>* points, int num_points, struct Arena* arena);
@@ -0,0 +1,21 @@
+#ifndef MORTON_H
+#define MORTON_H
+
+#include <stdint.h>
+
+#include "arena.h"
+#include "particle.h"
+
+// Bits of each coordinate kept in a Morton code; 21 bits per axis keeps 3D
+// codes within 64 bits.
+const int morton_bits = 21;
+
+template <int D>
+uint64_t morton_encode(const uint32_t* cell);
+template <int D>
+void morton_codes(const particle<D>* points, int num_points, uint64_t* codes);
+void radix_sort(uint64_t* keys, uint32_t* values, int n, int key_bits, struct Arena* arena);
+template <int D>
+void morton_reorder(particle<D>* points, int num_points, struct Arena* arena);
+
+#endif
@@ -0,0 +1,288 @@
+#include <mpi.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "broadphase.h"
+#include "domain.h"
+#include "lbvh.h"
+#include "particle_index.h"
+#include "physics.h"
+
+// Headless driver that spreads one simulation over the ranks of
+// MPI_COMM_WORLD. Each rank owns the bodies in its ORB box: forces come from
+// its own bodies plus the locally essential trees of the others, collisions
+// see a halo of remote bodies, and bodies move to their new owner after
+// every integration. There is no window; the run reports timings and global
+// conservation at the end.
+//
+//   mpirun -np 4 ./main_mpi --strong 200000 20   (N in total)
+//   mpirun -np 4 ./main_mpi --weak 50000 20      (N per rank)
+
+const int dimensions = 2;
+typedef particle<dimensions> Particle;
+
+const float opening_angle = 0.5f;
+const int repartition_interval = 10;
+
+struct Arena step_arena;
+struct ParticleIndex particle_index;
+orb_domain<dimensions> domain;
+lbvh<dimensions> local_tree;
+lbvh<dimensions> force_tree;
+
+enum { PHASE_DECOMPOSE, PHASE_TREE, PHASE_FORCE, PHASE_COLLIDE, PHASE_INTEGRATE, num_phases };
+const char* phase_names[num_phases] = {"decompose", "tree+LET", "force", "collide", "integrate"};
+double phase_time[num_phases];
+long cross_merges = 0;
+long local_merges = 0;
+
+inline uint32_t hash32(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+inline float hash_uniform(uint32_t key) {
+    return (int) (hash32(key) >> 8) * (1.0f/16777216.0f);
+}
+
+// The viewer's asteroid belt, but every body is a function of its id alone,
+// so each rank generates its share of a run without talking to the others
+// and any rank count yields the same initial state.
+Particle belt_body(uint64_t id, uint64_t num_total) {
+    float asteroid_mass = 0.005f;
+    float central_mass = asteroid_mass*num_total*10;
+    Particle p;
+    memset(&p, 0, sizeof(p));
+    p.id = id;
+    p.lineage = -1;
+    if (id == 0) {
+        p.mass = central_mass;
+    } else {
+        float min_asteroid_radius = 1.7f;
+        float max_asteroid_radius = 2.9f;
+        float angle = hash_uniform(2*(uint32_t) id)*2.0f*pi;
+        float r = min_asteroid_radius + hash_uniform(2*(uint32_t) id + 1)*(max_asteroid_radius - min_asteroid_radius);
+        p.mass = asteroid_mass;
+        p.position[0] = r*cosf(angle);
+        p.position[1] = r*sinf(angle);
+        float central_radius = radius_for_mass(central_mass);
+        float speed = sqrt(gravitational_constant*central_mass/(r - central_radius))*1.1f;
+        p.velocity[0] = -speed*sinf(angle);
+        p.velocity[1] = speed*cosf(angle);
+    }
+    p.radius = radius_for_mass(p.mass);
+    return p;
+}
+
+double wall_time() {
+    return MPI_Wtime();
+}
+
+// Gravity on every local body from the local bodies and the sources other
+// ranks sent for this box. Sources join the hierarchy as bodies of their own
+// after the locals, so a local's slot still excludes only itself.
+void compute_forces(Particle* points, int num_points) {
+    double start = wall_time();
+    lbvh_build(&local_tree, points, num_points, &step_arena);
+    int num_sources;
+    let_source<dimensions>* sources = domain_exchange_sources(&domain, &local_tree, opening_angle, &num_sources, &step_arena);
+    int num_bodies = num_points + num_sources;
+    Particle* bodies = (Particle*) arena_alloc(&step_arena, num_bodies*sizeof(Particle) + 1);
+    memcpy(bodies, points, num_points*sizeof(Particle));
+    for (int s = 0; s < num_sources; s++) {
+        Particle& b = bodies[num_points + s];
+        memset(&b, 0, sizeof(b));
+        b.position = sources[s].position;
+        b.mass = sources[s].mass;
+    }
+    lbvh_build(&force_tree, bodies, num_bodies, &step_arena);
+    double built = wall_time();
+    phase_time[PHASE_TREE] += built - start;
+    #pragma omp parallel for schedule(dynamic, 64)
+    for (int i = 0; i < num_points; i++) {
+        vec<dimensions> field = lbvh_field(&force_tree, bodies, i, opening_angle);
+        points[i].force += field * (gravitational_constant*points[i].mass);
+    }
+    phase_time[PHASE_FORCE] += wall_time() - built;
+}
+
+// Overlap merges: first against the halo, so bodies leaving for another rank
+// are gone, then among the remaining local bodies. Merged bodies keep their
+// slots until the pass ends and the array is compacted once.
+void collide(Particle* points, int* num_points) {
+    double start = wall_time();
+    int num_halo;
+    int* halo_owner;
+    Particle* halo = domain_exchange_halo(&domain, points, *num_points, &num_halo, &halo_owner, &step_arena);
+    int num_all = *num_points + num_halo;
+    Particle* all = (Particle*) arena_alloc(&step_arena, num_all*sizeof(Particle) + 1);
+    memcpy(all, points, *num_points*sizeof(Particle));
+    memcpy(all + *num_points, halo, num_halo*sizeof(Particle));
+
+    int max_pairs = num_all;
+    uint64_t* pairs = (uint64_t*) arena_alloc(&step_arena, 2*max_pairs*sizeof(uint64_t));
+    int found = grid_pairs(all, num_all, 0.0f, 0.0f, pairs, max_pairs, &step_arena);
+    if (found > max_pairs) {
+        max_pairs = found;
+        pairs = (uint64_t*) arena_alloc(&step_arena, 2*max_pairs*sizeof(uint64_t));
+        grid_pairs(all, num_all, 0.0f, 0.0f, pairs, max_pairs, &step_arena);
+    }
+    particle_index_rebuild(&particle_index, all, num_all);
+    cross_merges += domain_merge_across(&domain, points, num_points, halo, halo_owner, num_halo, pairs, found, &particle_index, &step_arena);
+    for (int i = 0; i < num_all; i++) {
+        particle_index_move(&particle_index, all[i].id, -1);
+    }
+    particle_index_rebuild(&particle_index, points, *num_points);
+
+    char* absorbed = (char*) arena_alloc(&step_arena, *num_points + 1);
+    memset(absorbed, 0, *num_points);
+    for (int p = 0; p < found; p++) {
+        int a = particle_index_slot(&particle_index, pairs[2*p]);
+        int b = particle_index_slot(&particle_index, pairs[2*p + 1]);
+        if (a < 0 || b < 0 || absorbed[a] || absorbed[b]) {
+            continue;
+        }
+        vec<dimensions> delta = points[a].position - points[b].position;
+        float reach = points[a].radius + points[b].radius;
+        if (dot(delta, delta) >= reach*reach) {
+            continue;
+        }
+        Particle merged = merge(points[a], points[b]);
+        int survivor = merged.id == points[a].id ? a : b;
+        int loser = survivor == a ? b : a;
+        merged.lineage = points[survivor].lineage;
+        points[survivor] = merged;
+        absorbed[loser] = 1;
+        local_merges++;
+    }
+    int kept = 0;
+    for (int i = 0; i < *num_points; i++) {
+        particle_index_move(&particle_index, points[i].id, -1);
+        if (!absorbed[i]) {
+            points[kept++] = points[i];
+        }
+    }
+    *num_points = kept;
+    phase_time[PHASE_COLLIDE] += wall_time() - start;
+}
+
+void integrate(Particle* points, int num_points) {
+    double start = wall_time();
+    #pragma omp simd
+    for (int i = 0; i < num_points; i++) {
+        Particle& p = points[i];
+        p.acceleration = p.force * (1.0f/p.mass);
+        p.velocity += p.acceleration;
+        p.position += p.velocity;
+        p.force = vec_zero<dimensions>();
+    }
+    phase_time[PHASE_INTEGRATE] += wall_time() - start;
+}
+
+// Global mass and momentum, identical on every rank.
+void conserved(const Particle* points, int num_points, double* totals) {
+    double local[1 + dimensions] = {0.0};
+    for (int i = 0; i < num_points; i++) {
+        local[0] += points[i].mass;
+        for (int d = 0; d < dimensions; d++) {
+            local[1 + d] += (double) points[i].mass*points[i].velocity[d];
+        }
+    }
+    MPI_Allreduce(local, totals, 1 + dimensions, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+}
+
+int main(int argc, char** argv) {
+    MPI_Init(&argc, &argv);
+    int rank, size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+    if (argc < 4 || (strcmp(argv[1], "--strong") != 0 && strcmp(argv[1], "--weak") != 0)) {
+        if (rank == 0) {
+            fprintf(stderr, "usage: %s --strong N steps | --weak N_per_rank steps\n", argv[0]);
+        }
+        MPI_Finalize();
+        return 1;
+    }
+    int weak = strcmp(argv[1], "--weak") == 0;
+    uint64_t num_total = strtoull(argv[2], NULL, 10)*(weak ? size : 1);
+    int steps = atoi(argv[3]);
+
+    arena_init(&step_arena, 1 << 20);
+    particle_index_init(&particle_index, num_total);
+    for (uint64_t id = 0; id < num_total; id++) {
+        particle_index_move(&particle_index, id, -1);
+    }
+    domain_init(&domain, MPI_COMM_WORLD);
+    lbvh_init(&local_tree);
+    lbvh_init(&force_tree);
+
+    uint64_t first = num_total*rank/size;
+    uint64_t last = num_total*(rank + 1)/size;
+    int num_points = (int) (last - first);
+    int capacity = num_points > 0 ? num_points : 1;
+    Particle* points = (Particle*) malloc(capacity*sizeof(Particle));
+    for (uint64_t id = first; id < last; id++) {
+        points[id - first] = belt_body(id, num_total);
+    }
+    double before[1 + dimensions];
+    conserved(points, num_points, before);
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    double start = wall_time();
+    for (int step = 0; step < steps; step++) {
+        arena_reset(&step_arena);
+        double decompose = wall_time();
+        if (step % repartition_interval == 0) {
+            domain_partition(&domain, points, num_points, &step_arena);
+        }
+        domain_migrate(&domain, &points, &num_points, &capacity, &step_arena);
+        phase_time[PHASE_DECOMPOSE] += wall_time() - decompose;
+        compute_forces(points, num_points);
+        collide(points, &num_points);
+        integrate(points, num_points);
+    }
+    double elapsed = wall_time() - start;
+
+    double after[1 + dimensions];
+    conserved(points, num_points, after);
+    double slowest, phase_max[num_phases], phase_sum[num_phases];
+    MPI_Reduce(&elapsed, &slowest, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    MPI_Reduce(phase_time, phase_max, num_phases, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    MPI_Reduce(phase_time, phase_sum, num_phases, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+    long merges[2] = {cross_merges, local_merges}, total_merges[2];
+    MPI_Reduce(merges, total_merges, 2, MPI_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+    long bodies = num_points, total_bodies, most_bodies;
+    MPI_Reduce(&bodies, &total_bodies, 1, MPI_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+    MPI_Reduce(&bodies, &most_bodies, 1, MPI_LONG, MPI_MAX, 0, MPI_COMM_WORLD);
+
+    if (rank == 0) {
+        printf("%-7s ranks %3d  N %9lu  steps %4d  %9.3f ms/step\n", weak ? "weak" : "strong", size, (unsigned long) num_total, steps, 1000.0*slowest/steps);
+        for (int p = 0; p < num_phases; p++) {
+            // Imbalance is the slowest rank over the mean; 1.0 is perfect.
+            double mean = phase_sum[p]/size;
+            printf("  %-10s %9.3f ms/step  imbalance %5.2f\n", phase_names[p], 1000.0*phase_max[p]/steps, mean > 0.0 ? phase_max[p]/mean : 1.0);
+        }
+        printf("  bodies %ld (most on one rank %ld), merges %ld across ranks, %ld within\n", total_bodies, most_bodies, total_merges[0], total_merges[1]);
+        double momentum_error = 0.0;
+        for (int d = 0; d < dimensions; d++) {
+            momentum_error += fabs(after[1 + d] - before[1 + d]);
+        }
+        printf("  mass error %.3e, momentum drift %.3e\n", fabs(after[0] - before[0])/before[0], momentum_error);
+    }
+
+    free(points);
+    lbvh_free(&local_tree);
+    lbvh_free(&force_tree);
+    domain_free(&domain);
+    particle_index_free(&particle_index);
+    arena_free(&step_arena);
+    MPI_Finalize();
+    return 0;
+}
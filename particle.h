@@ -0,0 +1,33 @@
+#ifndef PARTICLE_H
+#define PARTICLE_H
+
+#include <stdint.h>
+
+#include "vec.h"
+
+template <int D>
+struct particle {
+    float radius;
+    float mass;
+    vec<D> position;
+    vec<D> velocity;
+    vec<D> acceleration;
+    vec<D> force;
+    // Time derivative of acceleration, kept by the Hermite integrator.
+    vec<D> jerk;
+    // Stable identity across re-sorts and merges, and the head of this body's
+    // merge history in the ParticleIndex (-1 if it never absorbed anything).
+    uint64_t id;
+    int32_t lineage;
+    // 1 if the last boundary pass clamped, reflected or teleported this body,
+    // so it did not reach its position along a straight line.
+    int32_t boundary_hit;
+};
+
+template <int D>
+struct hcircle {
+    float radius;
+    vec<D> position;
+};
+
+#endif
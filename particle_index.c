@@ -0,0 +1,84 @@
+#include "particle_index.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+void particle_index_init(struct ParticleIndex* index, uint64_t num_ids) {
+    index->slot_of = (int*) malloc(num_ids*sizeof(int));
+    for (uint64_t id = 0; id < num_ids; id++) {
+        index->slot_of[id] = (int) id;
+    }
+    index->num_ids = num_ids;
+    index->merge_capacity = 64;
+    index->merges = (struct MergeEvent*) malloc(index->merge_capacity*sizeof(struct MergeEvent));
+    index->num_merges = 0;
+}
+
+void particle_index_free(struct ParticleIndex* index) {
+    free(index->slot_of);
+    free(index->merges);
+    index->slot_of = NULL;
+    index->merges = NULL;
+    index->num_ids = 0;
+    index->num_merges = 0;
+}
+
+// Reserves the next ID; the caller places the particle and calls
+// particle_index_move().
+uint64_t particle_index_new_id(struct ParticleIndex* index) {
+    uint64_t id = index->num_ids++;
+    index->slot_of = (int*) realloc(index->slot_of, index->num_ids*sizeof(int));
+    index->slot_of[id] = -1;
+    return id;
+}
+
+int particle_index_record_merge(struct ParticleIndex* index, uint64_t survivor, int32_t survivor_lineage, uint64_t absorbed, int32_t absorbed_lineage, long step) {
+    if (index->num_merges == index->merge_capacity) {
+        index->merge_capacity *= 2;
+        index->merges = (struct MergeEvent*) realloc(index->merges, index->merge_capacity*sizeof(struct MergeEvent));
+    }
+    struct MergeEvent event = {survivor, absorbed, step, survivor_lineage, absorbed_lineage};
+    index->merges[index->num_merges] = event;
+    index->slot_of[absorbed] = -1;
+    return index->num_merges++;
+}
+
+// Collects every ID ever absorbed into the body whose lineage head is given,
+// most recent merges first. Returns the total count, which may exceed max_ids.
+int particle_index_absorbed(const struct ParticleIndex* index, int32_t lineage, uint64_t* ids, int max_ids) {
+    if (lineage < 0) {
+        return 0;
+    }
+    // Each event is visited once, so the pending stack never exceeds the
+    // number of recorded merges.
+    int32_t* stack = (int32_t*) malloc((index->num_merges+1)*sizeof(int32_t));
+    int top = 0;
+    int count = 0;
+    stack[top++] = lineage;
+    while (top > 0) {
+        int32_t event = stack[--top];
+        while (event >= 0) {
+            const struct MergeEvent* merge = &index->merges[event];
+            if (count < max_ids) {
+                ids[count] = merge->absorbed;
+            }
+            count++;
+            if (merge->absorbed_prev >= 0) {
+                stack[top++] = merge->absorbed_prev;
+            }
+            event = merge->survivor_prev;
+        }
+    }
+    free(stack);
+    return count;
+}
+
+template <int D>
+void particle_index_rebuild(struct ParticleIndex* index, const particle<D>* points, int num_points) {
+    for (int i = 0; i < num_points; i++) {
+        index->slot_of[points[i].id] = i;
+    }
+}
+
+template void particle_index_rebuild<2>(struct ParticleIndex* index, const particle<2>* points, int num_points);
+template void particle_index_rebuild<3>(struct ParticleIndex* index, const particle<3>* points, int num_points);
@@ -0,0 +1,45 @@
+#ifndef PARTICLE_INDEX_H
+#define PARTICLE_INDEX_H
+
+#include <stdint.h>
+
+#include "particle.h"
+
+// One merge in a body's history. Events form a binary tree: survivor_prev
+// continues the survivor's own history and absorbed_prev the history of the
+// body it swallowed. -1 terminates either branch.
+struct MergeEvent {
+    uint64_t survivor;
+    uint64_t absorbed;
+    long step;
+    int32_t survivor_prev;
+    int32_t absorbed_prev;
+};
+
+// Maps stable particle IDs to their current array slot in O(1). IDs are
+// dense, so the map is a flat array; absorbed IDs map to -1.
+struct ParticleIndex {
+    int* slot_of;
+    uint64_t num_ids;
+    struct MergeEvent* merges;
+    int num_merges;
+    int merge_capacity;
+};
+
+void particle_index_init(struct ParticleIndex* index, uint64_t num_ids);
+void particle_index_free(struct ParticleIndex* index);
+uint64_t particle_index_new_id(struct ParticleIndex* index);
+int particle_index_record_merge(struct ParticleIndex* index, uint64_t survivor, int32_t survivor_lineage, uint64_t absorbed, int32_t absorbed_lineage, long step);
+int particle_index_absorbed(const struct ParticleIndex* index, int32_t lineage, uint64_t* ids, int max_ids);
+template <int D>
+void particle_index_rebuild(struct ParticleIndex* index, const particle<D>* points, int num_points);
+
+inline int particle_index_slot(const struct ParticleIndex* index, uint64_t id) {
+    return id < index->num_ids ? index->slot_of[id] : -1;
+}
+
+inline void particle_index_move(struct ParticleIndex* index, uint64_t id, int slot) {
+    index->slot_of[id] = slot;
+}
+
+#endif
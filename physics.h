@@ -0,0 +1,37 @@
+#ifndef PHYSICS_H
+#define PHYSICS_H
+
+#include <math.h>
+
+#include "particle.h"
+
+// Constants and the merge rule shared by every driver of the simulation.
+const float gravitational_constant = 0.000001f;
+// Not const: parameter sweeps vary it per run.
+inline int rad_mass_factor = 20;
+
+// Radius of a body of the given mass, for bodies made or merged in the run.
+inline float radius_for_mass(float mass) {
+    return sqrt(mass/pi)/rad_mass_factor;
+}
+
+template <int D>
+particle<D> merge(const particle<D>& p1, const particle<D>& p2) {
+    float mass = p1.mass + p2.mass;
+    float radius = radius_for_mass(mass);
+    vec<D> position;
+    if (p1.mass > p2.mass) {
+        position = p1.position;
+    } else if (p1.mass < p2.mass) {
+        position = p2.position;
+    } else {
+        position = (p1.position + p2.position) * 0.5f;
+    }
+    vec<D> velocity = (p1.velocity*p1.mass + p2.velocity*p2.mass) * (1.0f/mass);
+    // The heavier body keeps its identity; the caller records the lineage.
+    uint64_t id = p1.mass >= p2.mass ? p1.id : p2.id;
+    particle<D> p = {radius, mass, position, velocity, vec_zero<D>(), vec_zero<D>(), vec_zero<D>(), id, -1};
+    return p;
+}
+
+#endif
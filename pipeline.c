@@ -0,0 +1,72 @@
+#include "pipeline.h"
+
+#include <time.h>
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+void pipeline_init(struct Pipeline* pipeline, unsigned int all_stages) {
+    // Slots start out holding finished frames -depth..-1.
+    for (int s = 0; s < pipeline_depth; s++) {
+        pipeline->slots[s].frame = s - pipeline_depth;
+        pipeline->slots[s].done = all_stages;
+    }
+    pipeline->all_stages = all_stages;
+    pipeline->stopped = 0;
+    pipeline->stalled = 0.0;
+    pthread_mutex_init(&pipeline->lock, NULL);
+    pthread_cond_init(&pipeline->changed, NULL);
+}
+
+void pipeline_free(struct Pipeline* pipeline) {
+    pthread_mutex_destroy(&pipeline->lock);
+    pthread_cond_destroy(&pipeline->changed);
+}
+
+int pipeline_acquire(struct Pipeline* pipeline, long frame) {
+    int slot = (int) (frame % pipeline_depth);
+    struct PipelineSlot* s = &pipeline->slots[slot];
+    double start = now();
+    pthread_mutex_lock(&pipeline->lock);
+    while (!pipeline->stopped && !(s->frame == frame - pipeline_depth && s->done == pipeline->all_stages)) {
+        pthread_cond_wait(&pipeline->changed, &pipeline->lock);
+    }
+    if (!pipeline->stopped) {
+        s->frame = frame;
+        s->done = 0;
+    }
+    int stopped = pipeline->stopped;
+    pthread_mutex_unlock(&pipeline->lock);
+    pipeline->stalled += now() - start;
+    return stopped ? -1 : slot;
+}
+
+int pipeline_wait(struct Pipeline* pipeline, long frame, unsigned int needs) {
+    int slot = (int) (frame % pipeline_depth);
+    struct PipelineSlot* s = &pipeline->slots[slot];
+    pthread_mutex_lock(&pipeline->lock);
+    while (!pipeline->stopped && !(s->frame == frame && (s->done & needs) == needs)) {
+        pthread_cond_wait(&pipeline->changed, &pipeline->lock);
+    }
+    int stopped = pipeline->stopped;
+    pthread_mutex_unlock(&pipeline->lock);
+    return stopped ? -1 : slot;
+}
+
+void pipeline_complete(struct Pipeline* pipeline, long frame, unsigned int stages) {
+    struct PipelineSlot* s = &pipeline->slots[frame % pipeline_depth];
+    pthread_mutex_lock(&pipeline->lock);
+    s->done |= stages;
+    pthread_cond_broadcast(&pipeline->changed);
+    pthread_mutex_unlock(&pipeline->lock);
+}
+
+void pipeline_stop(struct Pipeline* pipeline) {
+    pthread_mutex_lock(&pipeline->lock);
+    pipeline->stopped = 1;
+    pthread_cond_broadcast(&pipeline->changed);
+    pthread_mutex_unlock(&pipeline->lock);
+}
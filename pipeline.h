@@ -0,0 +1,40 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <pthread.h>
+
+// Ring of frame slots shared by the stages of a frame graph. Each stage is a
+// bit; a slot records the frame it holds and which stages have finished with
+// it. A stage waits until the stages it depends on are done for its frame,
+// and the producer reuses a slot once every stage has finished with the
+// frame before. Stages on different threads therefore overlap across
+// frames: while frame n is drawn, frame n+1 can already be computed.
+const int pipeline_depth = 2;
+
+struct PipelineSlot {
+    long frame;
+    unsigned int done;
+};
+
+struct Pipeline {
+    struct PipelineSlot slots[pipeline_depth];
+    unsigned int all_stages;
+    int stopped;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    // Seconds the producer spent waiting for a free slot.
+    double stalled;
+};
+
+void pipeline_init(struct Pipeline* pipeline, unsigned int all_stages);
+void pipeline_free(struct Pipeline* pipeline);
+// Claims the slot for frame, waiting until the frame pipeline_depth before it
+// is finished. Returns the slot, or -1 once the pipeline is stopped.
+int pipeline_acquire(struct Pipeline* pipeline, long frame);
+// Waits until every stage in needs is done for frame. Returns the slot, or -1
+// once the pipeline is stopped.
+int pipeline_wait(struct Pipeline* pipeline, long frame, unsigned int needs);
+void pipeline_complete(struct Pipeline* pipeline, long frame, unsigned int stages);
+void pipeline_stop(struct Pipeline* pipeline);
+
+#endif
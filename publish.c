@@ -0,0 +1,192 @@
+#include "publish.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+static const uint32_t publish_magic = 0x6773696d;
+
+// The shared object is this header followed by num_slots slots, each a
+// SlotHeader and capacity body records, every part 64-byte aligned so slots
+// do not share cache lines.
+struct RingHeader {
+    uint32_t magic;
+    int32_t num_slots;
+    int32_t capacity;
+    gsim_layout layout;
+    uint64_t slot_size;
+    // Frames published so far; frame f lives in slot f % num_slots.
+    uint64_t frames;
+};
+
+struct SlotHeader {
+    uint64_t sequence;
+    uint64_t index;
+    int64_t step;
+    int32_t count;
+};
+
+static const size_t ring_header_size = (sizeof(RingHeader) + 63) & ~(size_t) 63;
+static const size_t slot_header_size = (sizeof(SlotHeader) + 63) & ~(size_t) 63;
+
+struct gsim_publisher {
+    char name[256];
+    RingHeader* ring;
+    size_t size;
+};
+
+struct gsim_reader {
+    const RingHeader* ring;
+    size_t size;
+    uint64_t last_frame;
+};
+
+static SlotHeader* slot_at(const RingHeader* ring, uint64_t frame) {
+    return (SlotHeader*) ((char*) ring + ring_header_size + (frame % ring->num_slots)*ring->slot_size);
+}
+
+gsim_publisher* gsim_publisher_open(const char* name, int capacity, int num_slots) {
+    if (capacity < 0 || num_slots < 2 || strlen(name) >= sizeof(((gsim_publisher*) 0)->name)) {
+        return NULL;
+    }
+    gsim_layout layout;
+    gsim_get_layout(&layout);
+    size_t slot_size = (slot_header_size + capacity*layout.record_size + 63) & ~(size_t) 63;
+    size_t size = ring_header_size + num_slots*slot_size;
+
+    // A ring left by an earlier run may still be mapped by readers; unlink it
+    // so they keep the old object rather than seeing this one half set up.
+    shm_unlink(name);
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0) {
+        return NULL;
+    }
+    void* memory = MAP_FAILED;
+    if (ftruncate(fd, size) == 0) {
+        memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (memory == MAP_FAILED) {
+        shm_unlink(name);
+        return NULL;
+    }
+    gsim_publisher* publisher = (gsim_publisher*) calloc(1, sizeof(gsim_publisher));
+    strcpy(publisher->name, name);
+    publisher->ring = (RingHeader*) memory;
+    publisher->size = size;
+    RingHeader* ring = publisher->ring;
+    ring->num_slots = num_slots;
+    ring->capacity = capacity;
+    ring->layout = layout;
+    ring->slot_size = slot_size;
+    ring->frames = 0;
+    // Readers check the magic first, so it goes in last.
+    __atomic_store_n(&ring->magic, publish_magic, __ATOMIC_RELEASE);
+    return publisher;
+}
+
+void gsim_publisher_close(gsim_publisher* publisher) {
+    if (publisher == NULL) {
+        return;
+    }
+    munmap(publisher->ring, publisher->size);
+    shm_unlink(publisher->name);
+    free(publisher);
+}
+
+int gsim_publish(gsim_publisher* publisher, gsim* sim) {
+    RingHeader* ring = publisher->ring;
+    int count = gsim_count(sim);
+    if (count > ring->capacity) {
+        return -1;
+    }
+    uint64_t frame = ring->frames;
+    SlotHeader* slot = slot_at(ring, frame);
+    uint64_t sequence = slot->sequence;
+    __atomic_store_n(&slot->sequence, sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    slot->index = frame;
+    slot->step = gsim_step_count(sim);
+    slot->count = count;
+    memcpy((char*) slot + slot_header_size, gsim_bodies(sim), count*ring->layout.record_size);
+    __atomic_store_n(&slot->sequence, sequence + 2, __ATOMIC_RELEASE);
+    __atomic_store_n(&ring->frames, frame + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+gsim_reader* gsim_reader_open(const char* name) {
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        return NULL;
+    }
+    void* memory = MAP_FAILED;
+    off_t size = lseek(fd, 0, SEEK_END);
+    if (size >= (off_t) ring_header_size) {
+        memory = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (memory == MAP_FAILED) {
+        return NULL;
+    }
+    const RingHeader* ring = (const RingHeader*) memory;
+    gsim_layout layout;
+    gsim_get_layout(&layout);
+    if (__atomic_load_n(&ring->magic, __ATOMIC_ACQUIRE) != publish_magic
+            || ring_header_size + ring->num_slots*ring->slot_size > (size_t) size
+            || ring->layout.record_size != layout.record_size || ring->layout.dimensions != layout.dimensions) {
+        munmap(memory, size);
+        return NULL;
+    }
+    gsim_reader* reader = (gsim_reader*) calloc(1, sizeof(gsim_reader));
+    reader->ring = ring;
+    reader->size = size;
+    return reader;
+}
+
+void gsim_reader_close(gsim_reader* reader) {
+    if (reader == NULL) {
+        return;
+    }
+    munmap((void*) reader->ring, reader->size);
+    free(reader);
+}
+
+const gsim_layout* gsim_reader_layout(const gsim_reader* reader) {
+    return &reader->ring->layout;
+}
+
+int gsim_reader_begin(gsim_reader* reader, gsim_frame* frame) {
+    const RingHeader* ring = reader->ring;
+    for (;;) {
+        uint64_t frames = __atomic_load_n(&ring->frames, __ATOMIC_ACQUIRE);
+        if (frames == 0 || frames == reader->last_frame) {
+            return -1;
+        }
+        const SlotHeader* slot = slot_at(ring, frames - 1);
+        uint64_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        // Odd, or already reused for a later frame: the publisher lapped us
+        // between the two loads, so there is a newer frame to take instead.
+        if ((sequence & 1) != 0 || slot->index != frames - 1) {
+            continue;
+        }
+        reader->last_frame = frames;
+        frame->index = frames - 1;
+        frame->step = slot->step;
+        frame->count = slot->count;
+        frame->bodies = (const char*) slot + slot_header_size;
+        frame->sequence = sequence;
+        frame->slot = slot;
+        if (frame->count < 0 || frame->count > ring->capacity) {
+            continue;
+        }
+        return 0;
+    }
+}
+
+int gsim_reader_end(const gsim_reader* reader, const gsim_frame* frame) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    const SlotHeader* slot = (const SlotHeader*) frame->slot;
+    return __atomic_load_n(&slot->sequence, __ATOMIC_RELAXED) == frame->sequence;
+}
@@ -0,0 +1,60 @@
+#ifndef PUBLISH_H
+#define PUBLISH_H
+
+#include <stdint.h>
+
+#include "gsim.h"
+
+// Live state of a running simulation in POSIX shared memory, for viewers
+// and analysis in other processes. The publisher writes frames round-robin
+// into a ring of slots and never waits for anyone; any number of readers map
+// the ring read-only and read the newest frame in place. Each slot carries a
+// seqlock sequence, odd while the slot is being written, so a reader that
+// raced the publisher (or was lapped by it) finds out after reading and
+// simply retries with the newest frame. A reader has num_slots - 1 frames of
+// time before the slot it reads comes around again.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct gsim_publisher gsim_publisher;
+typedef struct gsim_reader gsim_reader;
+
+// A frame being read. bodies points into the shared ring, laid out as
+// gsim_reader_layout() says.
+typedef struct gsim_frame {
+    uint64_t index;
+    int64_t step;
+    int count;
+    const void* bodies;
+    // Seqlock state, for gsim_reader_end().
+    uint64_t sequence;
+    const void* slot;
+} gsim_frame;
+
+// Creates (or replaces) the shared-memory object name, e.g. "/gsim", with
+// num_slots slots of up to capacity bodies. Returns NULL on failure.
+gsim_publisher* gsim_publisher_open(const char* name, int capacity, int num_slots);
+// Unlinks the object; readers keep their mapping until they close.
+void gsim_publisher_close(gsim_publisher* publisher);
+// Publishes the simulation's current bodies as the next frame. Returns 0, or
+// -1 if they do not fit a slot.
+int gsim_publish(gsim_publisher* publisher, gsim* sim);
+
+// Maps a published ring. Returns NULL if it does not exist (yet).
+gsim_reader* gsim_reader_open(const char* name);
+void gsim_reader_close(gsim_reader* reader);
+const gsim_layout* gsim_reader_layout(const gsim_reader* reader);
+// Starts reading the newest frame. Returns 0 and fills frame, or -1 if
+// nothing newer than the last frame begun has been published.
+int gsim_reader_begin(gsim_reader* reader, gsim_frame* frame);
+// Returns 1 if the frame was not overwritten while it was read, so what was
+// read is consistent, or 0 if it must be discarded.
+int gsim_reader_end(const gsim_reader* reader, const gsim_frame* frame);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
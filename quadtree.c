@@ -0,0 +1,484 @@
+#include "quadtree.h"
+
+#include <float.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Depth-first traversals push at most 2^D-1 siblings per level.
+const int quadtree_stack_size = (quadtree_max_depth+1)*8;
+
+template <int D>
+void quadtree_init(quadtree<D>* tree) {
+    tree->nodes = NULL;
+    tree->num_nodes = 0;
+    tree->node_capacity = 0;
+    tree->free_blocks = -1;
+    tree->leaf_of = NULL;
+    tree->next = NULL;
+    tree->prev = NULL;
+    tree->id_capacity = 0;
+    tree->num_particles = 0;
+    tree->min_source_mass = 0.0f;
+    tree->max_radius = 0.0f;
+    tree->reinserted = 0;
+    tree->updates = 0;
+    tree->rebuilds = 0;
+}
+
+template <int D>
+void quadtree_free(quadtree<D>* tree) {
+    free(tree->nodes);
+    free(tree->leaf_of);
+    free(tree->next);
+    free(tree->prev);
+    quadtree_init(tree);
+}
+
+template <int D>
+void reserve_particle_ids(quadtree<D>* tree, uint64_t num_ids) {
+    if (num_ids <= tree->id_capacity) {
+        return;
+    }
+    uint64_t capacity = num_ids > 2*tree->id_capacity ? num_ids : 2*tree->id_capacity;
+    tree->leaf_of = (int*) realloc(tree->leaf_of, capacity*sizeof(int));
+    tree->next = (int*) realloc(tree->next, capacity*sizeof(int));
+    tree->prev = (int*) realloc(tree->prev, capacity*sizeof(int));
+    for (uint64_t id = tree->id_capacity; id < capacity; id++) {
+        tree->leaf_of[id] = -1;
+    }
+    tree->id_capacity = capacity;
+}
+
+template <int D>
+void init_cell(quadtree<D>* tree, int node, int parent, const vec<D>& center, float half_size, int depth) {
+    quadtree_node<D>* n = &tree->nodes[node];
+    n->center = center;
+    n->half_size = half_size;
+    n->parent = parent;
+    n->first_child = -1;
+    n->depth = depth;
+    n->count = 0;
+    n->head = -1;
+    n->mass = 0.0f;
+    n->com = center;
+    n->lo = center;
+    n->hi = center;
+}
+
+// Children are allocated in blocks of 2^D; freed blocks are chained through
+// the first_child field of their first node.
+template <int D>
+int alloc_children(quadtree<D>* tree) {
+    if (tree->free_blocks >= 0) {
+        int first = tree->free_blocks;
+        tree->free_blocks = tree->nodes[first].first_child;
+        return first;
+    }
+    if (tree->num_nodes + (1 << D) > tree->node_capacity) {
+        tree->node_capacity = 2*tree->node_capacity + (1 << D);
+        tree->nodes = (quadtree_node<D>*) realloc(tree->nodes, tree->node_capacity*sizeof(quadtree_node<D>));
+    }
+    int first = tree->num_nodes;
+    tree->num_nodes += 1 << D;
+    return first;
+}
+
+template <int D>
+void free_children(quadtree<D>* tree, int first) {
+    tree->nodes[first].first_child = tree->free_blocks;
+    tree->free_blocks = first;
+}
+
+template <int D>
+int child_index(const quadtree_node<D>& node, const vec<D>& pos) {
+    int child = 0;
+    for (int d = 0; d < D; d++) {
+        if (pos[d] >= node.center[d]) {
+            child |= 1 << d;
+        }
+    }
+    return child;
+}
+
+template <int D>
+int cell_contains(const quadtree_node<D>& node, const vec<D>& pos) {
+    for (int d = 0; d < D; d++) {
+        if (fabsf(pos[d] - node.center[d]) > node.half_size) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+template <int D>
+void bucket_push(quadtree<D>* tree, int node, int id) {
+    int head = tree->nodes[node].head;
+    tree->next[id] = head;
+    tree->prev[id] = -1;
+    if (head >= 0) {
+        tree->prev[head] = id;
+    }
+    tree->nodes[node].head = id;
+    tree->leaf_of[id] = node;
+}
+
+template <int D>
+void bucket_unlink(quadtree<D>* tree, int id) {
+    int node = tree->leaf_of[id];
+    if (tree->prev[id] >= 0) {
+        tree->next[tree->prev[id]] = tree->next[id];
+    } else {
+        tree->nodes[node].head = tree->next[id];
+    }
+    if (tree->next[id] >= 0) {
+        tree->prev[tree->next[id]] = tree->prev[id];
+    }
+    tree->leaf_of[id] = -1;
+}
+
+template <int D>
+void insert_particle(quadtree<D>* tree, const particle<D>* points, const struct ParticleIndex* index, int id, const vec<D>& pos, int node);
+
+template <int D>
+void split_leaf(quadtree<D>* tree, const particle<D>* points, const struct ParticleIndex* index, int node) {
+    int first = alloc_children(tree);
+    quadtree_node<D> parent = tree->nodes[node];
+    float half_size = parent.half_size*0.5f;
+    for (int c = 0; c < (1 << D); c++) {
+        vec<D> center = parent.center;
+        for (int d = 0; d < D; d++) {
+            center[d] += (c & (1 << d)) ? half_size : -half_size;
+        }
+        init_cell(tree, first + c, node, center, half_size, parent.depth + 1);
+    }
+    int list = parent.head;
+    tree->nodes[node].head = -1;
+    tree->nodes[node].first_child = first;
+    while (list >= 0) {
+        int id = list;
+        list = tree->next[id];
+        const vec<D>& pos = points[particle_index_slot(index, id)].position;
+        insert_particle(tree, points, index, id, pos, first + child_index(parent, pos));
+    }
+}
+
+// Adds a particle below node, counting it in node and every cell it passes.
+template <int D>
+void insert_particle(quadtree<D>* tree, const particle<D>* points, const struct ParticleIndex* index, int id, const vec<D>& pos, int node) {
+    while (1) {
+        tree->nodes[node].count++;
+        if (tree->nodes[node].first_child < 0) {
+            break;
+        }
+        node = tree->nodes[node].first_child + child_index(tree->nodes[node], pos);
+    }
+    bucket_push(tree, node, id);
+    if (tree->nodes[node].count > quadtree_leaf_capacity && tree->nodes[node].depth < quadtree_max_depth) {
+        split_leaf(tree, points, index, node);
+    }
+}
+
+// Unlinks a particle and uncounts it from its leaf up to stop (inclusive);
+// stop = -1 uncounts it all the way to the root.
+template <int D>
+void remove_particle(quadtree<D>* tree, int id, int stop) {
+    int node = tree->leaf_of[id];
+    bucket_unlink(tree, id);
+    while (node >= 0) {
+        tree->nodes[node].count--;
+        if (node == stop) {
+            break;
+        }
+        node = tree->nodes[node].parent;
+    }
+}
+
+template <int D>
+void collapse_cell(quadtree<D>* tree, int node) {
+    int first = tree->nodes[node].first_child;
+    for (int c = 0; c < (1 << D); c++) {
+        if (tree->nodes[first + c].first_child >= 0) {
+            collapse_cell(tree, first + c);
+        }
+        int list = tree->nodes[first + c].head;
+        while (list >= 0) {
+            int id = list;
+            list = tree->next[id];
+            bucket_push(tree, node, id);
+        }
+    }
+    free_children(tree, first);
+    tree->nodes[node].first_child = -1;
+}
+
+// Merges back the highest sparse subtree above node, with hysteresis so a
+// cell does not flip between split and collapsed every step.
+template <int D>
+void collapse_sparse(quadtree<D>* tree, int node) {
+    int target = -1;
+    for (; node >= 0; node = tree->nodes[node].parent) {
+        if (tree->nodes[node].first_child >= 0 && tree->nodes[node].count <= quadtree_leaf_capacity/2) {
+            target = node;
+        }
+    }
+    if (target >= 0) {
+        collapse_cell(tree, target);
+    }
+}
+
+template <int D>
+void refit_cell(quadtree<D>* tree, const particle<D>* points, const struct ParticleIndex* index, int node) {
+    quadtree_node<D>* n = &tree->nodes[node];
+    float mass = 0.0f;
+    vec<D> moment = vec_zero<D>();
+    vec<D> lo, hi;
+    for (int d = 0; d < D; d++) {
+        lo[d] = FLT_MAX;
+        hi[d] = -FLT_MAX;
+    }
+    if (n->first_child < 0) {
+        for (int id = n->head; id >= 0; id = tree->next[id]) {
+            const particle<D>& p = points[particle_index_slot(index, id)];
+            if (p.mass >= tree->min_source_mass) {
+                mass += p.mass;
+                moment += p.position * p.mass;
+            }
+            for (int d = 0; d < D; d++) {
+                lo[d] = fminf(lo[d], p.position[d]);
+                hi[d] = fmaxf(hi[d], p.position[d]);
+            }
+            if (p.radius > tree->max_radius) {
+                tree->max_radius = p.radius;
+            }
+        }
+    } else {
+        for (int c = 0; c < (1 << D); c++) {
+            int child = n->first_child + c;
+            refit_cell(tree, points, index, child);
+            const quadtree_node<D>& cn = tree->nodes[child];
+            if (cn.count == 0) {
+                continue;
+            }
+            mass += cn.mass;
+            moment += cn.com * cn.mass;
+            for (int d = 0; d < D; d++) {
+                lo[d] = fminf(lo[d], cn.lo[d]);
+                hi[d] = fmaxf(hi[d], cn.hi[d]);
+            }
+        }
+    }
+    n->mass = mass;
+    n->com = mass > 0.0f ? moment * (1.0f/mass) : n->center;
+    n->lo = lo;
+    n->hi = hi;
+}
+
+template <int D>
+void quadtree_build(quadtree<D>* tree, const particle<D>* points, int num_points, const struct ParticleIndex* index) {
+    reserve_particle_ids(tree, index->num_ids);
+    for (uint64_t id = 0; id < tree->id_capacity; id++) {
+        tree->leaf_of[id] = -1;
+    }
+    vec<D> lo, hi;
+    for (int d = 0; d < D; d++) {
+        lo[d] = FLT_MAX;
+        hi[d] = -FLT_MAX;
+    }
+    for (int i = 0; i < num_points; i++) {
+        for (int d = 0; d < D; d++) {
+            lo[d] = fminf(lo[d], points[i].position[d]);
+            hi[d] = fmaxf(hi[d], points[i].position[d]);
+        }
+    }
+    float half_size = 1e-6f;
+    for (int d = 0; d < D; d++) {
+        half_size = fmaxf(half_size, 0.5f*(hi[d] - lo[d]));
+    }
+    // A little slack keeps particles near the edge from escaping the root
+    // cell (and forcing a rebuild) on the very next step.
+    half_size *= 1.05f;
+
+    if (tree->node_capacity < 1) {
+        tree->node_capacity = 1 + (1 << D);
+        tree->nodes = (quadtree_node<D>*) realloc(tree->nodes, tree->node_capacity*sizeof(quadtree_node<D>));
+    }
+    tree->num_nodes = 1;
+    tree->free_blocks = -1;
+    init_cell(tree, 0, -1, (lo + hi) * 0.5f, half_size, 0);
+    for (int i = 0; i < num_points; i++) {
+        insert_particle(tree, points, index, (int) points[i].id, points[i].position, 0);
+    }
+    tree->num_particles = num_points;
+    tree->max_radius = 0.0f;
+    tree->rebuilds++;
+    refit_cell(tree, points, index, 0);
+}
+
+template <int D>
+void quadtree_update(quadtree<D>* tree, const particle<D>* points, int num_points, const struct ParticleIndex* index) {
+    tree->updates++;
+    tree->reinserted = 0;
+    if (tree->num_nodes == 0) {
+        quadtree_build(tree, points, num_points, index);
+        return;
+    }
+    reserve_particle_ids(tree, index->num_ids);
+
+    // Drop bodies that were absorbed in merges since the last update.
+    if (tree->num_particles != num_points) {
+        for (uint64_t id = 0; id < tree->id_capacity; id++) {
+            if (tree->leaf_of[id] >= 0 && particle_index_slot(index, id) < 0) {
+                int parent = tree->nodes[tree->leaf_of[id]].parent;
+                remove_particle(tree, (int) id, -1);
+                collapse_sparse(tree, parent);
+                tree->num_particles--;
+            }
+        }
+    }
+
+    int limit = (int) (quadtree_rebuild_fraction*num_points);
+    for (int i = 0; i < num_points; i++) {
+        int id = (int) points[i].id;
+        const vec<D>& pos = points[i].position;
+        int leaf = tree->leaf_of[id];
+        if (leaf >= 0 && cell_contains(tree->nodes[leaf], pos)) {
+            continue;
+        }
+        int ancestor = leaf >= 0 ? tree->nodes[leaf].parent : 0;
+        while (ancestor >= 0 && !cell_contains(tree->nodes[ancestor], pos)) {
+            ancestor = tree->nodes[ancestor].parent;
+        }
+        if (ancestor < 0 || ++tree->reinserted > limit) {
+            quadtree_build(tree, points, num_points, index);
+            return;
+        }
+        if (leaf < 0) {
+            insert_particle(tree, points, index, id, pos, 0);
+            tree->num_particles++;
+            continue;
+        }
+        int old_parent = tree->nodes[leaf].parent;
+        remove_particle(tree, id, ancestor);
+        insert_particle(tree, points, index, id, pos, ancestor);
+        collapse_sparse(tree, old_parent);
+    }
+    tree->max_radius = 0.0f;
+    refit_cell(tree, points, index, 0);
+}
+
+template <int D>
+int inside_bounds(const quadtree_node<D>& node, const vec<D>& pos) {
+    for (int d = 0; d < D; d++) {
+        if (pos[d] < node.lo[d] || pos[d] > node.hi[d]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Barnes-Hut sum of m/r^2 along the separation from every other particle;
+// scaling by G and the particle's own mass gives the force. A cell is
+// accepted when its extent is below theta times its distance and it does not
+// enclose the particle itself.
+template <int D>
+vec<D> quadtree_field(const quadtree<D>* tree, const particle<D>* points, const struct ParticleIndex* index, int slot, float theta) {
+    vec<D> field = vec_zero<D>();
+    const vec<D>& pos = points[slot].position;
+    int stack[quadtree_stack_size];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+        const quadtree_node<D>& node = tree->nodes[stack[--top]];
+        if (node.count == 0 || node.mass <= 0.0f) {
+            continue;
+        }
+        vec<D> delta = node.com - pos;
+        float distance_sq = dot(delta, delta);
+        float size = 0.0f;
+        for (int d = 0; d < D; d++) {
+            size = fmaxf(size, node.hi[d] - node.lo[d]);
+        }
+        if (size*size < theta*theta*distance_sq && !inside_bounds(node, pos)) {
+            field += delta * (node.mass/(distance_sq*sqrtf(distance_sq)));
+        } else if (node.first_child < 0) {
+            for (int id = node.head; id >= 0; id = tree->next[id]) {
+                int other = particle_index_slot(index, id);
+                if (other == slot || points[other].mass < tree->min_source_mass) {
+                    continue;
+                }
+                vec<D> d = points[other].position - pos;
+                float r_sq = dot(d, d);
+                field += d * (points[other].mass/(r_sq*sqrtf(r_sq)));
+            }
+        } else {
+            for (int c = 0; c < (1 << D); c++) {
+                stack[top++] = node.first_child + c;
+            }
+        }
+    }
+    return field;
+}
+
+// Slots of all particles whose position lies in [lo, hi]. Returns the total
+// number found, which may exceed max_slots.
+template <int D>
+int quadtree_query(const quadtree<D>* tree, const particle<D>* points, const struct ParticleIndex* index, const vec<D>& lo, const vec<D>& hi, int* slots, int max_slots) {
+    int found = 0;
+    int stack[quadtree_stack_size];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+        const quadtree_node<D>& node = tree->nodes[stack[--top]];
+        if (node.count == 0) {
+            continue;
+        }
+        int overlaps = 1;
+        for (int d = 0; d < D; d++) {
+            if (node.hi[d] < lo[d] || node.lo[d] > hi[d]) {
+                overlaps = 0;
+            }
+        }
+        if (!overlaps) {
+            continue;
+        }
+        if (node.first_child >= 0) {
+            for (int c = 0; c < (1 << D); c++) {
+                stack[top++] = node.first_child + c;
+            }
+            continue;
+        }
+        for (int id = node.head; id >= 0; id = tree->next[id]) {
+            int slot = particle_index_slot(index, id);
+            if (slot < 0) {
+                continue;
+            }
+            int inside = 1;
+            for (int d = 0; d < D; d++) {
+                if (points[slot].position[d] < lo[d] || points[slot].position[d] > hi[d]) {
+                    inside = 0;
+                }
+            }
+            if (inside) {
+                if (found < max_slots) {
+                    slots[found] = slot;
+                }
+                found++;
+            }
+        }
+    }
+    return found;
+}
+
+template void quadtree_init<2>(quadtree<2>* tree);
+template void quadtree_init<3>(quadtree<3>* tree);
+template void quadtree_free<2>(quadtree<2>* tree);
+template void quadtree_free<3>(quadtree<3>* tree);
+template void quadtree_build<2>(quadtree<2>* tree, const particle<2>* points, int num_points, const struct ParticleIndex* index);
+template void quadtree_build<3>(quadtree<3>* tree, const particle<3>* points, int num_points, const struct ParticleIndex* index);
+template void quadtree_update<2>(quadtree<2>* tree, const particle<2>* points, int num_points, const struct ParticleIndex* index);
+template void quadtree_update<3>(quadtree<3>* tree, const particle<3>* points, int num_points, const struct ParticleIndex* index);
+template vec<2> quadtree_field<2>(const quadtree<2>* tree, const particle<2>* points, const struct ParticleIndex* index, int slot, float theta);
+template vec<3> quadtree_field<3>(const quadtree<3>* tree, const particle<3>* points, const struct ParticleIndex* index, int slot, float theta);
+template int quadtree_query<2>(const quadtree<2>* tree, const particle<2>* points, const struct ParticleIndex* index, const vec<2>& lo, const vec<2>& hi, int* slots, int max_slots);
+template int quadtree_query<3>(const quadtree<3>* tree, const particle<3>* points, const struct ParticleIndex* index, const vec<3>& lo, const vec<3>& hi, int* slots, int max_slots);
@@ -0,0 +1,67 @@
+#ifndef QUADTREE_H
+#define QUADTREE_H
+
+#include "particle.h"
+#include "particle_index.h"
+
+// Spatial tree over the particle array with 2^D children per cell (a quadtree
+// in 2D, an octree in 3D). It is kept alive across steps: cell geometry is
+// fixed between rebuilds, only particles that leave their leaf are moved, and
+// node bounds and centers of mass are refit bottom-up every update.
+const int quadtree_leaf_capacity = 8;
+const int quadtree_max_depth = 20;
+// Share of particles that may change leaves in one update before it is
+// cheaper to rebuild the tree from scratch.
+const float quadtree_rebuild_fraction = 0.25f;
+
+template <int D>
+struct quadtree_node {
+    vec<D> center;
+    float half_size;
+    int parent;
+    int first_child;
+    int depth;
+    int count;
+    int head;
+    float mass;
+    vec<D> com;
+    vec<D> lo;
+    vec<D> hi;
+};
+
+// Leaves keep their particles as doubly linked lists threaded through next
+// and prev, which like leaf_of are indexed by particle id.
+template <int D>
+struct quadtree {
+    quadtree_node<D>* nodes;
+    int num_nodes;
+    int node_capacity;
+    int free_blocks;
+    int* leaf_of;
+    int* next;
+    int* prev;
+    uint64_t id_capacity;
+    int num_particles;
+    // Particles lighter than this are located by the tree but contribute no
+    // mass to it, so fields only come from the heavier (active) bodies.
+    float min_source_mass;
+    float max_radius;
+    int reinserted;
+    long updates;
+    long rebuilds;
+};
+
+template <int D>
+void quadtree_init(quadtree<D>* tree);
+template <int D>
+void quadtree_free(quadtree<D>* tree);
+template <int D>
+void quadtree_build(quadtree<D>* tree, const particle<D>* points, int num_points, const struct ParticleIndex* index);
+template <int D>
+void quadtree_update(quadtree<D>* tree, const particle<D>* points, int num_points, const struct ParticleIndex* index);
+template <int D>
+vec<D> quadtree_field(const quadtree<D>* tree, const particle<D>* points, const struct ParticleIndex* index, int slot, float theta);
+template <int D>
+int quadtree_query(const quadtree<D>* tree, const particle<D>* points, const struct ParticleIndex* index, const vec<D>& lo, const vec<D>& hi, int* slots, int max_slots);
+
+#endif
@@ -6,6 +6,8 @@ const int resY = 1000;
 
 int num_sectors = 50;
 
+struct Arena render_arena;
+
 void error_callback(int error, const char* description) {
     fprintf(stderr, "Error %d: %s\n", error, description);
 }
@@ -63,6 +65,7 @@ GLFWwindow* init() {
     glfwSwapInterval(1);
 
     glfwSetTime(0.0);
+    arena_init(&render_arena, 1 << 20);
     return window;
 }
 
@@ -174,9 +177,10 @@ void dataInit(unsigned int* VAO, int num_circles, int num_h_circles, float* cent
     // };
     int data_size = 2*(num_sectors+1)*num_circles*sizeof(float);
     int indices_size = 3*num_sectors*num_circles*sizeof(unsigned int);
-    float* data = (float*) malloc(data_size);
-    unsigned int* indices = (unsigned int*) malloc(indices_size);
+    float* data = (float*) arena_alloc(&render_arena, data_size);
+    unsigned int* indices = (unsigned int*) arena_alloc(&render_arena, indices_size);
 
+    // A plain loop, since the step running alongside owns the task pool.
     for (int i = 0; i < num_circles; i++) {
         circleInit(data, indices, i, center_x[i], center_y[i], radii[i]);
     }
@@ -197,18 +201,21 @@ void dataInit(unsigned int* VAO, int num_circles, int num_h_circles, float* cent
     //     printf("Index %d: (%f, %f)\n", i/2, data[i], data[i+1]);
     // }
     
-    unsigned int VBO, EBO;
+    // The buffer objects are created once and refilled every frame.
+    static unsigned int VBO, EBO;
 
-    glGenVertexArrays(1, VAO);
-    glGenBuffers(1, &VBO);
-    glGenBuffers(1, &EBO);
+    if (*VAO == 0) {
+        glGenVertexArrays(1, VAO);
+        glGenBuffers(1, &VBO);
+        glGenBuffers(1, &EBO);
+    }
     glBindVertexArray(*VAO);
 
     glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, data_size, data, GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, data_size, data, GL_STREAM_DRAW);
 
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices_size, indices, GL_STATIC_DRAW);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices_size, indices, GL_STREAM_DRAW);
 
     glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, (void*)0);
     glEnableVertexAttribArray(0);
@@ -218,8 +225,6 @@ void dataInit(unsigned int* VAO, int num_circles, int num_h_circles, float* cent
     // glEnableVertexAttribArray(1);
     // glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 7*sizeof(float), (void*)(5*sizeof(float)));
     // glEnableVertexAttribArray(2);
-    free(data);
-    free(indices);
 }
 
 // unsigned int genTextures() {
@@ -242,6 +247,7 @@ void dataInit(unsigned int* VAO, int num_circles, int num_h_circles, float* cent
 // }
 
 int render(GLFWwindow* window, unsigned int* VAO, unsigned int program, int num_circles, int num_h_circles, float* center_x, float* center_y, float* radii) {
+    arena_reset(&render_arena);
     dataInit(VAO, num_circles, num_h_circles, center_x, center_y, radii);
     draw(program, *VAO, num_circles, num_h_circles);
     glfwSwapBuffers(window);
@@ -9,7 +9,10 @@
 #include <string.h>
 #include <stdlib.h>
 
-const float pi = 3.14159265f;
+#include "arena.h"
+#include "vec.h"
+
+extern struct Arena render_arena;
 
 void error_callback(int error, const char* description);
 void framebuffer_size_callback(GLFWwindow *window, int width, int height);
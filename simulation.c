@@ -0,0 +1,1156 @@
+#include "simulation.h"
+
+#include <math.h>
+#include <float.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#include "autotune.h"
+#include "hermite.h"
+#include "morton.h"
+#include "wisdom_holman.h"
+
+float damping_factor = 0.5f;
+int collision_mode = NO_BORDER;
+int pointgen_mode = ASTEROID_BELT;
+int force_mode = DIRECT_SUM;
+int integrator = EULER;
+float opening_angle = 0.5f;
+float passive_mass_threshold = 0.0f;
+int respa_interval = 1;
+float respa_cutoff = 0.25f;
+int swept_collisions = 1;
+float collision_step = 0.0f;
+int broad_phase = TREE_OR_ALL_PAIRS;
+float escape_radius = 0.0f;
+float wh_time_step = 50.0f;
+float hermite_step = 0.0f;
+int reorder_interval = 16;
+int autotune = 0;
+float autotune_error_budget = 0.01f;
+float autotune_drop = 0.75f;
+
+struct Arena step_arena;
+int task_pool_workers = 0;
+struct TaskPool task_pool;
+static int runtime_users = 0;
+
+long step_count = 0;
+struct ParticleIndex particle_index;
+quadtree<dimensions> tree;
+lbvh<dimensions> bvh;
+sweep_prune<dimensions> sweep;
+verlet_list<dimensions> neighbor_lists;
+escape_list<dimensions> escapes;
+long wh_cached_step = -2;
+long hermite_cached_step = -2;
+double simulated_time = 0.0;
+long force_evaluations = 0;
+int autotune_count = 0;
+struct StepTimings step_timings;
+
+double wall_time() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+
+template <int D>
+void print_particle(const particle<D>& p) {
+    printf("Particle with radius %f, mass %f:\n", p.radius, p.mass);
+    const char* labels[] = {"Position", "Velocity", "Acceleration", "Force"};
+    const vec<D>* vecs[] = {&p.position, &p.velocity, &p.acceleration, &p.force};
+    for (int v = 0; v < 4; v++) {
+        printf("%s: (", labels[v]);
+        for (int d = 0; d < D; d++) {
+            printf(d == 0 ? "%f" : ", %f", (*vecs[v])[d]);
+        }
+        printf(")\n");
+    }
+}
+
+// Earliest time in [0, dt], counted from the start of the last step, at
+// which the two bodies touched if both moved in a straight line at their
+// current velocity over that step; -1 if they stayed apart.
+template <int D>
+float time_of_impact(const particle<D>& p1, const particle<D>& p2, float dt) {
+    float reach = p1.radius + p2.radius;
+    vec<D> relative_velocity = p1.velocity - p2.velocity;
+    vec<D> start = p1.position - p2.position - relative_velocity*dt;
+    float c = dot(start, start) - reach*reach;
+    if (c <= 0.0f) {
+        return 0.0f;
+    }
+    float a = dot(relative_velocity, relative_velocity);
+    float half_b = dot(start, relative_velocity);
+    if (a == 0.0f || half_b >= 0.0f) {
+        return -1.0f;
+    }
+    float discriminant = half_b*half_b - a*c;
+    if (discriminant < 0.0f) {
+        return -1.0f;
+    }
+    float t = (-half_b - sqrtf(discriminant))/a;
+    return t <= dt ? t : -1.0f;
+}
+
+// Returns 1 if the pair merged; p2_index is removed and later slots shift down.
+// The merge happens where the bodies were at the time of impact, and the
+// merged body then moves on at its new velocity for the rest of the step.
+// A body the boundary moved has no straight path to sweep back along, so
+// pairs with one are only tested for overlap where they are now.
+template <int D>
+int check_collision(particle<D>* points, int* num_points, int p1_index, int p2_index) {
+    float dt = points[p1_index].boundary_hit || points[p2_index].boundary_hit ? 0.0f : collision_step;
+    float impact = time_of_impact(points[p1_index], points[p2_index], dt);
+    if (impact >= 0.0f && !disable_merging) {
+        // print_particle(points[p1_index]);
+        // print_particle(points[p2_index]);
+        float rewind = dt - impact;
+        particle<D> p1 = points[p1_index], p2 = points[p2_index];
+        p1.position -= p1.velocity*rewind;
+        p2.position -= p2.velocity*rewind;
+        particle<D> merged = merge(p1, p2);
+        merged.position += merged.velocity*rewind;
+        const particle<D>& survivor = merged.id == points[p1_index].id ? points[p1_index] : points[p2_index];
+        const particle<D>& absorbed = merged.id == points[p1_index].id ? points[p2_index] : points[p1_index];
+        merged.lineage = particle_index_record_merge(&particle_index, survivor.id, survivor.lineage, absorbed.id, absorbed.lineage, step_count);
+        points[p1_index] = merged;
+        particle_index_move(&particle_index, merged.id, p1_index);
+        // print_particle(points[p1_index]);
+        for (int i = p2_index; i < *num_points-1; i++) {
+            points[i] = points[i+1];
+            particle_index_move(&particle_index, points[i].id, i);
+        }
+        *num_points = *num_points-1;
+        return 1;
+    }
+    return 0;
+}
+
+// Angle of p2 as seen from p1, measured in the x-y plane.
+template <int D>
+float get_angle(const vec<D>& p1, const vec<D>& p2) {
+    return atan2f(p2[1] - p1[1], p2[0] - p1[0]);
+}
+
+template <int D>
+vec<D> pair_force(const particle<D>& p1, const particle<D>& p2) {
+    // The pull acts along the separation vector, so scaling it directly
+    // replaces the atan2f/cosf/sinf round trip and works in any dimension.
+    vec<D> delta = p2.position - p1.position;
+    float distance_sq = dot(delta, delta);
+    float distance = sqrtf(distance_sq);
+    float force = gravitational_constant*p1.mass*p2.mass/distance_sq;
+    return delta * (force/distance);
+}
+
+template <int D>
+void set_force(particle<D>* p1, particle<D>* p2) {
+    (*p1).force += pair_force(*p1, *p2);
+}
+
+// Boundary handling, one kernel per collision mode. Each updates a single
+// particle without branches so the loops over the whole array below
+// vectorize, and the mode is a template argument, so choosing it costs
+// nothing per particle. Randomness comes from hashing the particle id with a
+// per-step seed rather than from rand(), which would serialize the loop.
+// sin(pi*t) and cos(pi*t) for t in [-1, 1] from a parabola with one
+// correction term, accurate to about 0.1%.
+inline void fast_sincos_pi(float t, float* s, float* c) {
+    float y = 4.0f*t*(1.0f - fabsf(t));
+    *s = 0.225f*(y*fabsf(y) - y) + y;
+    float u = t + 0.5f;
+    u -= 2.0f*(u > 1.0f);
+    y = 4.0f*u*(1.0f - fabsf(u));
+    *c = 0.225f*(y*fabsf(y) - y) + y;
+}
+
+// Unit vector uniformly distributed over directions. In 3D the height is
+// uniform on [-1, 1], which is uniform on the sphere (Archimedes).
+template <int D>
+inline vec<D> hash_direction(uint32_t key) {
+    vec<D> dir = vec_zero<D>();
+    float s, c;
+    fast_sincos_pi(2.0f*hash_uniform(key) - 1.0f, &s, &c);
+    float planar = 1.0f;
+    for (int d = 2; d < D; d++) {
+        dir[d] = 2.0f*hash_uniform(key ^ 0x68e31da4u) - 1.0f;
+        planar = sqrtf(1.0f - dir[d]*dir[d]);
+    }
+    dir[0] = c*planar;
+    dir[1] = s*planar;
+    return dir * (1.0f/magnitude(dir));
+}
+
+template <int Mode>
+struct boundary_kernel {
+    template <int D>
+    static inline void apply(particle<D>& p, uint32_t key) {
+        p.boundary_hit = 0;
+    }
+};
+
+template <>
+struct boundary_kernel<SQUARE> {
+    template <int D>
+    static inline void apply(particle<D>& p, uint32_t key) {
+        const float square_size = 1.0f;
+        float hit = 0.0f;
+        #pragma GCC unroll 3
+        for (int d = 0; d < D; d++) {
+            float position = p.position[d];
+            float over = position + p.radius > square_size;
+            position = over ? square_size - p.radius : position;
+            float under = position - p.radius < -square_size;
+            p.position[d] = under ? -square_size + p.radius : position;
+            float clamped = over + under - over*under;
+            p.velocity[d] *= 1.0f - clamped*(1.0f + damping_factor);
+            hit += clamped - hit*clamped;
+        }
+        p.boundary_hit = hit != 0.0f;
+    }
+};
+
+template <>
+struct boundary_kernel<CIRCLE> {
+    template <int D>
+    static inline void apply(particle<D>& p, uint32_t key) {
+        const float max_rad = 1.0f;
+        float center_dist = magnitude(p.position);
+        float distance = center_dist + p.radius;
+        float hit = (distance >= max_rad) & (center_dist > 0.0f);
+        p.position -= p.position * (hit*(distance - max_rad)/(center_dist > 0.0f ? center_dist : 1.0f));
+        p.velocity = p.velocity * (1.0f - 2.0f*hit);
+        p.boundary_hit = hit != 0.0f;
+    }
+};
+
+template <>
+struct boundary_kernel<TELEPORT_CENTER> {
+    template <int D>
+    static inline void apply(particle<D>& p, uint32_t key) {
+        const float max_rad = 1.0f;
+        float keep = magnitude(p.position) + p.radius < max_rad;
+        p.position = p.position * keep;
+        p.boundary_hit = keep == 0.0f;
+    }
+};
+
+template <>
+struct boundary_kernel<TELEPORT_RANDOM> {
+    template <int D>
+    static inline void apply(particle<D>& p, uint32_t key) {
+        const float max_rad = 1.0f;
+        int out = magnitude(p.position) + p.radius >= max_rad;
+        vec<D> target = hash_direction<D>(key) * hash_uniform(key ^ 0x2c1b3c6du);
+        #pragma GCC unroll 3
+        for (int d = 0; d < D; d++) {
+            p.position[d] = out ? target[d] : p.position[d];
+        }
+        p.boundary_hit = out;
+    }
+};
+
+// The slot rather than the id keys the hash: it is the loop counter, so the
+// key costs no load from the strided particle array.
+inline uint32_t particle_key(int slot, uint32_t seed) {
+    return seed ^ ((uint32_t) slot*2654435761u);
+}
+
+template <int Mode, int D>
+void boundary_pass(particle<D>* points, int num_points, uint32_t seed) {
+    task_for(&task_pool, 0, num_points, stream_grain, [&](int begin, int end) {
+        #pragma omp simd
+        for (int i = begin; i < end; i++) {
+            boundary_kernel<Mode>::apply(points[i], particle_key(i, seed));
+        }
+    });
+}
+
+// Euler update with unit step, boundary and force reset fused into one pass
+// over the array.
+template <int Mode, int D>
+void integrate_pass(particle<D>* points, int num_points, uint32_t seed) {
+    task_for(&task_pool, 0, num_points, stream_grain, [&](int begin, int end) {
+        #pragma omp simd
+        for (int i = begin; i < end; i++) {
+            particle<D>& p = points[i];
+            p.acceleration = p.force * (1.0f/p.mass);
+            p.velocity += p.acceleration;
+            p.position += p.velocity;
+            p.force = vec_zero<D>();
+            boundary_kernel<Mode>::apply(p, particle_key(i, seed));
+        }
+    });
+}
+
+// The boundary is a template argument of the passes; these pick the
+// instantiation for the current mode once per pass.
+template <int D>
+void boundary_pass_for_mode(int mode, particle<D>* points, int num_points, uint32_t seed) {
+    switch (mode) {
+    case SQUARE: boundary_pass<SQUARE>(points, num_points, seed); break;
+    case CIRCLE: boundary_pass<CIRCLE>(points, num_points, seed); break;
+    case TELEPORT_CENTER: boundary_pass<TELEPORT_CENTER>(points, num_points, seed); break;
+    case TELEPORT_RANDOM: boundary_pass<TELEPORT_RANDOM>(points, num_points, seed); break;
+    default: break;
+    }
+}
+
+template <int D>
+void integrate_pass_for_mode(int mode, particle<D>* points, int num_points, uint32_t seed) {
+    switch (mode) {
+    case SQUARE: integrate_pass<SQUARE>(points, num_points, seed); break;
+    case CIRCLE: integrate_pass<CIRCLE>(points, num_points, seed); break;
+    case TELEPORT_CENTER: integrate_pass<TELEPORT_CENTER>(points, num_points, seed); break;
+    case TELEPORT_RANDOM: integrate_pass<TELEPORT_RANDOM>(points, num_points, seed); break;
+    default: integrate_pass<NO_BORDER>(points, num_points, seed); break;
+    }
+}
+
+template <int D>
+void tree_forces(particle<D>* points, int num_points, const quadtree<D>* tree) {
+    task_for(&task_pool, 0, num_points, force_grain, [&](int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            vec<D> field = quadtree_field(tree, points, &particle_index, i, opening_angle);
+            points[i].force += field * (gravitational_constant*points[i].mass);
+        }
+    });
+}
+
+template <int D>
+void bvh_forces(particle<D>* points, int num_points, const lbvh<D>* bvh) {
+    task_for(&task_pool, 0, num_points, force_grain, [&](int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            vec<D> field = lbvh_field(bvh, points, i, opening_angle);
+            points[i].force += field * (gravitational_constant*points[i].mass);
+        }
+    });
+}
+
+// Collision candidates are the particles within reach of each body's radius
+// plus the largest radius in the tree, widened by how far this body and the
+// fastest one moved during the swept step. Neighbors are held by id because
+// merges shift slots while the list is being walked.
+template <int D>
+void tree_collisions(particle<D>* points, int* num_points, const quadtree<D>* tree) {
+    int max_neighbors = 64;
+    int* neighbors = (int*) arena_alloc(&step_arena, max_neighbors*sizeof(int));
+    uint64_t* neighbor_ids = (uint64_t*) arena_alloc(&step_arena, max_neighbors*sizeof(uint64_t));
+    float max_speed = 0.0f;
+    if (collision_step > 0.0f) {
+        for (int i = 0; i < *num_points; i++) {
+            max_speed = fmaxf(max_speed, magnitude(points[i].velocity));
+        }
+    }
+    for (int i = 0; i < *num_points; i++) {
+        float reach = points[i].radius + tree->max_radius + (magnitude(points[i].velocity) + max_speed)*collision_step;
+        vec<D> lo = points[i].position, hi = points[i].position;
+        for (int d = 0; d < D; d++) {
+            lo[d] -= reach;
+            hi[d] += reach;
+        }
+        int found = quadtree_query(tree, points, &particle_index, lo, hi, neighbors, max_neighbors);
+        if (found > max_neighbors) {
+            max_neighbors = 2*found;
+            neighbors = (int*) arena_alloc(&step_arena, max_neighbors*sizeof(int));
+            neighbor_ids = (uint64_t*) arena_alloc(&step_arena, max_neighbors*sizeof(uint64_t));
+            found = quadtree_query(tree, points, &particle_index, lo, hi, neighbors, max_neighbors);
+        }
+        for (int n = 0; n < found; n++) {
+            neighbor_ids[n] = points[neighbors[n]].id;
+        }
+        for (int n = 0; n < found; n++) {
+            int k = particle_index_slot(&particle_index, neighbor_ids[n]);
+            if (k < 0 || k == i) {
+                continue;
+            }
+            if (check_collision(points, num_points, i, k) && k < i) {
+                i--;
+            }
+        }
+    }
+}
+
+template <int D>
+void direct_collisions(particle<D>* points, int* num_points) {
+    for (int i = 0; i < *num_points; i++) {
+        for (int k = 0; k < *num_points; k++) {
+            if (i != k) {
+                check_collision(points, num_points, i, k);
+            }
+        }
+    }
+}
+
+// Narrow phase over a broad phase's candidate pairs, held by id.
+template <int D>
+void pair_collisions(particle<D>* points, int* num_points, const uint64_t* pairs, int num_pairs) {
+    for (int p = 0; p < num_pairs; p++) {
+        int a = particle_index_slot(&particle_index, pairs[2*p]);
+        int b = particle_index_slot(&particle_index, pairs[2*p + 1]);
+        if (a >= 0 && b >= 0) {
+            check_collision(points, num_points, a, b);
+        }
+    }
+}
+
+template <int D>
+void sweep_collisions(particle<D>* points, int* num_points) {
+    sweep_prune_update(&sweep, points, *num_points, &particle_index, collision_step);
+    int max_pairs = *num_points;
+    uint64_t* pairs = (uint64_t*) arena_alloc(&step_arena, 2*max_pairs*sizeof(uint64_t));
+    int found = sweep_prune_pairs(&sweep, pairs, max_pairs);
+    if (found > max_pairs) {
+        max_pairs = found;
+        pairs = (uint64_t*) arena_alloc(&step_arena, 2*max_pairs*sizeof(uint64_t));
+        sweep_prune_pairs(&sweep, pairs, max_pairs);
+    }
+    pair_collisions(points, num_points, pairs, found);
+}
+
+template <int D>
+void grid_collisions(particle<D>* points, int* num_points) {
+    int max_pairs = *num_points;
+    uint64_t* pairs = (uint64_t*) arena_alloc(&step_arena, 2*max_pairs*sizeof(uint64_t));
+    int found = grid_pairs(points, *num_points, collision_step, 0.0f, pairs, max_pairs, &step_arena);
+    if (found > max_pairs) {
+        max_pairs = found;
+        pairs = (uint64_t*) arena_alloc(&step_arena, 2*max_pairs*sizeof(uint64_t));
+        grid_pairs(points, *num_points, collision_step, 0.0f, pairs, max_pairs, &step_arena);
+    }
+    pair_collisions(points, num_points, pairs, found);
+}
+
+template <int D>
+void verlet_collisions(particle<D>* points, int* num_points) {
+    verlet_list_update(&neighbor_lists, points, *num_points, &particle_index, collision_step, &step_arena);
+    for (uint64_t a = 0; a < neighbor_lists.num_rows; a++) {
+        for (int n = neighbor_lists.offsets[a]; n < neighbor_lists.offsets[a + 1]; n++) {
+            int i = particle_index_slot(&particle_index, a);
+            int k = particle_index_slot(&particle_index, neighbor_lists.neighbors[n]);
+            if (i < 0) {
+                break;
+            }
+            if (k >= 0) {
+                check_collision(points, num_points, i, k);
+            }
+        }
+    }
+}
+
+// Collisions for a step whose tree, if any, is already up to date.
+template <int D>
+void broad_phase_collisions(particle<D>* points, int* num_points, const quadtree<D>* tree) {
+    if (broad_phase == SWEEP_AND_PRUNE) {
+        sweep_collisions(points, num_points);
+    } else if (broad_phase == UNIFORM_GRID) {
+        grid_collisions(points, num_points);
+    } else if (broad_phase == VERLET_LIST) {
+        verlet_collisions(points, num_points);
+    } else {
+        tree_collisions(points, num_points, tree);
+    }
+}
+
+// Collision pass for the modes that separate it from the force loop. With
+// passive bodies the all-pairs check would keep the step O(N^2), so the tree
+// supplies candidates whenever test-particle mode is on.
+template <int D>
+void resolve_collisions(particle<D>* points, int* num_points, quadtree<D>* tree) {
+    if (broad_phase != TREE_OR_ALL_PAIRS) {
+        broad_phase_collisions(points, num_points, tree);
+    } else if (force_mode == BARNES_HUT || passive_mass_threshold > 0.0f) {
+        quadtree_update(tree, points, *num_points, &particle_index);
+        tree_collisions(points, num_points, tree);
+    } else {
+        direct_collisions(points, num_points);
+    }
+}
+
+// Slots of the bodies heavy enough to source gravity. Rebuilt every step, so
+// a passive body that grows past the threshold through merges is promoted
+// on the next force pass.
+template <int D>
+int* active_set(const particle<D>* points, int num_points, int* num_active) {
+    int* active = (int*) arena_alloc(&step_arena, num_points*sizeof(int));
+    int count = 0;
+    for (int i = 0; i < num_points; i++) {
+        if (points[i].mass >= passive_mass_threshold) {
+            active[count++] = i;
+        }
+    }
+    *num_active = count;
+    return active;
+}
+
+// Gravitational acceleration on every body from all bodies except the central
+// one, left in particle::acceleration for wh_kick().
+template <int D>
+void interaction_accelerations(particle<D>* points, int num_points, int central, quadtree<D>* tree) {
+    if (force_mode == BARNES_HUT) {
+        // Hide the central mass from the tree: folded into cell moments its
+        // pull would swamp the small interaction terms with approximation error.
+        float central_mass = points[central].mass;
+        points[central].mass = 0.0f;
+        force_evaluations++;
+        quadtree_update(tree, points, num_points, &particle_index);
+        task_for(&task_pool, 0, num_points, force_grain, [&](int begin, int end) {
+            for (int i = begin; i < end; i++) {
+                points[i].acceleration = quadtree_field(tree, points, &particle_index, i, opening_angle) * gravitational_constant;
+            }
+        });
+        points[central].mass = central_mass;
+        return;
+    }
+    if (force_mode == LINEAR_BVH) {
+        float central_mass = points[central].mass;
+        points[central].mass = 0.0f;
+        force_evaluations++;
+        lbvh_build(&bvh, points, num_points, &step_arena);
+        task_for(&task_pool, 0, num_points, force_grain, [&](int begin, int end) {
+            for (int i = begin; i < end; i++) {
+                points[i].acceleration = lbvh_field(&bvh, points, i, opening_angle) * gravitational_constant;
+            }
+        });
+        points[central].mass = central_mass;
+        return;
+    }
+    force_evaluations++;
+    int num_active;
+    int* active = active_set(points, num_points, &num_active);
+    task_for(&task_pool, 0, num_points, force_grain, [&](int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            vec<D> acceleration = vec_zero<D>();
+            for (int a = 0; a < num_active; a++) {
+                int k = active[a];
+                if (k != i && k != central) {
+                    vec<D> delta = points[k].position - points[i].position;
+                    float distance_sq = dot(delta, delta);
+                    acceleration += delta * (gravitational_constant*points[k].mass/(distance_sq*sqrtf(distance_sq)));
+                }
+            }
+            points[i].acceleration = acceleration;
+        }
+    });
+}
+
+// Forces for one r-RESPA step. Near pairs come from a tree query around each
+// body. On refresh steps the far field is added as an impulse of
+// respa_interval steps, either as a direct sum beyond the cutoff or as the
+// tree's field minus the exact near sum.
+template <int D>
+void respa_forces(particle<D>* points, int num_points, const quadtree<D>* tree, int refresh) {
+    float cutoff_sq = respa_cutoff*respa_cutoff;
+    task_for(&task_pool, 0, num_points, force_grain, [&](int begin, int end) {
+        int neighbors[respa_max_neighbors];
+        for (int i = begin; i < end; i++) {
+            vec<D> lo = points[i].position, hi = points[i].position;
+            for (int d = 0; d < D; d++) {
+                lo[d] -= respa_cutoff;
+                hi[d] += respa_cutoff;
+            }
+            vec<D> near = vec_zero<D>();
+            int found = quadtree_query(tree, points, &particle_index, lo, hi, neighbors, respa_max_neighbors);
+            // A crowded neighborhood overflows the buffer; scan everything.
+            int scan_all = found > respa_max_neighbors;
+            int count = scan_all ? num_points : found;
+            for (int n = 0; n < count; n++) {
+                int k = scan_all ? n : neighbors[n];
+                if (k != i && points[k].mass >= passive_mass_threshold && dist_sq(points[i].position, points[k].position) < cutoff_sq) {
+                    near += pair_force(points[i], points[k]);
+                }
+            }
+            points[i].force += near;
+            if (!refresh) {
+                continue;
+            }
+            vec<D> far = vec_zero<D>();
+            if (force_mode == BARNES_HUT) {
+                far = quadtree_field(tree, points, &particle_index, i, opening_angle) * (gravitational_constant*points[i].mass) - near;
+            } else {
+                for (int k = 0; k < num_points; k++) {
+                    if (k != i && points[k].mass >= passive_mass_threshold && dist_sq(points[i].position, points[k].position) >= cutoff_sq) {
+                        far += pair_force(points[i], points[k]);
+                    }
+                }
+            }
+            points[i].force += far * (float) respa_interval;
+        }
+    });
+}
+
+// Acceleration and jerk on every body in one pairwise pass over the bodies
+// that source gravity. Tree moments carry no velocities, so the Hermite
+// integrator always uses this direct sum.
+template <int D>
+void acceleration_jerk(const particle<D>* points, int num_points, vec<D>* acceleration, vec<D>* jerk) {
+    force_evaluations++;
+    int num_active;
+    int* active = active_set(points, num_points, &num_active);
+    task_for(&task_pool, 0, num_points, force_grain, [&](int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            vec<D> a = vec_zero<D>();
+            vec<D> j = vec_zero<D>();
+            for (int n = 0; n < num_active; n++) {
+                int k = active[n];
+                if (k != i) {
+                    vec<D> delta = points[k].position - points[i].position;
+                    vec<D> relative_velocity = points[k].velocity - points[i].velocity;
+                    float distance_sq = dot(delta, delta);
+                    float inv_cube = gravitational_constant*points[k].mass/(distance_sq*sqrtf(distance_sq));
+                    float rate = 3.0f*dot(delta, relative_velocity)/distance_sq;
+                    a += delta * inv_cube;
+                    j += (relative_velocity - delta*rate) * inv_cube;
+                }
+            }
+            acceleration[i] = a;
+            jerk[i] = j;
+        }
+    });
+}
+
+// One Hermite step of the current shared step length, which the corrector
+// then updates from the Aarseth criterion (at most doubling per step).
+// Merges leave the stored derivatives stale, so they force a fresh
+// evaluation at the start of the next step.
+template <int D>
+void hermite_integrate(particle<D>* points, int* num_points, quadtree<D>* tree) {
+    int n = *num_points;
+    vec<D>* acceleration = (vec<D>*) arena_alloc(&step_arena, n*sizeof(vec<D>));
+    vec<D>* jerk = (vec<D>*) arena_alloc(&step_arena, n*sizeof(vec<D>));
+    vec<D>* old_position = (vec<D>*) arena_alloc(&step_arena, n*sizeof(vec<D>));
+    vec<D>* old_velocity = (vec<D>*) arena_alloc(&step_arena, n*sizeof(vec<D>));
+
+    double start = wall_time();
+    if (hermite_cached_step != step_count - 1) {
+        acceleration_jerk(points, n, acceleration, jerk);
+        for (int i = 0; i < n; i++) {
+            points[i].acceleration = acceleration[i];
+            points[i].jerk = jerk[i];
+        }
+        if (hermite_step == 0.0f) {
+            hermite_step = fminf(hermite_initial_step(points, n, hermite_eta), hermite_max_step);
+        }
+    }
+    float dt = hermite_step;
+    double evaluated = wall_time();
+    hermite_predict(points, n, dt, old_position, old_velocity);
+    double predicted = wall_time();
+    acceleration_jerk(points, n, acceleration, jerk);
+    double forced = wall_time();
+    float next_step = hermite_correct(points, n, dt, old_position, old_velocity, acceleration, jerk, hermite_eta);
+    hermite_step = fminf(fminf(next_step, 2.0f*dt), hermite_max_step);
+    simulated_time += dt;
+    double corrected = wall_time();
+
+    collision_step = swept_collisions ? dt : 0.0f;
+    resolve_collisions(points, num_points, tree);
+    hermite_cached_step = *num_points == n ? step_count : -2;
+
+    step_timings.force += (evaluated - start) + (forced - predicted) + (wall_time() - corrected);
+    step_timings.integrate += (predicted - evaluated) + (corrected - forced);
+}
+
+// One Wisdom-Holman step of wh_time_step. Collisions are resolved in the
+// democratic frame, where the central body sits at the origin and all
+// velocities share one offset, so merges conserve momentum there as well.
+template <int D>
+void wisdom_holman_step(particle<D>* points, int* num_points, quadtree<D>* tree) {
+    float dt = wh_time_step;
+    int central = wh_central(points, *num_points);
+    uint64_t central_id = points[central].id;
+    wh_frame<D> frame;
+    wh_to_democratic(points, *num_points, central, &frame);
+
+    double start = wall_time();
+    if (wh_cached_step != step_count - 1) {
+        interaction_accelerations(points, *num_points, central, tree);
+    }
+    double kicked = wall_time();
+    wh_kick(points, *num_points, central, 0.5f*dt);
+    wh_jump(points, *num_points, central, 0.5f*dt);
+    wh_drift(points, *num_points, central, (double) gravitational_constant*points[central].mass, dt);
+    wh_jump(points, *num_points, central, 0.5f*dt);
+    frame.com_position += frame.com_velocity * dt;
+    simulated_time += dt;
+    double drifted = wall_time();
+
+    wh_sync_central(points, *num_points, central);
+    collision_step = swept_collisions ? dt : 0.0f;
+    resolve_collisions(points, num_points, tree);
+    central = particle_index_slot(&particle_index, central_id);
+    if (central < 0) {
+        central = wh_central(points, *num_points);
+    }
+    interaction_accelerations(points, *num_points, central, tree);
+    double forced = wall_time();
+    wh_kick(points, *num_points, central, 0.5f*dt);
+    wh_from_democratic(points, *num_points, central, frame);
+    wh_cached_step = step_count;
+
+    step_timings.force += (kicked - start) + (forced - drifted);
+    step_timings.integrate += (drifted - kicked) + (wall_time() - forced);
+}
+
+// Tree walks gain from neighbors sharing cache lines. Direct sums stream
+// over every body whatever the order, and dominate their step even with a
+// grid or Verlet broad phase, so they are left unsorted.
+static int reorder_helps() {
+    return force_mode != DIRECT_SUM || respa_interval > 1;
+}
+
+template <int D>
+void iterate(particle<D>* points, int* num_points, quadtree<D>* tree) {
+    if (autotune && autotune_due(*num_points)) {
+        autotune_run(points, *num_points, tree);
+    }
+    arena_reset(&step_arena);
+    if (reorder_interval > 0 && step_count % reorder_interval == 0 && reorder_helps()) {
+        morton_reorder(points, *num_points, &step_arena);
+        particle_index_rebuild(&particle_index, points, *num_points);
+    }
+    if (escape_radius > 0.0f && escape_retire(points, num_points, &particle_index, &escapes, gravitational_constant, escape_radius, step_count, simulated_time) > 0) {
+        wh_cached_step = -2;
+        hermite_cached_step = -2;
+    }
+    step_count++;
+    tree->min_source_mass = passive_mass_threshold;
+    bvh.min_source_mass = passive_mass_threshold;
+    // These integrators check collisions inside their step, so the boundary
+    // pass after it marks the bodies the next step's checks only overlap-test.
+    if (integrator == WISDOM_HOLMAN) {
+        wisdom_holman_step(points, num_points, tree);
+        if (collision_mode != NO_BORDER) {
+            boundary_pass_for_mode(collision_mode, points, *num_points, hash32((uint32_t) step_count));
+            wh_cached_step = -2;
+        }
+        return;
+    }
+    if (integrator == HERMITE) {
+        hermite_integrate(points, num_points, tree);
+        if (collision_mode != NO_BORDER) {
+            boundary_pass_for_mode(collision_mode, points, *num_points, hash32((uint32_t) step_count));
+            hermite_cached_step = -2;
+        }
+        return;
+    }
+    force_evaluations++;
+    simulated_time += 1.0;
+    // Collisions are checked before this step's integration, so they sweep
+    // back over the previous unit step.
+    collision_step = swept_collisions && step_count > 1 ? 1.0f : 0.0f;
+    double start = wall_time();
+    if (respa_interval > 1) {
+        quadtree_update(tree, points, *num_points, &particle_index);
+        double built = wall_time();
+        step_timings.tree += built - start;
+        start = built;
+        respa_forces(points, *num_points, tree, (step_count - 1) % respa_interval == 0);
+        broad_phase_collisions(points, num_points, tree);
+    } else if (force_mode == BARNES_HUT) {
+        quadtree_update(tree, points, *num_points, &particle_index);
+        double built = wall_time();
+        step_timings.tree += built - start;
+        start = built;
+        tree_forces(points, *num_points, tree);
+        broad_phase_collisions(points, num_points, tree);
+    } else if (force_mode == LINEAR_BVH) {
+        lbvh_build(&bvh, points, *num_points, &step_arena);
+        double built = wall_time();
+        step_timings.tree += built - start;
+        start = built;
+        bvh_forces(points, *num_points, &bvh);
+        // The hierarchy keeps no per-id state to query, so without another
+        // broad phase collisions come from the grid.
+        if (broad_phase == TREE_OR_ALL_PAIRS) {
+            grid_collisions(points, num_points);
+        } else {
+            broad_phase_collisions(points, num_points, tree);
+        }
+    } else if (passive_mass_threshold > 0.0f || broad_phase != TREE_OR_ALL_PAIRS) {
+        int num_active;
+        int* active = active_set(points, *num_points, &num_active);
+        task_for(&task_pool, 0, *num_points, force_grain, [&](int begin, int end) {
+            for (int i = begin; i < end; i++) {
+                for (int a = 0; a < num_active; a++) {
+                    if (active[a] != i) {
+                        set_force(&points[i], &points[active[a]]);
+                    }
+                }
+            }
+        });
+        resolve_collisions(points, num_points, tree);
+    } else {
+        for (int i = 0; i < *num_points; i++) {
+            for (int k = 0; k < *num_points; k++) {
+                if (i != k) {
+                    set_force(&points[i], &points[k]);
+                    check_collision(points, num_points, i, k);
+                }
+            }
+        }
+    }
+    double forced = wall_time();
+    step_timings.force += forced - start;
+    integrate_pass_for_mode(collision_mode, points, *num_points, hash32((uint32_t) step_count));
+    step_timings.integrate += wall_time() - forced;
+}
+
+// Velocity of magnitude vel pointing at angle in the x-y plane.
+template <int D>
+particle<D> p_init(float mass, vec<D> position, float vel, float angle) {
+    float radius = radius_for_mass(mass);
+    vec<D> velocity = vec_zero<D>();
+    velocity[0] = vel*cosf(angle);
+    velocity[1] = vel*sinf(angle);
+    particle<D> p = {radius, mass, position, velocity, vec_zero<D>(), vec_zero<D>(), vec_zero<D>(), 0, -1};
+    return p;
+}
+
+// Draw k of a body's random stream. Every body hashes its own stream from
+// the seed and its index instead of calling rand(), so bodies are generated
+// in parallel and the result depends on the seed alone, not on the split.
+inline float gen_uniform(uint32_t stream, int k) {
+    return hash_uniform(stream + (uint32_t) k*0x9e3779b9u);
+}
+
+// Uniform direction on the unit sphere, or circle in 2D.
+template <int D>
+vec<D> gen_direction(uint32_t stream, int* k) {
+    vec<D> direction = vec_zero<D>();
+    float phi = 2.0f*pi*gen_uniform(stream, (*k)++);
+    float z = D > 2 ? 2.0f*gen_uniform(stream, (*k)++) - 1.0f : 0.0f;
+    float ring = sqrtf(1.0f - z*z);
+    direction[0] = ring*cosf(phi);
+    direction[1] = ring*sinf(phi);
+    for (int d = 2; d < D; d++) {
+        direction[d] = d == 2 ? z : 0.0f;
+    }
+    return direction;
+}
+
+// Body on a circular orbit in the x-y plane around a mass at center, at
+// radius r and angle theta, with a small vertical spread in 3D.
+template <int D>
+particle<D> gen_orbiting(float mass, const particle<D>& center, float r, float theta, float speed, uint32_t stream, int* k) {
+    vec<D> position = center.position;
+    position[0] += r*cosf(theta);
+    position[1] += r*sinf(theta);
+    for (int d = 2; d < D; d++) {
+        position[d] += (2.0f*gen_uniform(stream, (*k)++) - 1.0f)*belt_thickness;
+    }
+    particle<D> p = p_init(mass, position, speed, theta + pi/2);
+    p.velocity += center.velocity;
+    return p;
+}
+
+// Central body of the belt generators: ten times the mass of everything
+// orbiting it.
+template <int D>
+particle<D> gen_central(float orbiting_mass, vec<D> position) {
+    return p_init(orbiting_mass*10.0f, position, 0.0f, 0.0f);
+}
+
+// Plummer sphere of scale radius plummer_radius in virial equilibrium, by
+// Aarseth, Henon and Wielen's recipe: radii from the inverse cumulative mass,
+// speeds by rejection from the isotropic distribution function. In 2D, the
+// sphere's projection onto the x-y plane.
+template <int D>
+particle<D> gen_plummer(float mass, float total_mass, uint32_t stream) {
+    const float plummer_radius = 0.5f;
+    int k = 0;
+    float r;
+    do {
+        float u = gen_uniform(stream, k++);
+        // u^(-2/3) - 1, from a cube root rather than powf.
+        float c = cbrtf(fmaxf(u, 1e-7f));
+        r = plummer_radius*c/sqrtf(1.0f - c*c);
+    } while (r > 10.0f*plummer_radius);
+    float q;
+    for (;;) {
+        q = gen_uniform(stream, k++);
+        float g = 0.1f*gen_uniform(stream, k++);
+        float s = 1.0f - q*q;
+        if (g <= q*q*s*s*s*sqrtf(s)) {
+            break;
+        }
+    }
+    float escape_speed = sqrtf(2.0f*gravitational_constant*total_mass/plummer_radius)
+        /sqrtf(sqrtf(1.0f + r*r/(plummer_radius*plummer_radius)));
+    vec<3> position = gen_direction<3>(stream, &k)*r;
+    vec<3> velocity = gen_direction<3>(stream, &k)*(q*escape_speed);
+    particle<D> p = p_init(mass, vec_zero<D>(), 0.0f, 0.0f);
+    for (int d = 0; d < D && d < 3; d++) {
+        p.position[d] = position[d];
+        p.velocity[d] = velocity[d];
+    }
+    return p;
+}
+
+// Cold disc around a central body with surface density falling off as
+// exp(-R/disk_scale), cut off inside disk_inner. Speeds are circular for the
+// central mass plus the disc mass inside each radius.
+template <int D>
+particle<D> gen_exponential_disk(float mass, float disk_mass, const particle<D>& center, uint32_t stream) {
+    const float disk_scale = 0.8f;
+    const float disk_inner = 0.3f;
+    int k = 0;
+    float r;
+    do {
+        // R*exp(-R/scale) per unit radius is a gamma distribution of shape 2.
+        float u = 1.0f - gen_uniform(stream, k++);
+        r = -disk_scale*logf(u*(1.0f - gen_uniform(stream, k++)));
+    } while (r < disk_inner);
+    float x = r/disk_scale;
+    float enclosed = disk_mass*(1.0f - (1.0f + x)*expf(-x));
+    float speed = sqrtf(gravitational_constant*(center.mass + enclosed)/r);
+    return gen_orbiting(mass, center, r, 2.0f*pi*gen_uniform(stream, k++), speed, stream, &k);
+}
+
+// Self-gravitating cold disc of uniform surface density and radius
+// disc_radius, rotating at the circular speed of the mass inside each radius.
+template <int D>
+particle<D> gen_uniform_disc(float mass, float total_mass, uint32_t stream) {
+    const float disc_radius = 1.0f;
+    int k = 0;
+    float r = disc_radius*sqrtf(gen_uniform(stream, k++));
+    float speed = sqrtf(gravitational_constant*total_mass*r)/disc_radius;
+    particle<D> center = p_init(0.0f, vec_zero<D>(), 0.0f, 0.0f);
+    particle<D> p = gen_orbiting(mass, center, r, 2.0f*pi*gen_uniform(stream, k++), speed, stream, &k);
+    return p;
+}
+
+template <int D>
+particle<D> gen_body(int i, int num_points, uint32_t seed) {
+    const float initial_mass = 0.005f;
+    uint32_t stream = hash32(seed ^ hash32((uint32_t) i));
+    int k = 0;
+    vec<D> position = vec_zero<D>();
+    for (int d = 0; d < D && pointgen_mode <= OUTWARDS_VELOCITIES; d++) {
+        position[d] = 2.0f*gen_uniform(stream, k++) - 1.0f;
+    }
+    if (pointgen_mode == RANDOM_STILL) {
+        return p_init(initial_mass, position, 0.0f, 0.0f);
+    } else if (pointgen_mode == RANDOM_VELOCITIES) {
+        float vel = 0.001f*(int) (10.0f*gen_uniform(stream, k++));
+        float angle = (int) (360.0f*gen_uniform(stream, k++))*(pi/180);
+        return p_init(initial_mass, position, vel, angle);
+    } else if (pointgen_mode == OUTWARDS_VELOCITIES) {
+        float vel = 0.001;
+        particle<D> p = p_init(initial_mass, position, 0.0f, 0.0f);
+        float len = magnitude(position);
+        if (len > 0.0f) {
+            p.velocity = position * (vel/len);
+        }
+        return p;
+    } else if (pointgen_mode == ASTEROID_BELT) {
+        particle<D> center = gen_central(initial_mass*num_points, vec_zero<D>());
+        if (i == 0) {
+            return center;
+        }
+        float min_asteroid_radius = 1.7f;
+        float max_asteroid_radius = 2.9f;
+        float r = min_asteroid_radius + (max_asteroid_radius - min_asteroid_radius)*gen_uniform(stream, k++);
+        float speed = sqrtf(gravitational_constant*center.mass/(r - center.radius))*1.1f;
+        return gen_orbiting(initial_mass, center, r, 2.0f*pi*gen_uniform(stream, k++), speed, stream, &k);
+    } else if (pointgen_mode == PLUMMER_SPHERE) {
+        return gen_plummer<D>(initial_mass, initial_mass*num_points, stream);
+    } else if (pointgen_mode == EXPONENTIAL_DISK) {
+        particle<D> center = gen_central(initial_mass*num_points, vec_zero<D>());
+        if (i == 0) {
+            return center;
+        }
+        return gen_exponential_disk(initial_mass, initial_mass*num_points, center, stream);
+    } else if (pointgen_mode == UNIFORM_DISC) {
+        return gen_uniform_disc<D>(initial_mass, initial_mass*num_points, stream);
+    } else {
+        // MULTI_BELT: bodies 0..num_belts-1 are the central bodies, spread on
+        // a circle, and the rest are dealt round-robin into their belts.
+        const int num_belts = 3;
+        const float belt_spacing = 4.0f;
+        int belt = i % num_belts;
+        float phase = 2.0f*pi*belt/num_belts;
+        vec<D> center_position = vec_zero<D>();
+        center_position[0] = belt_spacing*cosf(phase);
+        center_position[1] = belt_spacing*sinf(phase);
+        particle<D> center = gen_central(initial_mass*num_points/num_belts, center_position);
+        if (i < num_belts) {
+            return center;
+        }
+        float r = 0.8f + 0.6f*gen_uniform(stream, k++);
+        float speed = sqrtf(gravitational_constant*center.mass/r);
+        return gen_orbiting(initial_mass, center, r, 2.0f*pi*gen_uniform(stream, k++), speed, stream, &k);
+    }
+}
+
+// The seed comes from rand(), so srand() still picks the initial conditions.
+template <int D>
+void gen_points(int num_points, particle<D>* points) {
+    uint32_t seed = (uint32_t) rand();
+    task_for(&task_pool, 0, num_points, stream_grain, [&](int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            points[i] = gen_body<D>(i, num_points, seed);
+            points[i].id = i;
+        }
+    });
+}
+
+template <int D>
+double total_energy(const particle<D>* points, int num_points) {
+    double energy = 0.0;
+    for (int i = 0; i < num_points; i++) {
+        energy += 0.5*points[i].mass*dot(points[i].velocity, points[i].velocity);
+        for (int k = i+1; k < num_points; k++) {
+            float distance = dist(points[i].position, points[k].position);
+            if (distance > 0.0f) {
+                energy -= (double) gravitational_constant*points[i].mass*points[k].mass/distance;
+            }
+        }
+    }
+    return energy;
+}
+
+void simulation_save(struct SimulationState* state) {
+    state->damping_factor = damping_factor;
+    state->collision_mode = collision_mode;
+    state->pointgen_mode = pointgen_mode;
+    state->force_mode = force_mode;
+    state->integrator = integrator;
+    state->opening_angle = opening_angle;
+    state->passive_mass_threshold = passive_mass_threshold;
+    state->respa_interval = respa_interval;
+    state->respa_cutoff = respa_cutoff;
+    state->swept_collisions = swept_collisions;
+    state->collision_step = collision_step;
+    state->broad_phase = broad_phase;
+    state->escape_radius = escape_radius;
+    state->wh_time_step = wh_time_step;
+    state->hermite_step = hermite_step;
+    state->reorder_interval = reorder_interval;
+    state->autotune = autotune;
+    state->autotune_error_budget = autotune_error_budget;
+    state->autotune_drop = autotune_drop;
+    state->rad_mass_factor = rad_mass_factor;
+    state->step_count = step_count;
+    state->particle_index = particle_index;
+    state->tree = tree;
+    state->bvh = bvh;
+    state->sweep = sweep;
+    state->neighbor_lists = neighbor_lists;
+    state->escapes = escapes;
+    state->wh_cached_step = wh_cached_step;
+    state->hermite_cached_step = hermite_cached_step;
+    state->simulated_time = simulated_time;
+    state->force_evaluations = force_evaluations;
+    state->autotune_count = autotune_count;
+    state->step_timings = step_timings;
+}
+
+void simulation_load(const struct SimulationState* state) {
+    damping_factor = state->damping_factor;
+    collision_mode = state->collision_mode;
+    pointgen_mode = state->pointgen_mode;
+    force_mode = state->force_mode;
+    integrator = state->integrator;
+    opening_angle = state->opening_angle;
+    passive_mass_threshold = state->passive_mass_threshold;
+    respa_interval = state->respa_interval;
+    respa_cutoff = state->respa_cutoff;
+    swept_collisions = state->swept_collisions;
+    collision_step = state->collision_step;
+    broad_phase = state->broad_phase;
+    escape_radius = state->escape_radius;
+    wh_time_step = state->wh_time_step;
+    hermite_step = state->hermite_step;
+    reorder_interval = state->reorder_interval;
+    autotune = state->autotune;
+    autotune_error_budget = state->autotune_error_budget;
+    autotune_drop = state->autotune_drop;
+    rad_mass_factor = state->rad_mass_factor;
+    step_count = state->step_count;
+    particle_index = state->particle_index;
+    tree = state->tree;
+    bvh = state->bvh;
+    sweep = state->sweep;
+    neighbor_lists = state->neighbor_lists;
+    escapes = state->escapes;
+    wh_cached_step = state->wh_cached_step;
+    hermite_cached_step = state->hermite_cached_step;
+    simulated_time = state->simulated_time;
+    force_evaluations = state->force_evaluations;
+    autotune_count = state->autotune_count;
+    step_timings = state->step_timings;
+}
+
+Particle* alloc_points(int num_points) {
+    const size_t huge_page = 1 << 21;
+    size_t bytes = sizeof(Particle)*(num_points + 1);
+    if (bytes < 4*huge_page) {
+        return (Particle*) malloc(bytes);
+    }
+    bytes = (bytes + huge_page - 1) & ~(huge_page - 1);
+    Particle* points = (Particle*) aligned_alloc(huge_page, bytes);
+    if (points != NULL) {
+        madvise(points, bytes, MADV_HUGEPAGE);
+    }
+    return points;
+}
+
+void simulation_reset(int num_points) {
+    particle_index_init(&particle_index, num_points);
+    quadtree_init(&tree);
+    lbvh_init(&bvh);
+    sweep_prune_init(&sweep);
+    verlet_list_init(&neighbor_lists, verlet_skin);
+    escape_list_init(&escapes);
+    step_count = 0;
+    wh_cached_step = -2;
+    hermite_cached_step = -2;
+    hermite_step = 0.0f;
+    collision_step = 0.0f;
+    simulated_time = 0.0;
+    force_evaluations = 0;
+    autotune_count = 0;
+    memset(&step_timings, 0, sizeof(step_timings));
+}
+
+void simulation_release() {
+    particle_index_free(&particle_index);
+    quadtree_free(&tree);
+    lbvh_free(&bvh);
+    sweep_prune_free(&sweep);
+    verlet_list_free(&neighbor_lists);
+    escape_list_free(&escapes);
+}
+
+void simulation_runtime_acquire() {
+    if (runtime_users++ == 0) {
+        arena_init(&step_arena, 1 << 20);
+        task_pool_init(&task_pool, task_pool_workers);
+    }
+}
+
+void simulation_runtime_release() {
+    if (--runtime_users == 0) {
+        task_pool_free(&task_pool);
+        arena_free(&step_arena);
+    }
+}
+
+template void print_particle<dimensions>(const particle<dimensions>& p);
+template float get_angle<dimensions>(const vec<dimensions>& p1, const vec<dimensions>& p2);
+template void integrate_pass<NO_BORDER, dimensions>(particle<dimensions>* points, int num_points, uint32_t seed);
+template void integrate_pass<SQUARE, dimensions>(particle<dimensions>* points, int num_points, uint32_t seed);
+template void integrate_pass<CIRCLE, dimensions>(particle<dimensions>* points, int num_points, uint32_t seed);
+template void integrate_pass<TELEPORT_CENTER, dimensions>(particle<dimensions>* points, int num_points, uint32_t seed);
+template void integrate_pass<TELEPORT_RANDOM, dimensions>(particle<dimensions>* points, int num_points, uint32_t seed);
+template void iterate<dimensions>(particle<dimensions>* points, int* num_points, quadtree<dimensions>* tree);
+template particle<dimensions> p_init<dimensions>(float mass, vec<dimensions> position, float vel, float angle);
+template void gen_points<dimensions>(int num_points, particle<dimensions>* points);
+template double total_energy<dimensions>(const particle<dimensions>* points, int num_points);
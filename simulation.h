@@ -0,0 +1,255 @@
+#ifndef SIMULATION_H
+#define SIMULATION_H
+
+#include <stdint.h>
+
+#include "arena.h"
+#include "broadphase.h"
+#include "escape.h"
+#include "lbvh.h"
+#include "particle.h"
+#include "particle_index.h"
+#include "physics.h"
+#include "quadtree.h"
+#include "taskpool.h"
+
+// The simulation core: configuration, the state carried across steps and
+// iterate(), which advances the live particle array by one step. It keeps
+// one simulation's state in globals; gsim.h wraps it in handles, and the
+// viewer, benchmarks and sweeps in main.c drive it through either.
+
+// Number of spatial dimensions the simulation runs in (2 or 3).
+const int dimensions = 2;
+typedef particle<dimensions> Particle;
+
+enum collision_modes {
+    NO_BORDER = 1,
+    SQUARE = 2,
+    CIRCLE = 3,
+    TELEPORT_CENTER = 4,
+    TELEPORT_RANDOM = 5
+};
+
+enum pointgen_modes {
+    RANDOM_STILL = 1,
+    RANDOM_VELOCITIES = 2,
+    OUTWARDS_VELOCITIES = 3,
+    ASTEROID_BELT = 4,
+    PLUMMER_SPHERE = 5,
+    EXPONENTIAL_DISK = 6,
+    UNIFORM_DISC = 7,
+    MULTI_BELT = 8
+};
+
+enum force_modes {
+    DIRECT_SUM = 1,
+    BARNES_HUT = 2,
+    LINEAR_BVH = 3
+};
+
+enum integrators {
+    EULER = 1,
+    WISDOM_HOLMAN = 2,
+    HERMITE = 3
+};
+
+// Where collision candidates come from. TREE_OR_ALL_PAIRS queries the
+// Barnes-Hut tree when one is maintained and tests all pairs otherwise.
+enum broad_phases {
+    TREE_OR_ALL_PAIRS = 1,
+    SWEEP_AND_PRUNE = 2,
+    UNIFORM_GRID = 3,
+    VERLET_LIST = 4
+};
+
+const int disable_merging = 0;
+// Near neighbors gathered per body before falling back to a full scan.
+const int respa_max_neighbors = 256;
+// Extra distance kept in the VERLET_LIST neighbor lists; larger skins mean
+// longer lists but fewer rebuilds.
+const float verlet_skin = 0.02f;
+// Hermite accuracy parameter (Aarseth's eta) and the cap on its shared step,
+// in units of one Euler step.
+const float hermite_eta = 0.01f;
+const float hermite_max_step = 50.0f;
+const float belt_thickness = 0.05f;
+// Force loops are split down to force_grain bodies, since the cost per body
+// varies widely; streaming passes only to stream_grain.
+const int force_grain = 64;
+const int stream_grain = 4096;
+
+// Configuration, read by every step.
+extern float damping_factor;
+extern int collision_mode;
+extern int pointgen_mode;
+extern int force_mode;
+extern int integrator;
+// Opening angle of both tree force modes: cells smaller than this times their
+// distance are treated as a single mass.
+extern float opening_angle;
+// Test-particle mode: bodies lighter than this are passive. They feel the
+// active bodies' gravity but source none, so a force pass costs O(N*M) for M
+// active bodies. 0 makes every body active.
+extern float passive_mass_threshold;
+// Multiple timestepping for the Euler integrator (r-RESPA): pairs closer than
+// respa_cutoff are summed every step, while the far field from everything
+// else is refreshed every respa_interval steps and applied as one impulse of
+// that many steps. 1 disables the split.
+extern int respa_interval;
+extern float respa_cutoff;
+// Collision checks sweep each pair back along straight lines over the motion
+// of the last step, so fast bodies cannot pass through each other between
+// checks. collision_step is the length of that step, set by each integrator;
+// 0 reduces the sweep to an overlap test at the current positions.
+extern int swept_collisions;
+extern float collision_step;
+extern int broad_phase;
+// Distance from the barycenter beyond which unbound bodies are retired from
+// the simulation. Retiring changes the mass and momentum totals, so it is
+// off (0) unless a run asks for it.
+extern float escape_radius;
+// Wisdom-Holman step length, in units of one Euler step. Belt orbits take a
+// few thousand Euler steps, so this is still a small fraction of a period.
+extern float wh_time_step;
+// Current shared Hermite step; 0 until the first force evaluation sets it.
+extern float hermite_step;
+// Steps between Morton-order re-sorts of the particle array (0 disables).
+// Only the tree force modes and r-RESPA re-sort; direct sums gain nothing.
+extern int reorder_interval;
+// Auto-tuning (autotune.h): at the first step, and again whenever the body
+// count has dropped to autotune_drop of what it was at the last tuning, trial
+// steps pick the force mode, opening angle and broad phase that run fastest
+// with an RMS relative field error within autotune_error_budget.
+extern int autotune;
+extern float autotune_error_budget;
+extern float autotune_drop;
+
+// Scratch memory for buffers that only live for one iterate() call, and the
+// workers for every parallel loop of a step; task_pool_workers = 0 uses one
+// per CPU. Both are shared by every simulation in the process.
+extern struct Arena step_arena;
+extern int task_pool_workers;
+extern struct TaskPool task_pool;
+
+// State carried across steps.
+extern long step_count;
+// ID-to-slot map and merge history for the live particle array.
+extern struct ParticleIndex particle_index;
+// Spatial tree kept across steps for the BARNES_HUT force mode.
+extern quadtree<dimensions> tree;
+// Hierarchy rebuilt every force pass for the LINEAR_BVH force mode.
+extern lbvh<dimensions> bvh;
+// Sorted x-extents kept across steps for the SWEEP_AND_PRUNE broad phase.
+extern sweep_prune<dimensions> sweep;
+// Neighbor lists kept across steps for the VERLET_LIST broad phase.
+extern verlet_list<dimensions> neighbor_lists;
+// Bodies retired by escape_retire(), in the order they left.
+extern escape_list<dimensions> escapes;
+// Step whose closing kick left valid interaction accelerations behind; the
+// next Wisdom-Holman step reuses them for its opening kick.
+extern long wh_cached_step;
+// Same for the Hermite integrator's acceleration and jerk.
+extern long hermite_cached_step;
+// Simulated time so far, and how many force passes it took; integrators with
+// different step lengths are compared on these.
+extern double simulated_time;
+extern long force_evaluations;
+// Body count at the last tuning; 0 until the first.
+extern int autotune_count;
+
+// Seconds spent in each phase of iterate(), accumulated across steps.
+// The force phase includes collision checks, which share its pair loops.
+struct StepTimings {
+    double tree;
+    double force;
+    double integrate;
+};
+extern struct StepTimings step_timings;
+
+// Every global above that belongs to one simulation rather than the process,
+// so several simulations can take turns on the core.
+struct SimulationState {
+    float damping_factor;
+    int collision_mode;
+    int pointgen_mode;
+    int force_mode;
+    int integrator;
+    float opening_angle;
+    float passive_mass_threshold;
+    int respa_interval;
+    float respa_cutoff;
+    int swept_collisions;
+    float collision_step;
+    int broad_phase;
+    float escape_radius;
+    float wh_time_step;
+    float hermite_step;
+    int reorder_interval;
+    int autotune;
+    float autotune_error_budget;
+    float autotune_drop;
+    int rad_mass_factor;
+    long step_count;
+    struct ParticleIndex particle_index;
+    quadtree<dimensions> tree;
+    lbvh<dimensions> bvh;
+    sweep_prune<dimensions> sweep;
+    verlet_list<dimensions> neighbor_lists;
+    escape_list<dimensions> escapes;
+    long wh_cached_step;
+    long hermite_cached_step;
+    double simulated_time;
+    long force_evaluations;
+    int autotune_count;
+    struct StepTimings step_timings;
+};
+
+void simulation_save(struct SimulationState* state);
+void simulation_load(const struct SimulationState* state);
+// Fresh per-run state for num_points bodies with ids 0..num_points-1, and its
+// release; the configuration is left alone.
+void simulation_reset(int num_points);
+void simulation_release();
+// Reference-counted setup of the step arena and task pool.
+void simulation_runtime_acquire();
+void simulation_runtime_release();
+
+double wall_time();
+// Body array for num_points, released with free(). Large arrays ask for
+// transparent huge pages, so first touching millions of bodies takes far
+// fewer page faults.
+Particle* alloc_points(int num_points);
+
+// Randomness for per-particle kernels, from hashing a key rather than rand(),
+// which would serialize the loops.
+inline uint32_t hash32(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+// Uniform in [0, 1), from the top 24 bits of the hash. These fit a signed
+// int, whose conversion to float has a vector instruction.
+inline float hash_uniform(uint32_t key) {
+    return (int) (hash32(key) >> 8) * (1.0f/16777216.0f);
+}
+
+template <int D>
+void print_particle(const particle<D>& p);
+template <int D>
+float get_angle(const vec<D>& p1, const vec<D>& p2);
+template <int Mode, int D>
+void integrate_pass(particle<D>* points, int num_points, uint32_t seed);
+template <int D>
+void iterate(particle<D>* points, int* num_points, quadtree<D>* tree);
+template <int D>
+particle<D> p_init(float mass, vec<D> position, float vel, float angle);
+template <int D>
+void gen_points(int num_points, particle<D>* points);
+template <int D>
+double total_energy(const particle<D>* points, int num_points);
+
+#endif
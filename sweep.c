@@ -0,0 +1,272 @@
+#include "sweep.h"
+
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+void sweep_init(struct Sweep* sweep, int workers) {
+    memset(sweep, 0, sizeof(*sweep));
+    sweep->workers = workers > 0 ? workers : (int) sysconf(_SC_NPROCESSORS_ONLN);
+}
+
+int sweep_add(struct Sweep* sweep, const char* spec) {
+    const char* equals = strchr(spec, '=');
+    if (equals == NULL || equals == spec || equals - spec >= 32 || sweep->num_parameters == sweep_max_parameters) {
+        return -1;
+    }
+    struct SweepParameter* p = &sweep->parameters[sweep->num_parameters];
+    memcpy(p->name, spec, equals - spec);
+    p->name[equals - spec] = '\0';
+    p->num_values = 0;
+    const char* cursor = equals + 1;
+    while (*cursor != '\0') {
+        char* end;
+        double value = strtod(cursor, &end);
+        if (end == cursor || (*end != ',' && *end != '\0') || p->num_values == sweep_max_values) {
+            return -1;
+        }
+        p->values[p->num_values++] = value;
+        cursor = *end == ',' ? end + 1 : end;
+    }
+    if (p->num_values == 0) {
+        return -1;
+    }
+    sweep->num_parameters++;
+    return 0;
+}
+
+long sweep_size(const struct Sweep* sweep) {
+    long size = 1;
+    for (int k = 0; k < sweep->num_parameters; k++) {
+        size *= sweep->parameters[k].num_values;
+    }
+    return size;
+}
+
+// The last parameter varies fastest.
+void sweep_point(const struct Sweep* sweep, long index, double* values) {
+    for (int k = sweep->num_parameters - 1; k >= 0; k--) {
+        const struct SweepParameter* p = &sweep->parameters[k];
+        values[k] = p->values[index % p->num_values];
+        index /= p->num_values;
+    }
+}
+
+// A point's key is its parameter columns exactly as written to the file.
+static int format_key(const struct Sweep* sweep, const double* values, char* key, size_t size) {
+    int length = 0;
+    for (int k = 0; k < sweep->num_parameters; k++) {
+        length += snprintf(key + length, size - length, "%s%.9g", k > 0 ? "," : "", values[k]);
+    }
+    return length;
+}
+
+static int compare_keys(const void* a, const void* b) {
+    return strcmp(*(char* const*) a, *(char* const*) b);
+}
+
+// Keys of the rows already in the file, sorted. A row cut short by a crash
+// has no newline; it is truncated away so the retried run can append cleanly.
+static char** read_finished(const struct Sweep* sweep, const char* path, const char* header, int* num_finished) {
+    *num_finished = 0;
+    FILE* file = fopen(path, "r+");
+    if (file == NULL) {
+        return NULL;
+    }
+    char expected[sweep_row_size];
+    int length = 0;
+    for (int k = 0; k < sweep->num_parameters; k++) {
+        length += snprintf(expected + length, sizeof(expected) - length, "%s,", sweep->parameters[k].name);
+    }
+    snprintf(expected + length, sizeof(expected) - length, "%s\n", header);
+
+    int capacity = 64;
+    char** keys = (char**) malloc(capacity*sizeof(char*));
+    char line[sweep_row_size];
+    long complete = 0;
+    int first = 1;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        size_t n = strlen(line);
+        if (n == 0 || line[n - 1] != '\n') {
+            break;
+        }
+        complete = ftell(file);
+        if (first) {
+            first = 0;
+            if (strcmp(line, expected) != 0) {
+                fprintf(stderr, "sweep: %s holds a different sweep\n", path);
+                fclose(file);
+                free(keys);
+                *num_finished = -1;
+                return NULL;
+            }
+            continue;
+        }
+        // Cut the row after the parameter columns.
+        char* cut = line;
+        for (int k = 0; k < sweep->num_parameters && cut != NULL; k++) {
+            cut = strchr(cut + (k > 0), ',');
+        }
+        if (cut == NULL) {
+            continue;
+        }
+        *cut = '\0';
+        if (*num_finished == capacity) {
+            capacity *= 2;
+            keys = (char**) realloc(keys, capacity*sizeof(char*));
+        }
+        keys[(*num_finished)++] = strdup(line);
+    }
+    if (ftruncate(fileno(file), complete) != 0) {
+        perror("sweep: truncate");
+    }
+    fclose(file);
+    qsort(keys, *num_finished, sizeof(char*), compare_keys);
+    return keys;
+}
+
+// Allowed CPUs of this process, so pinning respects taskset and cgroups.
+static int allowed_cpus(int* cpus, int max_cpus) {
+    cpu_set_t set;
+    int count = 0;
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (int c = 0; c < CPU_SETSIZE && count < max_cpus; c++) {
+            if (CPU_ISSET(c, &set)) {
+                cpus[count++] = c;
+            }
+        }
+    }
+    return count;
+}
+
+int sweep_run(struct Sweep* sweep, const char* path, const char* header, SweepRunFn run, void* context) {
+    int num_finished;
+    char** finished = read_finished(sweep, path, header, &num_finished);
+    if (num_finished < 0) {
+        return -1;
+    }
+    FILE* file = fopen(path, "a");
+    if (file == NULL) {
+        perror("sweep: open");
+        return -1;
+    }
+    if (ftell(file) == 0) {
+        for (int k = 0; k < sweep->num_parameters; k++) {
+            fprintf(file, "%s,", sweep->parameters[k].name);
+        }
+        fprintf(file, "%s\n", header);
+        fflush(file);
+    }
+
+    int cpus[CPU_SETSIZE];
+    int num_cpus = allowed_cpus(cpus, CPU_SETSIZE);
+    int workers = sweep->workers;
+    pid_t* pids = (pid_t*) calloc(workers, sizeof(pid_t));
+    int* pipes = (int*) malloc(workers*sizeof(int));
+    long* points = (long*) malloc(workers*sizeof(long));
+    long total = sweep_size(sweep);
+    long next = 0;
+    int running = 0;
+    double values[sweep_max_parameters];
+    char key[sweep_row_size];
+    sweep->skipped = sweep->completed = sweep->failed = 0;
+
+    while (next < total || running > 0) {
+        while (running < workers && next < total) {
+            long point = next++;
+            sweep_point(sweep, point, values);
+            format_key(sweep, values, key, sizeof(key));
+            char* lookup = key;
+            if (num_finished > 0 && bsearch(&lookup, finished, num_finished, sizeof(char*), compare_keys) != NULL) {
+                sweep->skipped++;
+                continue;
+            }
+            int slot = 0;
+            while (pids[slot] != 0) {
+                slot++;
+            }
+            int fds[2];
+            if (pipe(fds) != 0) {
+                perror("sweep: pipe");
+                next = total;
+                break;
+            }
+            fflush(stdout);
+            fflush(file);
+            pid_t pid = fork();
+            if (pid == 0) {
+                close(fds[0]);
+                if (num_cpus > 0) {
+                    cpu_set_t set;
+                    CPU_ZERO(&set);
+                    CPU_SET(cpus[slot % num_cpus], &set);
+                    sched_setaffinity(0, sizeof(set), &set);
+                }
+                char row[sweep_row_size];
+                row[0] = '\0';
+                int status = run(values, row, sizeof(row), context);
+                if (status == 0 && write(fds[1], row, strlen(row)) < 0) {
+                    status = 1;
+                }
+                _exit(status);
+            }
+            close(fds[1]);
+            if (pid < 0) {
+                perror("sweep: fork");
+                close(fds[0]);
+                next = total;
+                break;
+            }
+            pids[slot] = pid;
+            pipes[slot] = fds[0];
+            points[slot] = point;
+            running++;
+        }
+        if (running == 0) {
+            continue;
+        }
+
+        int status;
+        pid_t pid = waitpid(-1, &status, 0);
+        int slot = 0;
+        while (slot < workers && pids[slot] != pid) {
+            slot++;
+        }
+        if (slot == workers) {
+            continue;
+        }
+        // Rows are shorter than PIPE_BUF, so the child never blocked on the
+        // write and the whole row is in the pipe.
+        char row[sweep_row_size];
+        ssize_t length = read(pipes[slot], row, sizeof(row) - 1);
+        close(pipes[slot]);
+        pids[slot] = 0;
+        running--;
+        sweep_point(sweep, points[slot], values);
+        format_key(sweep, values, key, sizeof(key));
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 || length <= 0) {
+            fprintf(stderr, "sweep: point %s failed\n", key);
+            sweep->failed++;
+            continue;
+        }
+        row[length] = '\0';
+        fprintf(file, "%s,%s\n", key, row);
+        fflush(file);
+        fsync(fileno(file));
+        sweep->completed++;
+        printf("[%ld/%ld] %s,%s\n", sweep->skipped + sweep->completed + sweep->failed, total, key, row);
+    }
+
+    fclose(file);
+    for (int k = 0; k < num_finished; k++) {
+        free(finished[k]);
+    }
+    free(finished);
+    free(pids);
+    free(pipes);
+    free(points);
+    return 0;
+}
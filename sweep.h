@@ -0,0 +1,47 @@
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include <stddef.h>
+
+// Parameter sweeps over the full grid of a few named parameters, each run as
+// a forked headless process pinned to its own CPU. Every finished run appends
+// one row, its parameter values followed by the caller's summary, to a CSV
+// file; rerunning the same sweep on that file skips the points it already
+// holds, so an interrupted sweep resumes where it stopped.
+const int sweep_max_parameters = 8;
+const int sweep_max_values = 64;
+const int sweep_row_size = 512;
+
+struct SweepParameter {
+    char name[32];
+    double values[sweep_max_values];
+    int num_values;
+};
+
+struct Sweep {
+    struct SweepParameter parameters[sweep_max_parameters];
+    int num_parameters;
+    int workers;
+    // Counts from the last sweep_run().
+    long skipped;
+    long completed;
+    long failed;
+};
+
+// Runs one point in a child process and writes the summary columns, without
+// a newline, to row. A nonzero return marks the run as failed, so it has no
+// row and a resumed sweep retries it.
+typedef int (*SweepRunFn)(const double* values, char* row, size_t row_size, void* context);
+
+void sweep_init(struct Sweep* sweep, int workers);
+// Adds a parameter from "name=v1,v2,...". Returns 0, or -1 if the spec is
+// malformed or there are too many parameters or values.
+int sweep_add(struct Sweep* sweep, const char* spec);
+long sweep_size(const struct Sweep* sweep);
+// Parameter values of point index, in the order the parameters were added.
+void sweep_point(const struct Sweep* sweep, long index, double* values);
+// Runs every point missing from path. header names the summary columns.
+// Returns 0, or -1 if the file cannot be used.
+int sweep_run(struct Sweep* sweep, const char* path, const char* header, SweepRunFn run, void* context);
+
+#endif
@@ -0,0 +1,231 @@
+#include "taskpool.h"
+
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Index of the worker running on this thread, -1 outside the pool.
+static __thread int current_worker = -1;
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+static int deque_push(struct TaskDeque* deque, const struct Task* task) {
+    long b = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED);
+    long t = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+    if (b - t >= task_deque_capacity) {
+        return 0;
+    }
+    deque->tasks[b % task_deque_capacity] = *task;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&deque->bottom, b + 1, __ATOMIC_RELAXED);
+    return 1;
+}
+
+static int deque_pop(struct TaskDeque* deque, struct Task* task) {
+    long b = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED) - 1;
+    __atomic_store_n(&deque->bottom, b, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    long t = __atomic_load_n(&deque->top, __ATOMIC_RELAXED);
+    if (t > b) {
+        __atomic_store_n(&deque->bottom, b + 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+    *task = deque->tasks[b % task_deque_capacity];
+    int taken = 1;
+    if (t == b) {
+        // Last task: race any thief for it.
+        taken = __atomic_compare_exchange_n(&deque->top, &t, t + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+        __atomic_store_n(&deque->bottom, b + 1, __ATOMIC_RELAXED);
+    }
+    return taken;
+}
+
+static int deque_steal(struct TaskDeque* deque, struct Task* task) {
+    long t = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    long b = __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE);
+    if (t >= b) {
+        return 0;
+    }
+    *task = deque->tasks[t % task_deque_capacity];
+    return __atomic_compare_exchange_n(&deque->top, &t, t + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+}
+
+static int find_task(struct TaskPool* pool, struct TaskWorker* worker, struct Task* task) {
+    if (deque_pop(&worker->deque, task)) {
+        return 1;
+    }
+    int n = pool->num_workers;
+    if (n < 2) {
+        return 0;
+    }
+    worker->rng = worker->rng*1664525u + 1013904223u;
+    int first = (int) ((worker->rng >> 8) % (unsigned int) n);
+    for (int v = 0; v < n; v++) {
+        int victim = (first + v) % n;
+        if (victim != worker->index && deque_steal(&pool->workers[victim].deque, task)) {
+            worker->steals++;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void run_task(struct TaskPool* pool, struct TaskWorker* worker, struct Task task) {
+    while (task.end - task.begin > task.grain) {
+        struct Task upper = task;
+        upper.begin = task.begin + (task.end - task.begin)/2;
+        if (!deque_push(&worker->deque, &upper)) {
+            break;
+        }
+        task.end = upper.begin;
+    }
+    double start = now();
+    task.fn(task.context, task.begin, task.end);
+    worker->busy += now() - start;
+    worker->tasks++;
+    __atomic_sub_fetch(&pool->pending, (long) (task.end - task.begin), __ATOMIC_ACQ_REL);
+}
+
+// Workers spin (yielding) while a loop is in flight, since more ranges may
+// still be split off, and park once it is done.
+static void* worker_main(void* arg) {
+    struct TaskWorker* worker = (struct TaskWorker*) arg;
+    struct TaskPool* pool = worker->pool;
+    current_worker = worker->index;
+    unsigned int seen = 0;
+    for (;;) {
+        struct Task task;
+        if (find_task(pool, worker, &task)) {
+            run_task(pool, worker, task);
+            continue;
+        }
+        if (__atomic_load_n(&pool->pending, __ATOMIC_ACQUIRE) > 0) {
+            sched_yield();
+            continue;
+        }
+        pthread_mutex_lock(&pool->lock);
+        while (!pool->shutdown && pool->generation == seen) {
+            pthread_cond_wait(&pool->wake, &pool->lock);
+        }
+        seen = pool->generation;
+        int stop = pool->shutdown;
+        pthread_mutex_unlock(&pool->lock);
+        if (stop) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+void task_pool_init(struct TaskPool* pool, int num_workers) {
+    if (num_workers <= 0) {
+        num_workers = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (num_workers < 1) {
+        num_workers = 1;
+    }
+    pool->workers = (struct TaskWorker*) aligned_alloc(alignof(struct TaskWorker), num_workers*sizeof(struct TaskWorker));
+    memset(pool->workers, 0, num_workers*sizeof(struct TaskWorker));
+    pool->num_workers = num_workers;
+    pool->pending = 0;
+    pool->generation = 0;
+    pool->shutdown = 0;
+    pool->active = 0;
+    pool->loop_time = 0.0;
+    pool->loops = 0;
+    pool->contended = 0;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    for (int w = 0; w < num_workers; w++) {
+        struct TaskWorker* worker = &pool->workers[w];
+        worker->pool = pool;
+        worker->index = w;
+        worker->rng = 2654435761u*(w + 1);
+        if (w > 0) {
+            pthread_create(&worker->thread, NULL, worker_main, worker);
+        }
+    }
+}
+
+void task_pool_free(struct TaskPool* pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+    for (int w = 1; w < pool->num_workers; w++) {
+        pthread_join(pool->workers[w].thread, NULL);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->wake);
+    free(pool->workers);
+    pool->workers = NULL;
+    pool->num_workers = 0;
+}
+
+void task_pool_for(struct TaskPool* pool, int begin, int end, int grain, task_range_fn fn, void* context) {
+    if (end <= begin) {
+        return;
+    }
+    if (current_worker >= 0 || pool->num_workers == 0) {
+        fn(context, begin, end);
+        return;
+    }
+    if (__atomic_exchange_n(&pool->active, 1, __ATOMIC_ACQUIRE)) {
+        __atomic_add_fetch(&pool->contended, 1, __ATOMIC_RELAXED);
+        fn(context, begin, end);
+        return;
+    }
+    double start = now();
+    struct TaskWorker* self = &pool->workers[0];
+    current_worker = 0;
+    struct Task root = {fn, context, begin, end, grain > 0 ? grain : 1};
+    __atomic_store_n(&pool->pending, (long) (end - begin), __ATOMIC_RELEASE);
+    deque_push(&self->deque, &root);
+    if (pool->num_workers > 1) {
+        pthread_mutex_lock(&pool->lock);
+        pool->generation++;
+        pthread_cond_broadcast(&pool->wake);
+        pthread_mutex_unlock(&pool->lock);
+    }
+    while (__atomic_load_n(&pool->pending, __ATOMIC_ACQUIRE) > 0) {
+        struct Task task;
+        if (find_task(pool, self, &task)) {
+            run_task(pool, self, task);
+        } else {
+            sched_yield();
+        }
+    }
+    current_worker = -1;
+    pool->loop_time += now() - start;
+    pool->loops++;
+    __atomic_store_n(&pool->active, 0, __ATOMIC_RELEASE);
+}
+
+void task_pool_reset_stats(struct TaskPool* pool) {
+    for (int w = 0; w < pool->num_workers; w++) {
+        pool->workers[w].busy = 0.0;
+        pool->workers[w].tasks = 0;
+        pool->workers[w].steals = 0;
+    }
+    pool->loop_time = 0.0;
+    pool->loops = 0;
+    pool->contended = 0;
+}
+
+// Per-worker busy time per step, and its share of the time spent in loops.
+void task_pool_print_stats(const struct TaskPool* pool, const char* name, int steps) {
+    printf("%s: %d workers, %.3f ms/step in %ld loops\n", name, pool->num_workers, 1000.0*pool->loop_time/steps, pool->loops);
+    for (int w = 0; w < pool->num_workers; w++) {
+        const struct TaskWorker* worker = &pool->workers[w];
+        printf("    worker %2d %10.3f ms/step busy (%5.1f%%), %8ld tasks, %6ld steals\n", w, 1000.0*worker->busy/steps,
+            pool->loop_time > 0.0 ? 100.0*worker->busy/pool->loop_time : 0.0, worker->tasks, worker->steals);
+    }
+}
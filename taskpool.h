@@ -0,0 +1,83 @@
+#ifndef TASKPOOL_H
+#define TASKPOOL_H
+
+#include <pthread.h>
+
+// Work-stealing pool for the parallel loops of a simulation step. Each worker
+// owns a deque of index ranges: it splits the range it is running in halves,
+// pushing the upper half for others to steal and running the lower half
+// itself until the piece is no larger than the grain. Idle workers steal the
+// oldest (largest) range from a random victim, so uneven per-particle costs
+// spread over every worker without a fixed partition. Between loops workers
+// park on a condition variable.
+//
+// The thread calling task_pool_for() joins in as worker 0 until the loop is
+// done. Loops started from inside a task, or from another thread while a
+// loop is running, run inline on the calling thread.
+const int task_deque_capacity = 256;
+
+typedef void (*task_range_fn)(void* context, int begin, int end);
+
+struct Task {
+    task_range_fn fn;
+    void* context;
+    int begin;
+    int end;
+    int grain;
+};
+
+// Chase-Lev deque: the owner pushes and pops at bottom, thieves take from top.
+struct TaskDeque {
+    long top;
+    long bottom;
+    struct Task tasks[task_deque_capacity];
+};
+
+struct alignas(64) TaskWorker {
+    struct TaskDeque deque;
+    struct TaskPool* pool;
+    pthread_t thread;
+    int index;
+    unsigned int rng;
+    // Seconds spent running task bodies, tasks run and ranges stolen since
+    // the last task_pool_reset_stats().
+    double busy;
+    long tasks;
+    long steals;
+};
+
+struct TaskPool {
+    struct TaskWorker* workers;
+    int num_workers;
+    // Loop iterations not yet run; the loop is complete when this hits 0.
+    long pending;
+    unsigned int generation;
+    int shutdown;
+    // Set while a loop is running; a loop started meanwhile by another
+    // thread runs inline on that thread.
+    int active;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    // Wall time spent inside task_pool_for() and loops run since the last
+    // task_pool_reset_stats().
+    double loop_time;
+    long loops;
+    // Loops that found another thread's loop running and ran inline on one
+    // thread instead.
+    long contended;
+};
+
+// num_workers counts the calling thread; 0 uses one per online CPU.
+void task_pool_init(struct TaskPool* pool, int num_workers);
+void task_pool_free(struct TaskPool* pool);
+void task_pool_for(struct TaskPool* pool, int begin, int end, int grain, task_range_fn fn, void* context);
+void task_pool_reset_stats(struct TaskPool* pool);
+void task_pool_print_stats(const struct TaskPool* pool, const char* name, int steps);
+
+// Runs body(begin, end) over pieces of [begin, end) no larger than grain.
+template <typename F>
+void task_for(struct TaskPool* pool, int begin, int end, int grain, const F& body) {
+    task_pool_for(pool, begin, end, grain, [](void* context, int b, int e) { (*(const F*) context)(b, e); }, (void*) &body);
+}
+
+#endif
@@ -0,0 +1,81 @@
+#ifndef VEC_H
+#define VEC_H
+
+#include <math.h>
+
+const float pi = 3.14159265f;
+
+// Fixed-dimension float vector. Every kernel is written as a loop over D so
+// the same code compiles (and fully unrolls) for 2D and 3D simulations.
+template <int D>
+struct vec {
+    float c[D];
+
+    float& operator[](int i) { return c[i]; }
+    const float& operator[](int i) const { return c[i]; }
+};
+
+typedef vec<2> vec2;
+typedef vec<3> vec3;
+
+template <int D>
+inline vec<D> vec_zero() {
+    vec<D> v;
+    for (int d = 0; d < D; d++) v[d] = 0.0f;
+    return v;
+}
+
+template <int D>
+inline vec<D> operator+(vec<D> a, const vec<D>& b) {
+    for (int d = 0; d < D; d++) a[d] += b[d];
+    return a;
+}
+
+template <int D>
+inline vec<D> operator-(vec<D> a, const vec<D>& b) {
+    for (int d = 0; d < D; d++) a[d] -= b[d];
+    return a;
+}
+
+template <int D>
+inline vec<D> operator*(vec<D> a, float s) {
+    for (int d = 0; d < D; d++) a[d] *= s;
+    return a;
+}
+
+template <int D>
+inline vec<D>& operator+=(vec<D>& a, const vec<D>& b) {
+    for (int d = 0; d < D; d++) a[d] += b[d];
+    return a;
+}
+
+template <int D>
+inline vec<D>& operator-=(vec<D>& a, const vec<D>& b) {
+    for (int d = 0; d < D; d++) a[d] -= b[d];
+    return a;
+}
+
+template <int D>
+inline float dot(const vec<D>& a, const vec<D>& b) {
+    float sum = 0.0f;
+    for (int d = 0; d < D; d++) sum += a[d]*b[d];
+    return sum;
+}
+
+template <int D>
+inline float magnitude(const vec<D>& v) {
+    return sqrtf(dot(v, v));
+}
+
+template <int D>
+inline float dist_sq(const vec<D>& v1, const vec<D>& v2) {
+    vec<D> delta = v1 - v2;
+    return dot(delta, delta);
+}
+
+template <int D>
+inline float dist(const vec<D>& v1, const vec<D>& v2) {
+    return sqrtf(dist_sq(v1, v2));
+}
+
+#endif
@@ -0,0 +1,203 @@
+#include "wisdom_holman.h"
+
+#include <math.h>
+
+const int kepler_max_iterations = 50;
+const double kepler_tolerance = 1e-12;
+
+template <int D>
+int wh_central(const particle<D>* points, int num_points) {
+    int central = 0;
+    for (int i = 1; i < num_points; i++) {
+        if (points[i].mass > points[central].mass) {
+            central = i;
+        }
+    }
+    return central;
+}
+
+template <int D>
+void wh_to_democratic(particle<D>* points, int num_points, int central, wh_frame<D>* frame) {
+    float total_mass = 0.0f;
+    vec<D> moment = vec_zero<D>();
+    vec<D> momentum = vec_zero<D>();
+    for (int i = 0; i < num_points; i++) {
+        total_mass += points[i].mass;
+        moment += points[i].position * points[i].mass;
+        momentum += points[i].velocity * points[i].mass;
+    }
+    frame->total_mass = total_mass;
+    frame->com_position = moment * (1.0f/total_mass);
+    frame->com_velocity = momentum * (1.0f/total_mass);
+
+    vec<D> origin = points[central].position;
+    #pragma omp parallel for
+    for (int i = 0; i < num_points; i++) {
+        points[i].position -= origin;
+        points[i].velocity -= frame->com_velocity;
+    }
+}
+
+// Inverse of wh_to_democratic; frame.com_position must already be advanced
+// to the current time. The central body is placed so the barycenter is
+// preserved and given the momentum that balances everything else.
+template <int D>
+void wh_from_democratic(particle<D>* points, int num_points, int central, const wh_frame<D>& frame) {
+    vec<D> moment = vec_zero<D>();
+    vec<D> momentum = vec_zero<D>();
+    for (int i = 0; i < num_points; i++) {
+        if (i != central) {
+            moment += points[i].position * points[i].mass;
+            momentum += points[i].velocity * points[i].mass;
+        }
+    }
+    vec<D> origin = frame.com_position - moment * (1.0f/frame.total_mass);
+    points[central].position = vec_zero<D>();
+    points[central].velocity = momentum * (-1.0f/points[central].mass);
+    #pragma omp parallel for
+    for (int i = 0; i < num_points; i++) {
+        points[i].position += origin;
+        points[i].velocity += frame.com_velocity;
+    }
+}
+
+// The central body's barycentric velocity is implied by everyone else's
+// momenta and is not evolved; refresh it before anything (such as a merge)
+// reads it.
+template <int D>
+void wh_sync_central(particle<D>* points, int num_points, int central) {
+    vec<D> momentum = vec_zero<D>();
+    for (int i = 0; i < num_points; i++) {
+        if (i != central) {
+            momentum += points[i].velocity * points[i].mass;
+        }
+    }
+    points[central].velocity = momentum * (-1.0f/points[central].mass);
+}
+
+template <int D>
+void wh_kick(particle<D>* points, int num_points, int central, float dt) {
+    #pragma omp parallel for
+    for (int i = 0; i < num_points; i++) {
+        if (i != central) {
+            points[i].velocity += points[i].acceleration * dt;
+        }
+    }
+}
+
+template <int D>
+void wh_jump(particle<D>* points, int num_points, int central, float dt) {
+    vec<D> momentum = vec_zero<D>();
+    for (int i = 0; i < num_points; i++) {
+        if (i != central) {
+            momentum += points[i].velocity * points[i].mass;
+        }
+    }
+    vec<D> shift = momentum * (dt/points[central].mass);
+    #pragma omp parallel for
+    for (int i = 0; i < num_points; i++) {
+        if (i != central) {
+            points[i].position += shift;
+        }
+    }
+}
+
+template <int D>
+void wh_drift(particle<D>* points, int num_points, int central, double mu, float dt) {
+    #pragma omp parallel for schedule(dynamic, 256)
+    for (int i = 0; i < num_points; i++) {
+        if (i != central) {
+            kepler_drift(&points[i].position, &points[i].velocity, mu, dt);
+        }
+    }
+}
+
+// Stumpff functions c2(z) and c3(z), with series near zero where the closed
+// forms lose precision.
+void stumpff(double z, double* c2, double* c3) {
+    if (z > 1e-4) {
+        double s = sqrt(z);
+        *c2 = (1.0 - cos(s))/z;
+        *c3 = (s - sin(s))/(z*s);
+    } else if (z < -1e-4) {
+        double s = sqrt(-z);
+        *c2 = (cosh(s) - 1.0)/(-z);
+        *c3 = (sinh(s) - s)/(-z*s);
+    } else {
+        *c2 = 0.5 - z/24.0 + z*z/720.0;
+        *c3 = 1.0/6.0 - z/120.0 + z*z/5040.0;
+    }
+}
+
+// Advances a two-body orbit with gravitational parameter mu by dt using the
+// universal-variable f and g functions, so elliptic, parabolic and
+// hyperbolic orbits share one code path.
+template <int D>
+void kepler_drift(vec<D>* position, vec<D>* velocity, double mu, double dt) {
+    double r0[D], v0[D];
+    double r0_sq = 0.0, v0_sq = 0.0, r0_dot_v0 = 0.0;
+    for (int d = 0; d < D; d++) {
+        r0[d] = (*position)[d];
+        v0[d] = (*velocity)[d];
+        r0_sq += r0[d]*r0[d];
+        v0_sq += v0[d]*v0[d];
+        r0_dot_v0 += r0[d]*v0[d];
+    }
+    double r0_len = sqrt(r0_sq);
+    if (r0_len == 0.0 || mu <= 0.0) {
+        for (int d = 0; d < D; d++) {
+            (*position)[d] += (float) (v0[d]*dt);
+        }
+        return;
+    }
+    double sqrt_mu = sqrt(mu);
+    double alpha = 2.0/r0_len - v0_sq/mu;
+    double sigma = r0_dot_v0/sqrt_mu;
+
+    // Newton iteration on the universal Kepler equation for chi.
+    double chi = sqrt_mu*fabs(alpha)*dt;
+    if (alpha <= 0.0 || chi == 0.0) {
+        chi = sqrt_mu*dt/r0_len;
+    }
+    double c2 = 0.5, c3 = 1.0/6.0, r = r0_len;
+    for (int it = 0; it < kepler_max_iterations; it++) {
+        double chi_sq = chi*chi;
+        stumpff(alpha*chi_sq, &c2, &c3);
+        double f = sigma*chi_sq*c2 + (1.0 - alpha*r0_len)*chi_sq*chi*c3 + r0_len*chi - sqrt_mu*dt;
+        r = sigma*chi*(1.0 - alpha*chi_sq*c3) + (1.0 - alpha*r0_len)*chi_sq*c2 + r0_len;
+        double step = f/r;
+        chi -= step;
+        if (fabs(step) <= kepler_tolerance*fmax(1.0, fabs(chi))) {
+            break;
+        }
+    }
+    double chi_sq = chi*chi;
+    stumpff(alpha*chi_sq, &c2, &c3);
+    r = sigma*chi*(1.0 - alpha*chi_sq*c3) + (1.0 - alpha*r0_len)*chi_sq*c2 + r0_len;
+
+    double f = 1.0 - chi_sq*c2/r0_len;
+    double g = dt - chi_sq*chi*c3/sqrt_mu;
+    double f_dot = sqrt_mu/(r*r0_len)*chi*(alpha*chi_sq*c3 - 1.0);
+    double g_dot = 1.0 - chi_sq*c2/r;
+    for (int d = 0; d < D; d++) {
+        (*position)[d] = (float) (f*r0[d] + g*v0[d]);
+        (*velocity)[d] = (float) (f_dot*r0[d] + g_dot*v0[d]);
+    }
+}
+
+template int wh_central<2>(const particle<2>* points, int num_points);
+template int wh_central<3>(const particle<3>* points, int num_points);
+template void wh_to_democratic<2>(particle<2>* points, int num_points, int central, wh_frame<2>* frame);
+template void wh_to_democratic<3>(particle<3>* points, int num_points, int central, wh_frame<3>* frame);
+template void wh_from_democratic<2>(particle<2>* points, int num_points, int central, const wh_frame<2>& frame);
+template void wh_from_democratic<3>(particle<3>* points, int num_points, int central, const wh_frame<3>& frame);
+template void wh_sync_central<2>(particle<2>* points, int num_points, int central);
+template void wh_sync_central<3>(particle<3>* points, int num_points, int central);
+template void wh_kick<2>(particle<2>* points, int num_points, int central, float dt);
+template void wh_kick<3>(particle<3>* points, int num_points, int central, float dt);
+template void wh_jump<2>(particle<2>* points, int num_points, int central, float dt);
+template void wh_jump<3>(particle<3>* points, int num_points, int central, float dt);
+template void wh_drift<2>(particle<2>* points, int num_points, int central, double mu, float dt);
+template void wh_drift<3>(particle<3>* points, int num_points, int central, double mu, float dt);
+template void kepler_drift<2>(vec<2>* position, vec<2>* velocity, double mu, double dt);
+template void kepler_drift<3>(vec<3>* position, vec<3>* velocity, double mu, double dt);
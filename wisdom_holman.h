@@ -0,0 +1,38 @@
+#ifndef WISDOM_HOLMAN_H
+#define WISDOM_HOLMAN_H
+
+#include "particle.h"
+
+// Mixed-variable symplectic integration around one dominant mass, in
+// democratic heliocentric coordinates: positions relative to the central
+// body, velocities relative to the barycenter. Each body follows its Kepler
+// orbit about the central mass exactly (wh_drift); mutual interactions enter
+// as velocity kicks (wh_kick) and the central body's reflex motion as a
+// linear drift of all positions (wh_jump). The usual step is
+//     kick(dt/2) jump(dt/2) drift(dt) jump(dt/2) kick(dt/2)
+// with the interaction accelerations stored in particle::acceleration.
+template <int D>
+struct wh_frame {
+    vec<D> com_position;
+    vec<D> com_velocity;
+    float total_mass;
+};
+
+template <int D>
+int wh_central(const particle<D>* points, int num_points);
+template <int D>
+void wh_to_democratic(particle<D>* points, int num_points, int central, wh_frame<D>* frame);
+template <int D>
+void wh_from_democratic(particle<D>* points, int num_points, int central, const wh_frame<D>& frame);
+template <int D>
+void wh_sync_central(particle<D>* points, int num_points, int central);
+template <int D>
+void wh_kick(particle<D>* points, int num_points, int central, float dt);
+template <int D>
+void wh_jump(particle<D>* points, int num_points, int central, float dt);
+template <int D>
+void wh_drift(particle<D>* points, int num_points, int central, double mu, float dt);
+template <int D>
+void kepler_drift(vec<D>* position, vec<D>* velocity, double mu, double dt);
+
+#endif